@@ -36,6 +36,12 @@ void IIOSession::setSendqueueLimit( int32_t limit )
     iolayer_set_sndqlimit( m_Layer, m_Sid, limit );
 }
 
+void IIOSession::setTransformKey( uint64_t key )
+{
+    assert( m_Sid != 0 && m_Layer != nullptr );
+    iolayer_set_transformkey( m_Layer, m_Sid, key );
+}
+
 void IIOSession::setMTU( int32_t mtu )
 {
     assert( m_Sid != 0 && m_Layer != nullptr );
@@ -365,6 +371,27 @@ int32_t IIOService::broadcast( const sids_t & ids, const char * buffer, size_t n
     return iolayer_broadcast( m_IOLayer, const_cast<sid_t *>( &(*start) ), count, buffer, nbytes );
 }
 
+int32_t IIOService::join( uint64_t group, sid_t id )
+{
+    return iolayer_join_group( m_IOLayer, group, id );
+}
+
+int32_t IIOService::leave( uint64_t group, sid_t id )
+{
+    return iolayer_leave_group( m_IOLayer, group, id );
+}
+
+int32_t IIOService::publish( uint64_t group, const std::string & buffer )
+{
+    return iolayer_broadcast_group( m_IOLayer, group,
+            static_cast<const char *>(buffer.data()), buffer.size() );
+}
+
+int32_t IIOService::publish( uint64_t group, const char * buffer, size_t nbytes )
+{
+    return iolayer_broadcast_group( m_IOLayer, group, buffer, nbytes );
+}
+
 int32_t IIOService::invoke( void * task, taskcloner_t clone, taskexecutor_t execute )
 {
     return iolayer_invoke( m_IOLayer, task, clone, execute );
@@ -71,6 +71,8 @@ public:
     void setEndpoint( const std::string & host, uint16_t port );
     // 设置发送队列长度
     void setSendqueueLimit( int32_t limit );
+    // 设置数据改造的类型, 相同类型的会话共享广播的改造结果
+    void setTransformKey( uint64_t key );
     // 设置KCP的MTU
     void setMTU( int32_t mtu );
     // 设置KCP的MinRTO
@@ -199,6 +201,12 @@ public:
     int32_t broadcast( const sids_t & ids, const std::string & buffer );
     int32_t broadcast( const sids_t & ids, const char * buffer, size_t nbytes );
 
+    // 广播组
+    int32_t join( uint64_t group, sid_t id );
+    int32_t leave( uint64_t group, sid_t id );
+    int32_t publish( uint64_t group, const std::string & buffer );
+    int32_t publish( uint64_t group, const char * buffer, size_t nbytes );
+
     // 终止会话
     int32_t shutdown( sid_t id );
     int32_t shutdown( const sids_t & ids );
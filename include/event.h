@@ -44,6 +44,7 @@ extern "C" {
 #define EV_WRITE 0x02   // 写事件
 #define EV_TIMEOUT 0x04 // 超时事件
 #define EV_PERSIST 0x08 // 永久模式
+#define EV_ET 0x10      // 边缘触发模式(仅epoll有效, 其他机制下等同于水平触发)
 
 //
 // 事件的定义, 以及事件集的定义
@@ -56,6 +57,10 @@ typedef void ( *eventcb_t )( int32_t, int16_t, void * );
 // 时间精度
 #define TIMER_PRECISION 8 // 时间精度
 
+// 事件集的创建标志
+#define EVSETS_IOURING 0x01 // 使用io_uring(仅Linux, 内核不支持时回退到epoll)
+#define EVSETS_HIGHRES 0x02 // 高精度定时器(Linux下由timerfd唤醒), precision的单位为微秒
+
 //
 // 事件的方法
 //
@@ -96,12 +101,22 @@ void event_destroy( event_t self );
 // 创建事件集(TIMER_PRECISION)
 evsets_t evsets_create( int32_t precision );
 
+// 创建事件集
+//      precision   - 时间精度(TIMER_PRECISION), EVSETS_HIGHRES模式下单位为微秒
+//      flags       - 创建标志(EVSETS_IOURING, EVSETS_HIGHRES)
+evsets_t evsets_create2( int32_t precision, int32_t flags );
+
 // 事件库的版本
 const char * evsets_get_version();
 
 // 获取缓存的时间戳
 int64_t evsets_get_current( evsets_t self );
 
+// 获取修改关注事件的系统调用统计(epoll)
+//      calls   - 实际调用epoll_ctl()的次数
+//      saved   - 变更列表合并后节省的次数
+void evsets_get_ctlstats( evsets_t self, uint64_t * calls, uint64_t * saved );
+
 // 向事件集中添加事件
 //      self    -
 //      ev      - 事件
@@ -120,6 +135,10 @@ int32_t evsets_del( evsets_t self, event_t ev );
 // 返回激活的事件个数
 int32_t evsets_dispatch( evsets_t self );
 
+// 非阻塞的分发并处理事件(忙轮询)
+// 返回激活的事件个数
+int32_t evsets_poll( evsets_t self );
+
 // 销毁事件集
 void evsets_destroy( evsets_t self );
 
@@ -62,6 +62,44 @@ typedef struct
     int32_t ntransfer; // 中转描述符个数, 默认值16
 } options_t;
 
+// 网络层的扩展配置(iolayer_create2())
+typedef struct
+{
+    int32_t iouring;     // 使用io_uring作为事件通知机制, 默认值0(内核不支持时回退到epoll)
+    int32_t edgetrigger; // TCP会话使用边缘触发模式(读事件常驻), 默认值0
+    int32_t highres;     // 高精度定时器, 默认值0(开启后precision的单位为微秒)
+    int32_t busypoll;    // 忙轮询的时间(微秒), 网络线程空闲超过该时间后阻塞等待, 默认值0(关闭)
+                         // 同时为TCP会话开启SO_BUSY_POLL(需要CAP_NET_ADMIN权限)
+    uint32_t queuelimit; // 每个网络线程任务队列的容量, 默认值0(不限制)
+    int32_t queuepolicy; // 任务队列满时的处理策略, 默认值0(立即返回IOLAYER_EQUEUEFULL)
+                         // 1-阻塞等待queuetimeout毫秒; 2-丢弃最早的发送/广播任务
+    int32_t queuetimeout; // 任务队列满时阻塞等待的时间(毫秒)
+    const int32_t * cpus; // 每个网络线程绑定的CPU(数组长度为nthreads, -1表示不绑定), 默认值NULL(不绑定)
+                          // 尽力而为: 网络线程的内存在绑定的CPU上分配, 按照首次访问(first-touch)的策略落在对应的NUMA节点上,
+                          // 会话表等新映射的大块内存有效, 和其他内存共享页面的小对象(struct iothread等)不保证
+    int32_t incomingcpu;  // SO_REUSEPORT的监听套接字设置SO_INCOMING_CPU为网络线程绑定的CPU, 默认值0
+    int32_t placement;    // 会话的分配策略(IOLAYER_PLACEMENT_xxx), 默认值0(取模或者轮询)
+    uint8_t maxthreads;   // 网络线程数的上限(iolayer_add_thread()), 默认值0(等于nthreads)
+} ioconfig_t;
+
+// 网络线程的任务队列已满(iolayer_send(), iolayer_broadcast()等的返回值)
+#define IOLAYER_EQUEUEFULL ( -2 )
+
+// 网络线程的负载
+typedef struct
+{
+    uint32_t nsessions; // 会话数
+    uint32_t cpuload;   // 最近的CPU占用率(千分比)
+    uint32_t queuesize; // 任务队列长度
+} ioload_t;
+
+// 会话的分配策略
+// 决定accept(), connect(), associate()的会话由哪个网络线程管理
+#define IOLAYER_PLACEMENT_MODULO        0 // 描述符取模或者轮询
+#define IOLAYER_PLACEMENT_LEASTSESSIONS 1 // 会话数最少的网络线程
+#define IOLAYER_PLACEMENT_LEASTCPU      2 // 最近CPU占用率最低的网络线程
+#define IOLAYER_PLACEMENT_LEASTQUEUE    3 // 任务队列最短的网络线程
+
 // IO服务
 //        start()       - 网络就绪的回调
 //        process()     - 收到数据包的回调
@@ -97,11 +135,32 @@ typedef struct
 } ioservice_t;
 
 // 创建网络层
-//        nthreads      - 网络线程数
+//        nthreads      - 网络线程数, 0: 嵌入模式, 不创建网络线程,
+//                        由创建网络层的线程调用iolayer_poll()驱动, 该线程中的接口都直接执行
 //        nclients      - 网络层服务的连接数
 //        precision     - 事件集的时间精度(建议值为8ms)
 iolayer_t iolayer_create( uint8_t nthreads, uint32_t nclients, int32_t precision );
 
+// 创建网络层(扩展配置)
+//        config        - 扩展配置, NULL表示使用默认配置
+iolayer_t iolayer_create2( uint8_t nthreads, uint32_t nclients, int32_t precision, const ioconfig_t * config );
+
+// 网络层设置会话的分配策略
+//        policy        - 分配策略(IOLAYER_PLACEMENT_xxx)
+int32_t iolayer_set_placement( iolayer_t self, int32_t policy );
+
+// 自定义会话的分配方法
+//      参数1: 上下文参数
+//      参数2: 各个网络线程的负载(参考ioload_t的定义)
+//      参数3: 网络线程数
+//      返回值: 网络线程的编号
+typedef uint8_t ( *placer_t )( void *, const ioload_t *, uint8_t );
+// 网络层设置自定义的分配方法, 优先于分配策略, NULL表示取消
+int32_t iolayer_set_placer( iolayer_t self, placer_t placer, void * context );
+
+// 获取指定网络线程的负载
+int32_t iolayer_get_load( iolayer_t self, uint8_t index, ioload_t * load );
+
 // 网络层设置线程上下文参数(在listen(), connect(), associate()之前调用)
 //        self          -
 //        contexts      - 上下文参数数组, 每个网络线程设置上下文参数
@@ -184,6 +243,14 @@ int32_t iolayer_set_service( iolayer_t self, sid_t id, ioservice_t * service, vo
 int32_t iolayer_set_persist( iolayer_t self, sid_t id, int32_t onoff );
 // 设置发送队列阈值, 超过阈值关闭连接( 默认为0: 不限制 )
 int32_t iolayer_set_sndqlimit( iolayer_t self, sid_t id, int32_t queuelimit );
+// 设置零拷贝发送的阈值, 不小于阈值的消息使用MSG_ZEROCOPY发送( 默认为0: 关闭; 仅支持Linux 4.14以上的TCP会话 )
+// 消息在收到内核的完成通知后才释放, 适合64KB以上的大消息; 内核回退到拷贝时(例如回环地址)自动关闭
+// iolayer_send()指定由网络层释放缓冲区时, 大消息不需要复制
+int32_t iolayer_set_zerocopy( iolayer_t self, sid_t id, size_t threshold );
+// 设置数据改造的类型( 默认为0: 不共享 )
+// 相同类型的会话对相同的数据必须得到相同的改造结果(例如共享密钥的加密, 相同参数的压缩)
+// 广播时每个网络线程对每种类型只改造一次, 改造后的消息由这些会话共享发送
+int32_t iolayer_set_transformkey( iolayer_t self, sid_t id, uint64_t key );
 // 设置kcp的窗口, MTU, MINRTO
 int32_t iolayer_set_mtu( iolayer_t self, sid_t id, int32_t mtu );
 int32_t iolayer_set_minrto( iolayer_t self, sid_t id, int32_t minrto );
@@ -194,14 +261,45 @@ int32_t iolayer_set_wndsize( iolayer_t self, sid_t id, int32_t sndwnd, int32_t r
 //      buf             - 要发送的缓冲区
 //      nbytes          - 要发送的长度
 //      isfree          - 1-由网络层释放缓冲区, 0-网络层需要Copy缓冲区
+// 返回值: 0-成功, IOLAYER_EQUEUEFULL-网络线程的任务队列已满(缓冲区已被网络层释放)
 int32_t iolayer_send( iolayer_t self, sid_t id, const char * buf, size_t nbytes, int32_t isfree );
 
+// 批量发送的数据
+typedef struct
+{
+    sid_t id;         // 会话ID
+    const char * buf; // 要发送的缓冲区
+    size_t nbytes;    // 要发送的长度
+} iomessage_t;
+
+// 批量发送数据到多个会话
+// 按照网络线程分组, 每个网络线程只加锁一次, 最多唤醒一次
+//      messages        - 要发送的数据数组
+//      count           - 数组长度
+//      isfree          - 1-由网络层释放缓冲区, 0-网络层需要Copy缓冲区
+// 返回值: 成功提交的数据个数, 提交失败的缓冲区已被网络层释放(isfree==1)
+int32_t iolayer_sendmany( iolayer_t self, const iomessage_t * messages, uint32_t count, int32_t isfree );
+
 // 广播数据到指定的会话
+// 返回值: 0-成功, IOLAYER_EQUEUEFULL-部分网络线程的任务队列已满
 int32_t iolayer_broadcast( iolayer_t self, sid_t * ids, uint32_t count, const char * buf, size_t nbytes );
 
 // 广播数据到IO层的所有会话
 int32_t iolayer_broadcast2( iolayer_t self, const char * buf, size_t nbytes );
 
+// 广播组
+// 每个网络线程维护本线程中的组成员, 广播时每个网络线程只需要一次跨线程任务
+// 会话终止时自动离开所有的广播组, 迁移时随会话一起迁移
+//      group           - 广播组ID, 由逻辑层分配
+int32_t iolayer_join_group( iolayer_t self, uint64_t group, sid_t id );
+int32_t iolayer_leave_group( iolayer_t self, uint64_t group, sid_t id );
+// 广播数据到广播组的所有会话
+// 返回值: 0-成功, IOLAYER_EQUEUEFULL-部分网络线程的任务队列已满
+int32_t iolayer_broadcast_group( iolayer_t self, uint64_t group, const char * buf, size_t nbytes );
+
+// 获取指定网络线程的任务队列长度
+uint32_t iolayer_get_queuesize( iolayer_t self, uint8_t index );
+
 // 终止指定的会话
 // 此处需要注意, 主动终止会话的情况下,也会收到shutdown()的回调, 只是way==0
 int32_t iolayer_shutdown( iolayer_t self, sid_t id );
@@ -216,10 +314,19 @@ typedef void * ( *taskcloner_t )( void * );
 typedef void ( *taskexecutor_t )( void *, void * );
 // 提交任务到网络层
 //      task            - 任务
-//      clone           - 任务复制函数(参考taskcloner_t的定义), 如果为NULL, 随机选择一个网络线程投递
+//      clone           - 任务复制函数(参考taskcloner_t的定义), 如果为NULL, 由任意一个网络线程执行,
+//                        空闲的网络线程会窃取其他网络线程积压的任务
 //      execute         - 任务处理函数(参考taskexecutor_t的定义)
 int32_t iolayer_invoke( iolayer_t self, void * task, taskcloner_t clone, taskexecutor_t execute );
 
+// 提交任务到指定的网络线程
+//      index           - 网络线程的编号
+int32_t iolayer_invoke_thread( iolayer_t self, uint8_t index, void * task, taskexecutor_t execute );
+
+// 提交任务到会话所在的网络线程(会话迁移后, 在迁入的网络线程中执行)
+//      id              - 会话ID, 会话不存在时, 仍然在会话ID所属的网络线程中执行
+int32_t iolayer_invoke_session( iolayer_t self, sid_t id, void * task, taskexecutor_t execute );
+
 // 任务回收函数
 //      参数1: 类型
 //      参数2: 任务
@@ -233,6 +340,34 @@ typedef void ( *taskrecycler_t )( int32_t, void *, int32_t );
 //      recycle         - 任务回收函数(参考taskrecycler_t的定义)
 int32_t iolayer_perform( iolayer_t self, sid_t id, int32_t type, void * task, int32_t interval, taskrecycler_t recycle );
 
+// 迁移会话到指定的网络线程
+//      id              - 会话ID
+//      index           - 目标网络线程
+// 迁移后会话获得新的会话ID, 旧的会话ID仍然可以继续使用(发送, 广播, 终止, 分派任务等)
+// 接收缓冲区, 发送队列以及定时任务一起迁移, 定时器在目标线程中重新计时
+// 只支持TCP会话, KCP会话以及正在终止的会话不能迁移
+int32_t iolayer_migrate( iolayer_t self, sid_t id, uint8_t index );
+
+// 运行期间增加一个网络线程(优先恢复退役的网络线程), 不能超过ioconfig_t.maxthreads
+//      cpu             - 绑定的CPU, -1表示不绑定(恢复退役的网络线程时忽略)
+//      iocontext       - 网络线程的上下文参数(参考iolayer_set_iocontext())
+// 新的网络线程按照SO_REUSEPORT重新监听iolayer_listen()的端口, 并参与会话的分配
+// 返回值: 网络线程的编号, <0-失败
+int32_t iolayer_add_thread( iolayer_t self, int32_t cpu, void * iocontext );
+
+// 退役一个网络线程
+//      index           - 网络线程的编号
+// 退役的网络线程停止监听TCP端口, 不再分配新的会话, 已有的TCP会话迁移到其他网络线程
+// 网络线程不会退出, 继续转发迁出会话的旧会话ID, 以及管理KCP会话和无法迁移的会话
+// 关闭监听套接字的瞬间完成握手的连接会被内核重置, 开启net.ipv4.tcp_migrate_req(Linux 5.14)可以避免
+// iolayer_add_thread()和iolayer_retire_thread()需要在同一个线程中调用
+int32_t iolayer_retire_thread( iolayer_t self, uint8_t index );
+
+// 驱动嵌入模式的网络层(nthreads为0), 只能在创建网络层的线程中调用
+//        timeout       - 等待的时间(毫秒), 0-不等待, -1-一直等待, 直到有事件或者任务
+// 返回值: 处理的事件和任务数, <0-失败
+int32_t iolayer_poll( iolayer_t self, int32_t timeout );
+
 // 停止网络服务
 // 行为定义:
 //      1. 停止对外提供接入服务, 不再接受新的连接;
@@ -43,15 +43,71 @@ extern "C" {
 typedef void * iothreads_t;
 typedef void ( *processor_t )( void *, uint8_t, int16_t, void * );
 
+// 任务队列满时的处理策略
+#define IOTHREADS_QUEUE_FAILFAST   0 // 立即返回IOTHREADS_EQUEUEFULL(默认)
+#define IOTHREADS_QUEUE_BLOCK      1 // 阻塞等待, 超时后返回IOTHREADS_EQUEUEFULL
+#define IOTHREADS_QUEUE_DROPOLDEST 2 // 丢弃队列中最早的可丢弃任务, 没有可丢弃的任务时立即返回失败
+
+// 提交任务的选项
+#define IOTHREADS_POST_NOLIMIT   0x01 // 不受队列容量的限制(控制类任务)
+#define IOTHREADS_POST_DROPPABLE 0x02 // 队列满时可以被丢弃
+
+// 任务队列已满
+#define IOTHREADS_EQUEUEFULL ( -2 )
+
 // 创建网络线程组
 // nthreads         - 网络线程组中的线程数
 // nclients         - 服务的连接数
 // precision        - 事件集的精度
 iothreads_t iothreads_start( uint8_t nthreads, uint32_t nclients, int32_t precision );
 
+// 创建网络线程组
+// evflags          - 事件集的创建标志(EVSETS_IOURING, EVSETS_HIGHRES)
+iothreads_t iothreads_start2( uint8_t nthreads, uint32_t nclients, int32_t precision, int32_t evflags );
+
+// 创建网络线程组
+// cpus             - 每个网络线程绑定的CPU(数组长度为nthreads, -1表示不绑定), NULL-都不绑定
+//                    网络线程的内存分配在绑定的CPU所在的NUMA节点上
+iothreads_t iothreads_start3( uint8_t nthreads, uint32_t nclients, int32_t precision, int32_t evflags, const int32_t * cpus );
+
+// 创建嵌入式的网络线程组
+// 只有一个网络线程, 不创建线程, 由调用者的线程通过iothreads_poll()驱动,
+// 调用者的线程中提交的任务不需要唤醒网络线程
+iothreads_t iothreads_embed( uint32_t nclients, int32_t precision, int32_t evflags );
+
+// 驱动嵌入式的网络线程组, 处理网络事件和任务, 只能在创建网络线程组的线程中调用
+// timeout          - 等待的时间(毫秒), 0-不等待, -1-一直等待, 直到有事件或者任务
+// 返回值: 处理的事件和任务数, <0-失败
+int32_t iothreads_poll( iothreads_t self, int32_t timeout );
+
+// 创建网络线程组
+// maxthreads       - 网络线程数的上限, 运行期间可以通过iothreads_grow()增加网络线程
+iothreads_t iothreads_start4( uint8_t nthreads, uint8_t maxthreads, uint32_t nclients, int32_t precision, int32_t evflags, const int32_t * cpus );
+
+// 增加一个网络线程, 不能和其他的iothreads_grow()并发调用
+// cpu              - 绑定的CPU, -1表示不绑定
+// 返回值: 新的网络线程的编号, <0-失败(例如达到上限)
+int32_t iothreads_grow( iothreads_t self, int32_t cpu, uint32_t nclients );
+
 // 设置处理器
 void iothreads_set_processor( iothreads_t self, processor_t processor, void * context );
 
+// 设置忙轮询
+// usecs            - 网络线程空闲后继续非阻塞轮询的时间(微秒), 之后退化为阻塞等待; 0-关闭(默认)
+void iothreads_set_busypoll( iothreads_t self, int32_t usecs );
+
+// 设置任务队列的容量
+// capacity         - 每个网络线程任务队列的容量, 0-不限制(默认)
+// policy           - 队列满时的处理策略(IOTHREADS_QUEUE_FAILFAST, IOTHREADS_QUEUE_BLOCK, IOTHREADS_QUEUE_DROPOLDEST)
+// timeout          - 阻塞等待的超时时间(毫秒), 仅用于IOTHREADS_QUEUE_BLOCK
+void iothreads_set_queuelimit( iothreads_t self, uint32_t capacity, int32_t policy, int32_t timeout );
+
+// 设置丢弃处理器, 回收被丢弃的任务, 参数和处理器相同
+void iothreads_set_dropper( iothreads_t self, processor_t dropper );
+
+// 获取网络线程组中指定线程的任务队列长度
+uint32_t iothreads_get_queuesize( iothreads_t self, uint8_t index );
+
 // 获取网络线程组中指定线程的ID
 pthread_t iothreads_get_id( iothreads_t self, uint8_t index );
 
@@ -67,8 +123,26 @@ void iothreads_set_context( iothreads_t self, uint8_t index, void * context );
 // type             - 提交的任务类型, NOTE:0xff内置的任务类型
 // task             - 提交的任务数据
 // size             - 任务数据的长度, 默认设置为0
+// 返回值: 0-成功, IOTHREADS_EQUEUEFULL-队列已满, 其他-失败
 int32_t iothreads_post( iothreads_t self, uint8_t index, int16_t type, void * task, uint8_t size );
 
+// 向网络线程组中指定的线程提交任务
+// flags            - 提交任务的选项(IOTHREADS_POST_NOLIMIT, IOTHREADS_POST_DROPPABLE)
+int32_t iothreads_post2( iothreads_t self, uint8_t index, int16_t type, void * task, uint8_t size, int32_t flags );
+
+// 向网络线程组中指定的线程批量提交同一类型的任务, 只加锁一次, 最多唤醒一次
+// tasks            - 任务数组, size为0时是指针数组, 否则每个任务的长度为size
+// count            - 任务个数
+// 返回值: 成功提交的任务数, 队列满时只提交前面的部分任务
+int32_t iothreads_post_batch( iothreads_t self,
+    uint8_t index, int16_t type, void * tasks, uint32_t count, uint8_t size, int32_t flags );
+
+// 向网络线程组提交不绑定网络线程的任务
+// 网络线程中提交时放入本线程的任务队列, 其他线程中提交时轮询选择网络线程,
+// 空闲的网络线程会从积压的网络线程中窃取任务, 任务在执行的网络线程中回调处理器
+// 返回值: 0-成功, 其他-失败
+int32_t iothreads_submit( iothreads_t self, int16_t type, void * task, uint8_t size );
+
 // 网络线程组停止
 void iothreads_stop( iothreads_t self );
 
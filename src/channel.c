@@ -9,6 +9,10 @@
 #include <sys/uio.h>
 
 #include "config.h"
+#if defined EVENT_HAVE_ZEROCOPY
+#include <netinet/in.h>
+#include <linux/errqueue.h>
+#endif
 #include "session.h"
 #include "utils.h"
 #include "driver.h"
@@ -39,6 +43,13 @@ static inline int32_t _timeout( struct session * session );
 static void _reconnected( int32_t fd, int16_t ev, void * arg );
 static void _reconnect_direct( int32_t fd, int16_t ev, void * arg );
 static void _reassociate_direct( int32_t fd, int16_t ev, void * arg );
+static void _zerocopy_linger( int32_t fd, int16_t ev, void * arg );
+
+// 零拷贝发送
+// _zerocopy_notify()  - 读取错误队列中的完成通知, 1: 内核回退到了拷贝发送
+// _zerocopy_release() - 释放已经完成的消息
+static inline int32_t _zerocopy_notify( int32_t fd, uint32_t zcseq, uint32_t * zcdone );
+static inline void _zerocopy_release( struct zcqueue * queue, uint32_t zcdone );
 
 // -----------------------------------------------------------------------------
 // -----------------------------------------------------------------------------
@@ -91,6 +102,109 @@ ssize_t channel_transmit( struct session * session )
     return total;
 }
 
+ssize_t channel_zerocopy_transmit( struct session * session )
+{
+#if defined EVENT_HAVE_ZEROCOPY
+    ssize_t total = 0;
+
+    while ( session_sendqueue_count( session ) > 0 ) {
+        size_t offset = session->msgoffset;
+        int32_t iov_size = 0;
+        int32_t zerocopy = -1;
+        struct iovec iov_array[iov_max];
+
+        // 连续的大消息零拷贝发送, 连续的小消息拷贝发送
+        for ( uint32_t i = 0; i < session_sendqueue_count( session ) && iov_size < iov_max; ++i ) {
+            struct message * message = NULL;
+            QUEUE_GET( sendqueue ) ( &session->sendqueue, i, &message );
+            int32_t eligible = session_zerocopy_eligible( session, message_get_length( message ) );
+            if ( zerocopy == -1 ) {
+                zerocopy = eligible;
+            } else if ( zerocopy != eligible ) {
+                break;
+            }
+            if ( offset >= message_get_length( message ) ) {
+                offset -= message_get_length( message );
+            } else {
+                iov_array[iov_size].iov_len = message_get_length( message ) - offset;
+                iov_array[iov_size].iov_base = message_get_buffer( message ) + offset;
+                ++iov_size; offset = 0;
+            }
+        }
+
+        ssize_t writen = -1;
+        if ( zerocopy == 1 ) {
+            struct msghdr msg;
+            memset( &msg, 0, sizeof( msg ) );
+            msg.msg_iov = iov_array;
+            msg.msg_iovlen = iov_size;
+            writen = sendmsg( session->fd, &msg, MSG_ZEROCOPY );
+            if ( writen < 0 && errno == ENOBUFS ) {
+                // 超过了锁定内存的限制, 本次拷贝发送
+                zerocopy = 0;
+            }
+        }
+        if ( zerocopy != 1 ) {
+            writen = writev( session->fd, iov_array, iov_size );
+        }
+        if ( writen <= 0 ) {
+            if ( writen < 0 && ( errno == EAGAIN || errno == EWOULDBLOCK ) ) {
+                break;
+            }
+            return writen;
+        }
+
+        total += writen;
+        offset = session->msgoffset + writen;
+        if ( zerocopy == 1 ) {
+            ++session->zcseq;
+        }
+
+        for ( ; session_sendqueue_count( session ) > 0; ) {
+            struct message * message = NULL;
+            QUEUE_TOP( sendqueue ) ( &session->sendqueue, &message );
+            if ( offset < message_get_length( message ) ) break;
+            QUEUE_POP( sendqueue ) ( &session->sendqueue, &message );
+            offset -= message_get_length( message );
+            if ( session_zerocopy_pending( session ) ) {
+                // 按照发送的顺序等待之前的零拷贝发送全部完成
+                struct zcentry entry = { session->zcseq - 1, message };
+                QUEUE_PUSH( zcqueue ) ( &session->zcqueue, &entry );
+            } else {
+                message_add_success( message );
+                if ( message_is_complete( message ) ) message_destroy( message );
+            }
+        }
+        session->msgoffset = offset;
+    }
+
+    return total;
+#else
+    return channel_transmit( session );
+#endif
+}
+
+void channel_zerocopy_complete( struct session * session )
+{
+#if defined EVENT_HAVE_ZEROCOPY
+    // 内核回退到了拷贝发送(例如回环地址), 之后不再使用零拷贝
+    if ( _zerocopy_notify( session->fd, session->zcseq, &session->zcdone ) ) {
+        session->setting.zerocopy = 0;
+    }
+
+    _zerocopy_release( &session->zcqueue, session->zcdone );
+#endif
+}
+
+void channel_zerocopy_linger( struct session * session )
+{
+    // 会话的事件已经全部删除, 定时检查完成通知
+    event_set( &session->evwrite, -1, 0 );
+    event_set_callback( &session->evwrite, _zerocopy_linger, session );
+    evsets_add( session->evsets, &session->evwrite, ZEROCOPY_LINGER_INTERVAL );
+    session->status |= SESSION_WRITING;
+}
+
 ssize_t channel_send( struct session * session, char * buf, size_t nbytes )
 {
     ssize_t writen = write( session->fd, buf, nbytes );
@@ -189,6 +303,11 @@ void _reconnected( int32_t fd, int16_t ev, void * arg )
 #endif
         // 总算是连接上了
 
+        // 新的描述符需要重新开启零拷贝
+        if ( session->setting.zerocopy > 0 && set_zerocopy( fd ) != 0 ) {
+            session->setting.zerocopy = 0;
+        }
+
         // 把缓存的消息提取出来
         struct sendqueue queue;
         session_sendqueue_take( session, &queue );
@@ -223,6 +342,78 @@ void _reconnect_direct( int32_t fd, int16_t ev, void * arg )
     evsets_add( connector->evsets, connector->event, TRY_RECONNECT_INTERVAL );
 }
 
+void _zerocopy_linger( int32_t fd, int16_t ev, void * arg )
+{
+    struct session * session = (struct session *)arg;
+
+    session->status &= ~SESSION_WRITING;
+    channel_zerocopy_complete( session );
+
+    // 最多等待MAX_SECONDS_WAIT_FOR_SHUTDOWN
+    if ( session_zerocopy_pending( session )
+        && ++session->zclinger * ZEROCOPY_LINGER_INTERVAL < MAX_SECONDS_WAIT_FOR_SHUTDOWN ) {
+        channel_zerocopy_linger( session );
+        return;
+    }
+
+    channel_shutdown( session );
+}
+
+int32_t _zerocopy_notify( int32_t fd, uint32_t zcseq, uint32_t * zcdone )
+{
+    int32_t copied = 0;
+
+#if defined EVENT_HAVE_ZEROCOPY
+    while ( zcseq != *zcdone ) {
+        char control[128];
+        struct msghdr msg;
+        memset( &msg, 0, sizeof( msg ) );
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof( control );
+
+        // 错误队列中没有通知时返回EAGAIN
+        if ( recvmsg( fd, &msg, MSG_ERRQUEUE ) < 0 ) {
+            break;
+        }
+
+        for ( struct cmsghdr * cm = CMSG_FIRSTHDR( &msg ); cm != NULL; cm = CMSG_NXTHDR( &msg, cm ) ) {
+            if ( !( cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR )
+                && !( cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR ) ) {
+                continue;
+            }
+
+            struct sock_extended_err * serr = (struct sock_extended_err *)CMSG_DATA( cm );
+            if ( serr->ee_errno != 0 || serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY ) {
+                continue;
+            }
+
+            if ( serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED ) {
+                copied = 1;
+            }
+
+            // [ee_info, ee_data]区间内的发送已经完成, TCP按序确认
+            if ( (int32_t)( serr->ee_data + 1 - *zcdone ) > 0 ) {
+                *zcdone = serr->ee_data + 1;
+            }
+        }
+    }
+#endif
+
+    return copied;
+}
+
+void _zerocopy_release( struct zcqueue * queue, uint32_t zcdone )
+{
+    while ( QUEUE_COUNT( zcqueue )( queue ) > 0 ) {
+        struct zcentry entry;
+        QUEUE_TOP( zcqueue ) ( queue, &entry );
+        if ( (int32_t)( zcdone - entry.seq ) <= 0 ) break;
+        QUEUE_POP( zcqueue ) ( queue, &entry );
+        message_add_success( entry.message );
+        if ( message_is_complete( entry.message ) ) message_destroy( entry.message );
+    }
+}
+
 void _reassociate_direct( int32_t fd, int16_t ev, void * arg )
 {
     struct associater * associater = (struct associater *)arg;
@@ -280,6 +471,13 @@ int32_t channel_shutdown( struct session * session )
     // 会话终止
     session->service.shutdown(
         session->context, way );
+    // 删除迁移留下的转发
+    if ( session->aliases != NULL ) {
+        iolayer_unforward_session(
+            (struct iolayer *)session->iolayer, session->manager->index, session->aliases );
+    }
+    // 零拷贝发送的消息等待完成通知后再释放
+    session_manager_linger( session->manager, session );
     session_manager_remove( session->manager, session );
 #ifndef USE_REUSESESSION
     session_end( session, session->id, 0 );
@@ -306,6 +504,11 @@ void channel_on_read( int32_t fd, int16_t ev, void * arg )
         session->status &= ~SESSION_READING;
     }
 
+    // 零拷贝发送的完成通知(EPOLLERR)
+    if ( session_zerocopy_pending( session ) ) {
+        channel_zerocopy_complete( session );
+    }
+
     if ( ev & EV_READ ) {
         /* >0    - ok
          *  0    - peer shutdown
@@ -313,13 +516,19 @@ void channel_on_read( int32_t fd, int16_t ev, void * arg )
          * -2    - expand() failure
          */
         ssize_t nprocess = 0;
-        ssize_t nread = _receive( session );
+        ssize_t nread = 0;
 
-        // 只有iolayer处于运行状态下的时候
-        // 才会回调逻辑层处理数据
-        if ( likely( iolayer->status == eIOStatus_Running ) ) {
-            nprocess = _process( session );
-        }
+        // 边缘触发模式下, 必须一直读到EAGAIN为止
+        do {
+            nread = _receive( session );
+
+            // 只有iolayer处于运行状态下的时候
+            // 才会回调逻辑层处理数据
+            if ( likely( iolayer->status == eIOStatus_Running ) ) {
+                nprocess = _process( session );
+            }
+        } while ( session->setting.edge_trigger
+            && nread > 0 && nprocess >= 0 );
 
         if ( nprocess < 0 ) {
             // 处理出错, 尝试终止会话
@@ -393,13 +602,22 @@ void channel_on_write( int32_t fd, int16_t ev, void * arg )
 {
     struct session * session = (struct session *)arg;
 
-    session->status &= ~SESSION_WRITING;
+    // 边缘触发模式下, 写事件常驻事件集直到发送队列为空
+    if ( session->setting.edge_trigger == 0 ) {
+        session->status &= ~SESSION_WRITING;
+    }
+
+    // 零拷贝发送的完成通知(EPOLLERR)
+    if ( session_zerocopy_pending( session ) ) {
+        channel_zerocopy_complete( session );
+    }
 
     if ( ev & EV_WRITE ) {
         if ( session_sendqueue_count( session ) > 0 ) {
             // 发送数据
             ssize_t writen = session->setting.transmit( session );
             if ( writen < 0 ) {
+                session_del_event( session, EV_WRITE );
                 channel_error( session, eIOError_WriteFailure );
             } else {
                 // 正常发送 或者 socket缓冲区已满
@@ -415,10 +633,12 @@ void channel_on_write( int32_t fd, int16_t ev, void * arg )
                     } else {
                         // 客户端无法正常接收数据，导致发送队列过度增长
                         // 避免服务器内存耗尽，必须将该会话关闭
+                        session_del_event( session, EV_WRITE );
                         channel_error( session, eIOError_SendQueueLimit );
                     }
                 } else {
                     // 数据全部发送完成
+                    session_del_event( session, EV_WRITE );
 
                     // 尝试收缩发送队列
                     // session_sendqueue_shrink(
@@ -426,14 +646,20 @@ void channel_on_write( int32_t fd, int16_t ev, void * arg )
 
                     // 关闭会话
                     if ( session->status & SESSION_EXITING ) {
-                        // 等待关闭的会话, 直接终止会话
-                        // 后续的行为由SO_LINGER决定
-                        channel_shutdown( session );
+                        if ( session_zerocopy_pending( session ) ) {
+                            // 等待零拷贝发送的完成通知
+                            channel_zerocopy_linger( session );
+                        } else {
+                            // 等待关闭的会话, 直接终止会话
+                            // 后续的行为由SO_LINGER决定
+                            channel_shutdown( session );
+                        }
                     }
                 }
             }
         } else {
             // 队列为空的情况
+            session_del_event( session, EV_WRITE );
 
             // TODO: 其他需要处理的逻辑
 
@@ -474,8 +700,10 @@ void channel_on_accept( int32_t fd, int16_t ev, void * arg )
             task.transfer = NULL;
             task.host = host;
             task.port = port;
+            task.cb = acceptor->cb;
+            task.context = acceptor->context;
             iolayer_assign_session( layer,
-                acceptor->index, DISPATCH_POLICY( layer, fd ), &task );
+                acceptor->index, iolayer_dispatch( layer, fd ), &task );
         } else if ( errno == EMFILE ) {
             // Read the section named
             // "The special problem of accept()ing when you can't" in libev's doc.
@@ -520,6 +748,8 @@ void channel_on_udpread( int32_t fd, int16_t ev, void * arg )
                 task.transfer = transfer;
                 task.acceptor = acceptor;
                 task.type = acceptor->type;
+                task.cb = acceptor->cb;
+                task.context = acceptor->context;
                 iolayer_assign_session( layer, acceptor->index, acceptor->index, &task );
             }
             // 重置BUFF
@@ -569,9 +799,9 @@ void channel_on_reconnect( int32_t fd, int16_t ev, void * arg )
     }
 
     // 注册写事件, 以重新激活会话
-    event_set( session->evwrite, session->fd, EV_WRITE );
-    event_set_callback( session->evwrite, _reconnected, session );
-    evsets_add( session->evsets, session->evwrite, -1 );
+    event_set( &session->evwrite, session->fd, EV_WRITE );
+    event_set_callback( &session->evwrite, _reconnected, session );
+    evsets_add( session->evsets, &session->evwrite, -1 );
 
     session->status |= SESSION_WRITING;
 }
@@ -736,3 +966,20 @@ void channel_on_schedule( int32_t fd, int16_t ev, void * arg )
         session_shutdown( session );
     }
 }
+
+void channel_on_zclinger( int32_t fd, int16_t ev, void * arg )
+{
+    struct zclinger * linger = (struct zclinger *)arg;
+
+    _zerocopy_notify( linger->fd, linger->zcseq, &linger->zcdone );
+    _zerocopy_release( &linger->zcqueue, linger->zcdone );
+
+    // 最多等待MAX_SECONDS_WAIT_FOR_SHUTDOWN, 超时后重置连接
+    if ( QUEUE_COUNT( zcqueue )( &linger->zcqueue ) > 0
+        && ++linger->nlinger * ZEROCOPY_LINGER_INTERVAL < MAX_SECONDS_WAIT_FOR_SHUTDOWN ) {
+        evsets_add( linger->evsets, &linger->evtimer, ZEROCOPY_LINGER_INTERVAL );
+        return;
+    }
+
+    session_manager_unlinger( linger->manager, linger );
+}
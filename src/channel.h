@@ -18,6 +18,15 @@ ssize_t channel_transmit( struct session * session );
 ssize_t channel_receive( struct session * session );
 ssize_t channel_send( struct session * session, char * buf, size_t nbytes );
 
+// 零拷贝发送(MSG_ZEROCOPY)
+// channel_zerocopy_transmit()  - 超过阈值的消息零拷贝发送, 收到完成通知后才释放消息
+// channel_zerocopy_complete()  - 读取错误队列中的完成通知, 释放已经完成的消息
+// channel_zerocopy_linger()    - 终止会话前等待完成通知
+// channel_on_zclinger()        - 会话终止后, 管理器接管的消息等待完成通知
+ssize_t channel_zerocopy_transmit( struct session * session );
+void channel_zerocopy_complete( struct session * session );
+void channel_zerocopy_linger( struct session * session );
+
 // 会话出错
 // 丢弃发送队列中的数据
 int32_t channel_error( struct session * session, int32_t result );
@@ -39,5 +48,6 @@ void channel_on_reconnect( int32_t fd, int16_t ev, void * arg );
 void channel_on_connected( int32_t fd, int16_t ev, void * arg );
 void channel_on_associated( int32_t fd, int16_t ev, void * arg );
 void channel_on_schedule( int32_t fd, int16_t ev, void * arg );
+void channel_on_zclinger( int32_t fd, int16_t ev, void * arg );
 
 #endif
@@ -83,6 +83,38 @@
     #endif
 #endif
 
+// EVENT_HAVE_TIMERFD
+#if defined EVENT_OS_LINUX
+    // timerfd_create() was added to the kernel in version 2.6.25.
+    // Library support is provided by glibc since version 2.8.
+    #if LINUX_VERSION_CODE >= KERNEL_VERSION(2,6,25)
+        #if defined __GLIBC__ && __GLIBC_PREREQ(2,8)
+            #define EVENT_HAVE_TIMERFD
+            #include <sys/timerfd.h>
+        #endif
+    #endif
+#endif
+
+// EVENT_HAVE_IOURING
+#if defined EVENT_OS_LINUX
+    // io_uring_setup() was added to the kernel in version 5.1,
+    // IORING_FEAT_EXT_ARG(timeout of io_uring_enter()) was added in version 5.11.
+    // 运行时内核不支持的情况下, 回退到epoll
+    #if LINUX_VERSION_CODE >= KERNEL_VERSION(5,11,0)
+        #define EVENT_HAVE_IOURING
+    #endif
+#endif
+
+// EVENT_HAVE_ZEROCOPY
+#if defined EVENT_OS_LINUX
+    // MSG_ZEROCOPY for TCP was added to the kernel in version 4.14.
+    #if LINUX_VERSION_CODE >= KERNEL_VERSION(4,14,0)
+        #if defined MSG_ZEROCOPY && defined SO_ZEROCOPY
+            #define EVENT_HAVE_ZEROCOPY
+        #endif
+    #endif
+#endif
+
 #define likely( x ) __builtin_expect( ( x ), 1 )
 #define unlikely( x ) __builtin_expect( ( x ), 0 )
 
@@ -27,12 +27,8 @@ struct driver * driver_create( struct session * s, struct buffer * buffer, const
     if ( self != NULL ) {
         uint32_t conv = ikcp_getconv( buffer_data( buffer ) );
 
-        // 创建定时器
-        self->timer = event_create();
-        if ( self->timer == NULL ) {
-            driver_destroy( self );
-            return NULL;
-        }
+        // 初始化定时器
+        event_init( &self->timer );
 
         // 创建kcp对象
         self->kcp = ikcp_create( conv, s );
@@ -42,7 +38,7 @@ struct driver * driver_create( struct session * s, struct buffer * buffer, const
         }
 
         // 设置时间戳
-        self->epoch = event_get_current( self->timer );
+        self->epoch = event_get_current( &self->timer );
         // 设置kcp的极速模式
         // 1 - 启动nodelay模式
         // 1 - 关闭流量控制
@@ -63,15 +59,10 @@ void driver_destroy( struct driver * self )
 {
     struct session * session = _get_session( self );
 
-    if ( self->timer != NULL ) {
-        if ( session != NULL
-            && ( session->status & SESSION_SCHEDULING ) ) {
-            evsets_del( session->evsets, self->timer );
-            session->status &= ~SESSION_SCHEDULING;
-        }
-
-        event_destroy( self->timer );
-        self->timer = NULL;
+    if ( session != NULL
+        && ( session->status & SESSION_SCHEDULING ) ) {
+        evsets_del( session->evsets, &self->timer );
+        session->status &= ~SESSION_SCHEDULING;
     }
 
     if ( self->entry != NULL ) {
@@ -231,7 +222,7 @@ void _kcp_refresh_state( struct driver * self )
 
 uint32_t _kcp_milliseconds( struct driver * self )
 {
-    return (uint32_t)( event_get_current( self->timer ) - self->epoch );
+    return (uint32_t)( event_get_current( &self->timer ) - self->epoch );
 }
 
 void _kcp_timer( int32_t fd, int16_t ev, void * arg )
@@ -262,14 +253,14 @@ void _kcp_schedule( struct driver * self, int32_t timeout )
 
     // 还在定时器中, 移除
     if ( session->status & SESSION_SCHEDULING ) {
-        evsets_del( session->evsets, self->timer );
+        evsets_del( session->evsets, &self->timer );
         session->status &= ~SESSION_SCHEDULING;
     }
 
     // 加入定时器
-    event_set( self->timer, -1, 0 );
-    event_set_callback( self->timer, _kcp_timer, session );
-    evsets_add( session->evsets, self->timer, timeout );
+    event_set( &self->timer, -1, 0 );
+    event_set_callback( &self->timer, _kcp_timer, session );
+    evsets_add( session->evsets, &self->timer, timeout );
     session->status |= SESSION_SCHEDULING;
 }
 
@@ -4,6 +4,7 @@
 
 #include "ikcp.h"
 #include "event.h"
+#include "event-internal.h"
 #include "message.h"
 #include "network.h"
 
@@ -14,7 +15,7 @@ struct ephashtable;
 struct driver
 {
     ikcpcb * kcp;                 // kcp对象
-    event_t timer;                // 定时器
+    struct event timer;           // 定时器(内嵌)
     int64_t epoch;                // 开始时间
     struct udpentry * entry;      // UDP条目
     struct sockaddr_storage addr; // 对端地址
@@ -25,8 +25,22 @@
 struct eventpair {
     struct event * evread;
     struct event * evwrite;
+    int32_t edge;     // 以边缘触发模式注册到epoll中
+    int32_t events;   // 已经注册到epoll中的事件
+    int32_t nchanges; // 尚未提交的修改次数
 };
 
+//
+// 变更列表
+// 描述符仍然关注着其他事件时, 读写事件的增删只标记描述符,
+// 在epoll_wait()之前按描述符合并后统一提交
+//
+// 推迟的删除
+// 非持久事件在回调前删除描述符的最后一个事件时, 推迟删除,
+// 回调中又重新添加, 不需要任何系统调用;
+// 否则在下一次操作(增删事件, 回调中再次删除该事件, 分发)时提交,
+// 回调中关闭描述符之前需要调用evsets_del(), 避免dup()的描述符遗留在epoll中
+//
 struct epoller {
     // 管理的所有事件对, 这个是基于描述符的
     int32_t npairs;
@@ -36,6 +50,15 @@ struct epoller {
     int32_t nevents;
     struct epoll_event * events;
 
+    // 修改过的描述符
+    int32_t nchanges;
+    int32_t maxchanges;
+    int32_t * changes;
+
+    // 推迟删除的描述符以及事件
+    int32_t detachedfd;
+    struct event * detached;
+
     // epoll描述符
     int32_t epollfd;
 };
@@ -49,6 +72,12 @@ void epoll_final( void * arg );
 int32_t epoll_expand( struct epoller * self );
 int32_t epoll_insert( struct epoller * self, int32_t max );
 
+static inline int32_t _epoll_interest( struct eventpair * pair );
+static inline int32_t _epoll_change( struct epoller * self, int32_t fd );
+static inline int32_t _epoll_ctl( struct epoller * self, struct eventset * sets, int32_t fd, int32_t events );
+static inline void _epoll_flush( struct epoller * self, struct eventset * sets );
+static inline void _epoll_commit( struct epoller * self, struct eventset * sets );
+
 const struct eventop epollops = {
     epoll_init,
     epoll_add,
@@ -76,7 +105,7 @@ void * epoll_init()
         set_cloexec( epollfd );
     }
 
-    poller = (struct epoller *)malloc( sizeof( struct epoller ) );
+    poller = (struct epoller *)calloc( 1, sizeof( struct epoller ) );
     if ( poller == NULL ) {
         close( epollfd );
         return NULL;
@@ -86,13 +115,19 @@ void * epoll_init()
 
     poller->evpairs = (struct eventpair *)calloc( INIT_EVENTS, sizeof( struct eventpair ) );
     poller->events = (struct epoll_event *)calloc( INIT_EVENTS, sizeof( struct epoll_event ) );
-    if ( poller->evpairs == NULL || poller->events == NULL ) {
+    poller->changes = (int32_t *)malloc( INIT_EVENTS * sizeof( int32_t ) );
+    if ( poller->evpairs == NULL
+        || poller->events == NULL || poller->changes == NULL ) {
         epoll_final( poller );
         return NULL;
     }
 
     poller->npairs = INIT_EVENTS;
     poller->nevents = INIT_EVENTS;
+    poller->nchanges = 0;
+    poller->maxchanges = INIT_EVENTS;
+    poller->detachedfd = -1;
+    poller->detached = NULL;
 
     return poller;
 }
@@ -139,67 +174,238 @@ int32_t epoll_insert( struct epoller * self, int32_t max )
     return 0;
 }
 
-int32_t epoll_add( void * arg, struct event * ev )
+int32_t _epoll_interest( struct eventpair * pair )
 {
-    int32_t fd = 0, rc = -1;
-    int32_t op = 0, events = 0;
-
-    struct epoll_event epollevent;
-    struct eventpair * eventpair = NULL;
-    struct epoller * poller = (struct epoller *)arg;
+    int32_t events = 0;
 
-    fd = event_get_fd( (event_t)ev );
-    if ( fd < 0 ) {
-        return -3;
-    } else if ( fd >= poller->npairs ) {
-        if ( epoll_insert( poller, fd ) != 0 ) {
-            return -1;
-        }
+    if ( pair->evread == NULL
+        && pair->evwrite == NULL ) {
+        return 0;
     }
 
-    events = 0;
-    op = EPOLL_CTL_ADD;
-    eventpair = &( poller->evpairs[fd] );
+    if ( pair->edge ) {
+        return EPOLLIN | EPOLLOUT | EPOLLET;
+    }
 
-    if ( eventpair->evread != NULL ) {
+    if ( pair->evread != NULL ) {
         events |= EPOLLIN;
-        op = EPOLL_CTL_MOD;
     }
-    if ( eventpair->evwrite != NULL ) {
+    if ( pair->evwrite != NULL ) {
         events |= EPOLLOUT;
-        op = EPOLL_CTL_MOD;
     }
 
-    if ( ev->events & EV_READ ) {
-        events |= EPOLLIN;
+    return events;
+}
+
+int32_t _epoll_change( struct epoller * self, int32_t fd )
+{
+    struct eventpair * pair = &( self->evpairs[fd] );
+
+    if ( pair->nchanges == 0 ) {
+        if ( unlikely( self->nchanges == self->maxchanges ) ) {
+            int32_t maxchanges = self->maxchanges << 1;
+            int32_t * changes = (int32_t *)realloc(
+                self->changes, maxchanges * sizeof( int32_t ) );
+            if ( changes == NULL ) {
+                return -1;
+            }
+
+            self->changes = changes;
+            self->maxchanges = maxchanges;
+        }
+
+        self->changes[self->nchanges++] = fd;
     }
-    if ( ev->events & EV_WRITE ) {
-        events |= EPOLLOUT;
+
+    ++pair->nchanges;
+
+    return 0;
+}
+
+int32_t _epoll_ctl( struct epoller * self, struct eventset * sets, int32_t fd, int32_t events )
+{
+    int32_t op = 0, rc = -1;
+    struct epoll_event epollevent;
+    struct eventpair * pair = &( self->evpairs[fd] );
+
+    if ( events == pair->events ) {
+        return 0;
+    }
+
+    if ( pair->events == 0 ) {
+        op = EPOLL_CTL_ADD;
+    } else if ( events == 0 ) {
+        op = EPOLL_CTL_DEL;
+    } else {
+        op = EPOLL_CTL_MOD;
     }
 
     epollevent.data.u64 = 0; /* avoid valgrind warnning */
     epollevent.data.fd = fd;
     epollevent.events = events;
 
-    rc = epoll_ctl( poller->epollfd, op, fd, &epollevent );
+    ++sets->ctl_calls;
+    rc = epoll_ctl( self->epollfd, op, fd, &epollevent );
     if ( rc == -1 ) {
         if ( op == EPOLL_CTL_MOD && errno == ENOENT ) {
             // If a MOD operation fails with ENOENT, the fd was probably closed and re-opened.
             // We should retry the operation as an ADD.
-            rc = epoll_ctl( poller->epollfd, EPOLL_CTL_ADD, fd, &epollevent );
+            ++sets->ctl_calls;
+            rc = epoll_ctl( self->epollfd, EPOLL_CTL_ADD, fd, &epollevent );
         } else if ( op == EPOLL_CTL_ADD && errno == EEXIST ) {
             // If an ADD operation fails with EEXIST,
             // either the operation was redundant (as with a precautionary add),
             // or we ran into a fun kernel bug where using dup*() to duplicate the same file into the same fd gives you the same epitem rather than a fresh one.
             // For the second case, we must retry with MOD.
-            rc = epoll_ctl( poller->epollfd, EPOLL_CTL_MOD, fd, &epollevent );
+            ++sets->ctl_calls;
+            rc = epoll_ctl( self->epollfd, EPOLL_CTL_MOD, fd, &epollevent );
         }
     }
 
     if ( rc == -1 ) {
+        if ( op != EPOLL_CTL_DEL
+            || ( errno != ENOENT && errno != EBADF ) ) {
+            return -1;
+        }
+        // 描述符已经关闭, 内核已经删除
+    }
+
+    pair->events = events;
+    return 0;
+}
+
+void _epoll_flush( struct epoller * self, struct eventset * sets )
+{
+    int32_t i = 0;
+
+    for ( i = 0; i < self->nchanges; ++i ) {
+        int32_t fd = self->changes[i];
+        struct eventpair * pair = &( self->evpairs[fd] );
+
+        int32_t nchanges = pair->nchanges;
+        int32_t events = _epoll_interest( pair );
+
+        pair->nchanges = 0;
+
+        // 合并后关注的事件没有变化
+        if ( events == pair->events ) {
+            sets->ctl_saved += nchanges;
+            continue;
+        }
+
+        sets->ctl_saved += nchanges - 1;
+        if ( _epoll_ctl( self, sets, fd, events ) != 0 ) {
+            syslog( LOG_WARNING, "%s(fd=%d) epoll_ctl() error <%d, %s>", __FUNCTION__, fd, errno, strerror( errno ) );
+        }
+    }
+
+    self->nchanges = 0;
+}
+
+void _epoll_commit( struct epoller * self, struct eventset * sets )
+{
+    int32_t fd = self->detachedfd;
+    struct eventpair * pair = &( self->evpairs[fd] );
+
+    self->detachedfd = -1;
+    self->detached = NULL;
+
+    // 描述符在推迟期间没有重新关注事件
+    if ( pair->evread == NULL && pair->evwrite == NULL ) {
+        pair->edge = 0;
+        if ( _epoll_ctl( self, sets, fd, 0 ) != 0 ) {
+            syslog( LOG_WARNING, "%s(fd=%d) epoll_ctl() error <%d, %s>", __FUNCTION__, fd, errno, strerror( errno ) );
+        }
+    }
+}
+
+int32_t epoll_add( void * arg, struct event * ev )
+{
+    int32_t fd = 0, events = 0;
+
+    struct eventpair * eventpair = NULL;
+    struct epoller * poller = (struct epoller *)arg;
+
+    fd = event_get_fd( (event_t)ev );
+    if ( fd < 0 ) {
+        return -3;
+    } else if ( fd >= poller->npairs ) {
+        if ( epoll_insert( poller, fd ) != 0 ) {
+            return -1;
+        }
+    }
+
+    eventpair = &( poller->evpairs[fd] );
+
+    if ( poller->detached != NULL ) {
+        if ( poller->detached == ev && poller->detachedfd == fd ) {
+            // 非持久事件在回调中重新添加, 描述符仍然在epoll中
+            poller->detachedfd = -1;
+            poller->detached = NULL;
+            ev->evsets->ctl_saved += 2;
+
+            if ( ev->events & EV_READ ) {
+                eventpair->evread = ev;
+            }
+            if ( ev->events & EV_WRITE ) {
+                eventpair->evwrite = ev;
+            }
+
+            // 关注的事件发生了变化
+            if ( _epoll_interest( eventpair ) != eventpair->events
+                && _epoll_change( poller, fd ) != 0 ) {
+                return _epoll_ctl( poller, ev->evsets, fd, _epoll_interest( eventpair ) ) == 0 ? 0 : -2;
+            }
+            return 0;
+        }
+
+        _epoll_commit( poller, ev->evsets );
+    }
+
+    if ( ev->events & EV_ET ) {
+        if ( eventpair->edge ) {
+            // 边缘触发模式下描述符只注册一次, 读写事件的增删不再修改epoll
+            // 未关注期间可能错过了边缘, 所以乐观的激活一次, 由回调读写到EAGAIN为止
+            if ( ev->events & EV_READ ) {
+                eventpair->evread = ev;
+            }
+            if ( ev->events & EV_WRITE ) {
+                eventpair->evwrite = ev;
+            }
+            event_active( ev, ev->events & ( EV_READ | EV_WRITE ) );
+            return 0;
+        }
+
+        // 同时关注读写事件
+        events = EPOLLIN | EPOLLOUT | EPOLLET;
+    } else if ( ( eventpair->evread != NULL || eventpair->evwrite != NULL )
+        && _epoll_change( poller, fd ) == 0 ) {
+        // 描述符已经注册, 延迟到epoll_wait()之前提交
+        if ( ev->events & EV_READ ) {
+            eventpair->evread = ev;
+        }
+        if ( ev->events & EV_WRITE ) {
+            eventpair->evwrite = ev;
+        }
+        return 0;
+    }
+
+    // 首次注册需要立即提交, 及时反馈描述符是否合法
+    events |= _epoll_interest( eventpair );
+    if ( ev->events & EV_READ ) {
+        events |= EPOLLIN;
+    }
+    if ( ev->events & EV_WRITE ) {
+        events |= EPOLLOUT;
+    }
+
+    if ( _epoll_ctl( poller, ev->evsets, fd, events ) != 0 ) {
         return -2;
     }
 
+    if ( ev->events & EV_ET ) {
+        eventpair->edge = 1;
+    }
     if ( ev->events & EV_READ ) {
         eventpair->evread = ev;
     }
@@ -213,60 +419,56 @@ int32_t epoll_add( void * arg, struct event * ev )
 int32_t epoll_del( void * arg, struct event * ev )
 {
     int32_t fd = 0;
-    int32_t op = 0, events = 0;
-    int32_t delwrite = 1, delread = 1;
 
-    struct epoll_event epollevent;
     struct eventpair * eventpair = NULL;
     struct epoller * poller = (struct epoller *)arg;
 
     fd = event_get_fd( (event_t)ev );
-    if ( fd >= poller->npairs ) {
+    if ( fd < 0 || fd >= poller->npairs ) {
         return -1;
     }
 
     // 简单的删除指定的事件
-    events = 0;
-    op = EPOLL_CTL_DEL;
     eventpair = &( poller->evpairs[fd] );
 
+    if ( poller->detached != NULL ) {
+        _epoll_commit( poller, ev->evsets );
+    }
+
+    // 事件已经删除, 只需要提交推迟的删除
+    if ( eventpair->evread != ev && eventpair->evwrite != ev ) {
+        return 0;
+    }
+
     if ( ev->events & EV_READ ) {
-        events |= EPOLLIN;
+        eventpair->evread = NULL;
     }
     if ( ev->events & EV_WRITE ) {
-        events |= EPOLLOUT;
+        eventpair->evwrite = NULL;
     }
 
     // 删除的同时查看该描述符是否支持了其他事件
     // 如有, 则不能直接简单的删除
-    if ( ( events & ( EPOLLIN | EPOLLOUT ) ) != ( EPOLLIN | EPOLLOUT ) ) {
-        if ( ( events & EPOLLIN ) && eventpair->evwrite != NULL ) {
-            // 删除的是读事件, 写事件仍然要监听
-            // 并且还需要从写事件中查看是否支持了边缘触发模式
-            delwrite = 0;
-            events = EPOLLOUT;
-            op = EPOLL_CTL_MOD;
-        } else if ( ( events & EPOLLOUT ) && eventpair->evread != NULL ) {
-            // 删除的是写事件, 读事件仍然要监听
-            // 并且还需要从读事件中查看是否支持了边缘触发模式
-            delread = 0;
-            events = EPOLLIN;
-            op = EPOLL_CTL_MOD;
+    if ( eventpair->evread != NULL
+        || eventpair->evwrite != NULL ) {
+        if ( eventpair->edge ) {
+            // 边缘触发模式下, 读写事件都删除后才从epoll中删除
+            return 0;
         }
+        if ( _epoll_change( poller, fd ) == 0 ) {
+            return 0;
+        }
+    } else if ( !eventpair->edge && ev->evsets->rearming == ev ) {
+        // 非持久事件在回调前删除, 推迟到回调中重新添加或者下一次操作
+        poller->detachedfd = fd;
+        poller->detached = ev;
+        return 0;
+    } else {
+        // 读写事件都删除后, 描述符随时可能被关闭, 必须立即从epoll中删除
+        eventpair->edge = 0;
     }
 
-    epollevent.data.u64 = 0; /* avoid valgrind warnning */
-    epollevent.data.fd = fd;
-    epollevent.events = events;
-
-    if ( delread ) {
-        eventpair->evread = NULL;
-    }
-    if ( delwrite ) {
-        eventpair->evwrite = NULL;
-    }
-
-    return epoll_ctl( poller->epollfd, op, fd, &epollevent ) == -1 ? -2 : 0;
+    return _epoll_ctl( poller, ev->evsets, fd, _epoll_interest( eventpair ) ) == 0 ? 0 : -2;
 }
 
 int32_t epoll_dispatch( struct eventset * sets, void * arg, int32_t tv )
@@ -278,6 +480,12 @@ int32_t epoll_dispatch( struct eventset * sets, void * arg, int32_t tv )
         tv = MAX_EPOLL_WAIT;
     }
 
+    // 提交推迟的删除以及变更列表
+    if ( poller->detached != NULL ) {
+        _epoll_commit( poller, sets );
+    }
+    _epoll_flush( poller, sets );
+
     res = epoll_wait( poller->epollfd, poller->events, poller->nevents, tv );
     if ( res == -1 ) {
         if ( errno != EINTR ) {
@@ -338,6 +546,9 @@ void epoll_final( void * arg )
     if ( poller->events ) {
         free( poller->events );
     }
+    if ( poller->changes ) {
+        free( poller->changes );
+    }
     if ( poller->epollfd >= 0 ) {
         close( poller->epollfd );
     }
@@ -2,6 +2,8 @@
 #ifndef EVENT_INTERNAL_H
 #define EVENT_INTERNAL_H
 
+#include <stdatomic.h>
+
 #include "queue.h"
 #include "event.h"
 
@@ -16,16 +18,17 @@
 // 链表:    1 - 在全局链表中
 //          2 - 在定时器中
 //          3 - 激活链表中
-//          4 - 保留
+//          4 - 回调之前删除的非常驻事件
 //
 
 #define EVSTATUS_INSERTED 0x01
 #define EVSTATUS_TIMER 0x02
 #define EVSTATUS_ACTIVE 0x04
+#define EVSTATUS_REARMING 0x08
 #define EVSTATUS_INTERNAL 0x10
 #define EVSTATUS_INIT 0x20
 
-#define EVSTATUS_ALL ( 0x0f00 | 0x37 )
+#define EVSTATUS_ALL ( 0x0f00 | 0x3f )
 
 //
 //
@@ -42,64 +45,71 @@ struct eventop {
 
 //
 // 事件
+// 分发时访问的字段(状态, 回调, 激活链表)排列在第一个缓存行中
 //
 struct eventset;
 struct event {
-    int32_t fd;
+    int32_t status;
     int16_t events;
+    int16_t results;
 
-    int32_t status;
-    int32_t results;
+    int32_t fd;
+
+    // 定时器的超时时间
+    int32_t timer_msecs;
 
     // cb 一定要合法
-    void * arg;
     eventcb_t cb;
+    void * arg;
 
     struct eventset * evsets;
 
-    // 定时器的超时时间
-    int32_t timer_msecs;
+    TAILQ_ENTRY( event ) activelink;
 
     // 事件在定时器数组中的索引
     // 删除时, 快速定位到某一个桶
     int32_t timer_index;
 
-    // 事件的周期数
-    int32_t timer_stepcnt;
+    // 事件超时的时钟周期
+    uint32_t timer_expires;
 
     TAILQ_ENTRY( event ) timerlink;
     TAILQ_ENTRY( event ) eventlink;
-    TAILQ_ENTRY( event ) activelink;
 };
 
 TAILQ_HEAD( event_list, event );
 
 #define EVENT_TIMEOUT( ev ) ( int32_t )( ( ev )->timer_msecs )
 #define EVENT_TIMERINDEX( ev ) ( int32_t )( ( ev )->timer_index )
-#define EVENT_TIMERSTEP( ev ) ( int32_t )( ( ev )->timer_stepcnt )
 
+// 初始化内嵌的事件(无需event_create()分配)
+void event_init( struct event * self );
 int32_t event_active( struct event * self, int16_t res );
 
 //
 // event定时器模块
 //
-#define TIMER_BUCKET_COUNT 8192 // 必须是2的N次方
+#define TIMER_WHEEL_BITS 8 // 第一层的桶数 2^8
+#define TIMER_LEVEL_BITS 6 // 其余各层的桶数 2^6
+#define TIMER_LEVEL_COUNT 4
+#define TIMER_WHEEL_SIZE ( 1 << TIMER_WHEEL_BITS )
+#define TIMER_LEVEL_SIZE ( 1 << TIMER_LEVEL_BITS )
+#define TIMER_BUCKET_COUNT ( TIMER_WHEEL_SIZE + TIMER_LEVEL_COUNT * TIMER_LEVEL_SIZE )
 
 struct evtimer {
     int32_t event_count;   // 管理的事件个数
-    int32_t bucket_count;  // 桶的个数
-    int32_t max_precision; // 最大精度, 精确到1毫秒
+    int32_t max_precision; // 最大精度(时钟周期), 精确到1微秒
 
-    int32_t dispatch_refer;           //
-    struct event_list * bucket_array; // 桶的数组
+    uint32_t dispatch_refer;          // 下一次分发的时钟周期
+    struct event_list * bucket_array; // 桶的数组(各层依次排列)
 };
 
-#define EVTIMER_INDEX( t, c ) ( ( c ) & ( ( t )->bucket_count - 1 ) )
-
-struct evtimer * evtimer_create( int32_t max_precision, int32_t bucket_count );
+struct evtimer * evtimer_create( int32_t max_precision );
 int32_t evtimer_append( struct evtimer * self, struct event * ev );
 int32_t evtimer_remove( struct evtimer * self, struct event * ev );
 int32_t evtimer_dispatch( struct evtimer * self );
+int32_t evtimer_next( struct evtimer * self );
+int32_t evtimer_advance( struct evtimer * self, uint32_t ticks );
 int32_t evtimer_count( struct evtimer * self );
 int32_t evtimer_clean( struct evtimer * self );
 void evtimer_destroy( struct evtimer * self );
@@ -109,11 +119,26 @@ void evtimer_destroy( struct evtimer * self );
 //
 
 struct eventset {
-    int32_t timer_precision;
+    int32_t flags;
+    int32_t timer_precision; // 时间精度(毫秒)
+    int32_t timer_tick;      // 时钟周期(微秒)
 
-    int64_t expire_time;
+    int64_t expire_time;     // 下一个时钟周期的到期时间(单调时钟, 微秒)
     int64_t cache_current;
     struct evtimer * core_timer;
+    struct event * timerfd_event; // 高精度模式下的timerfd
+    int64_t timerfd_expire;       // timerfd的到期时间(单调时钟, 微秒), 0-未启动
+
+    // 修改关注事件的系统调用统计
+    uint64_t ctl_calls; // 实际调用的次数
+    uint64_t ctl_saved; // 变更列表合并后节省的次数
+
+    // 阻塞等待的标志, 由等待的线程设置, 从等待中返回后立即清除
+    _Atomic int32_t * sleepflag;
+
+    // 正在回调的非常驻事件, 回调之前的删除可以由后端推迟
+    // 回调中重新添加时, 省去删除和添加的系统调用
+    struct event * rearming;
 
     void * evsets;
     struct eventop * evselect;
@@ -122,6 +147,8 @@ struct eventset {
     struct event_list activelist;
 };
 
+void evsets_set_sleepflag( struct eventset * self, _Atomic int32_t * flag );
+
 #define EVENTSET_PRECISION( sets ) ( ( (struct eventset *)( sets ) )->timer_precision )
 
 #endif
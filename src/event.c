@@ -4,6 +4,7 @@
 #include <stdlib.h>
 #include <syslog.h>
 #include <assert.h>
+#include <unistd.h>
 
 #include "config.h"
 #include "utils.h"
@@ -22,6 +23,9 @@
 #if defined EVENT_OS_LINUX
 extern const struct eventop epollops;
 const struct eventop * evsel = &epollops;
+#if defined EVENT_HAVE_IOURING
+extern const struct eventop iouringops;
+#endif
 #elif defined EVENT_OS_BSD || defined EVENT_OS_MACOS
 extern const struct eventop kqueueops;
 const struct eventop * evsel = &kqueueops;
@@ -33,9 +37,16 @@ const struct eventop * evsel = NULL;
 
 static inline int64_t _get_current( struct eventset * self, int8_t clear );
 static inline int32_t evsets_process_active( struct eventset * self );
+static inline int32_t _dispatch( struct eventset * self, int8_t block );
 static inline int32_t event_queue_insert( struct eventset * self, struct event * ev, int32_t type );
 static inline int32_t event_queue_remove( struct eventset * self, struct event * ev, int32_t type );
 
+// 高精度定时器
+static inline int32_t _start_timerfd( struct eventset * self );
+static inline void _stop_timerfd( struct eventset * self );
+static inline void _arm_timerfd( struct eventset * self, int64_t expire );
+static void _timerfd_callback( int32_t fd, int16_t ev, void * arg );
+
 // -----------------------------------------------------------------------------
 // -----------------------------------------------------------------------------
 // -----------------------------------------------------------------------------
@@ -53,6 +64,82 @@ int64_t _get_current( struct eventset * self, int8_t clear )
     return self->cache_current;
 }
 
+int32_t _start_timerfd( struct eventset * self )
+{
+#if defined EVENT_HAVE_TIMERFD
+    int32_t fd = -1;
+
+    // 一次性的定时器, 阻塞等待之前设置为最近的定时器的到期时间
+    fd = timerfd_create( CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC );
+    if ( fd == -1 ) {
+        return -1;
+    }
+
+    self->timerfd_expire = 0;
+    self->timerfd_event = (struct event *)event_create();
+    if ( self->timerfd_event == NULL ) {
+        close( fd );
+        return -3;
+    }
+
+    event_set( self->timerfd_event, fd, EV_READ | EV_PERSIST );
+    event_set_callback( self->timerfd_event, _timerfd_callback, NULL );
+    if ( evsets_add( self, self->timerfd_event, -1 ) != 1 ) {
+        _stop_timerfd( self );
+        return -4;
+    }
+
+    return 0;
+#else
+    return -1;
+#endif
+}
+
+void _stop_timerfd( struct eventset * self )
+{
+    if ( self->timerfd_event != NULL ) {
+        int32_t fd = self->timerfd_event->fd;
+
+        if ( self->timerfd_event->evsets != NULL ) {
+            evsets_del( self, self->timerfd_event );
+        }
+        event_destroy( self->timerfd_event );
+        self->timerfd_event = NULL;
+        close( fd );
+    }
+}
+
+void _arm_timerfd( struct eventset * self, int64_t expire )
+{
+#if defined EVENT_HAVE_TIMERFD
+    struct itimerspec its;
+
+    // 到期时间没有变化
+    if ( expire == self->timerfd_expire ) {
+        return;
+    }
+
+    // 到期时间为0时停止定时器
+    its.it_interval.tv_sec = 0;
+    its.it_interval.tv_nsec = 0;
+    its.it_value.tv_sec = expire / 1000000;
+    its.it_value.tv_nsec = ( expire % 1000000 ) * 1000;
+    if ( timerfd_settime( self->timerfd_event->fd, TFD_TIMER_ABSTIME, &its, NULL ) == 0 ) {
+        self->timerfd_expire = expire;
+    }
+#endif
+}
+
+void _timerfd_callback( int32_t fd, int16_t ev, void * arg )
+{
+    uint64_t expirations = 0;
+
+    // 只需要唤醒事件集, 清空计数即可
+    if ( read( fd, &expirations, sizeof( expirations ) ) == -1 ) {
+        // 没有可读的数据
+    }
+}
+
 int32_t event_queue_insert( struct eventset * self, struct event * ev, int32_t type )
 {
     if ( ev->status & type ) {
@@ -116,25 +203,30 @@ int32_t event_queue_remove( struct eventset * self, struct event * ev, int32_t t
 // -----------------------------------------------------------------------------
 // -----------------------------------------------------------------------------
 
+void event_init( struct event * self )
+{
+    self->fd = -1;
+    self->events = 0;
+    self->evsets = NULL;
+
+    self->cb = NULL;
+    self->arg = NULL;
+
+    self->timer_index = -1;
+    self->timer_msecs = -1;
+    self->timer_expires = 0;
+
+    self->results = 0;
+    self->status = EVSTATUS_INIT;
+}
+
 event_t event_create()
 {
     struct event * self = NULL;
 
     self = (struct event *)malloc( sizeof( struct event ) );
     if ( self ) {
-        self->fd = -1;
-        self->events = 0;
-        self->evsets = NULL;
-
-        self->cb = NULL;
-        self->arg = NULL;
-
-        self->timer_index = -1;
-        self->timer_msecs = -1;
-        self->timer_stepcnt = -1;
-
-        self->results = 0;
-        self->status = EVSTATUS_INIT;
+        event_init( self );
     }
 
     return (event_t)self;
@@ -181,22 +273,9 @@ void event_reset( event_t self )
 
     if ( ev->evsets != NULL ) {
         evsets_del( ev->evsets, self );
-        ev->evsets = NULL;
     }
 
-    ev->fd = -1;
-    ev->events = 0;
-    ev->evsets = NULL;
-
-    ev->cb = NULL;
-    ev->arg = NULL;
-
-    ev->timer_index = -1;
-    ev->timer_msecs = -1;
-    ev->timer_stepcnt = -1;
-
-    ev->results = 0;
-    ev->status = EVSTATUS_INIT;
+    event_init( ev );
 }
 
 void event_destroy( event_t self )
@@ -222,6 +301,11 @@ int32_t event_active( struct event * self, int16_t res )
 // -----------------------------------------------------------------------------
 
 evsets_t evsets_create( int32_t precision )
+{
+    return evsets_create2( precision, 0 );
+}
+
+evsets_t evsets_create2( int32_t precision, int32_t flags )
 {
     struct eventset * self = NULL;
 
@@ -239,12 +323,38 @@ evsets_t evsets_create( int32_t precision )
         TAILQ_INIT( &self->activelist );
 
         self->cache_current = 0;
-        self->evsets = self->evselect->init();
+#if defined EVENT_HAVE_IOURING
+        if ( flags & EVSETS_IOURING ) {
+            self->evsets = iouringops.init();
+            if ( self->evsets != NULL ) {
+                self->evselect = (struct eventop *)&iouringops;
+            } else {
+                syslog( LOG_WARNING, "%s() io_uring is not supported, fallback to the default eventop .", __FUNCTION__ );
+            }
+        }
+#endif
+        if ( self->evsets == NULL ) {
+            self->evsets = self->evselect->init();
+        }
         if ( self->evsets ) {
-            self->core_timer = evtimer_create( precision, TIMER_BUCKET_COUNT );
+            // 时钟周期, 高精度模式下精度的单位为微秒
+            self->flags = flags;
+            self->timer_tick = precision * 1000;
+            self->timer_precision = precision;
+            if ( flags & EVSETS_HIGHRES ) {
+                self->timer_tick = precision;
+                // 毫秒精度至少为1, 避免KCP的调度超时为0
+                self->timer_precision = precision < 1000 ? 1 : precision / 1000;
+            }
+
+            self->core_timer = evtimer_create( self->timer_tick );
             if ( self->core_timer ) {
-                self->timer_precision = precision;
-                self->expire_time = milliseconds() + self->timer_precision;
+                self->expire_time = monotonic_microseconds() + self->timer_tick;
+                // 高精度模式下由timerfd在最近的定时器到期时唤醒
+                if ( ( flags & EVSETS_HIGHRES )
+                    && _start_timerfd( self ) != 0 ) {
+                    syslog( LOG_WARNING, "%s() timerfd is not supported, the timer precision is limited to 1ms .", __FUNCTION__ );
+                }
             } else {
                 evsets_destroy( self );
                 self = NULL;
@@ -268,6 +378,23 @@ int64_t evsets_get_current( evsets_t self )
     return _get_current( (struct eventset *)self, 0 );
 }
 
+void evsets_get_ctlstats( evsets_t self, uint64_t * calls, uint64_t * saved )
+{
+    struct eventset * sets = (struct eventset *)self;
+
+    if ( calls != NULL ) {
+        *calls = sets->ctl_calls;
+    }
+    if ( saved != NULL ) {
+        *saved = sets->ctl_saved;
+    }
+}
+
+void evsets_set_sleepflag( struct eventset * self, _Atomic int32_t * flag )
+{
+    self->sleepflag = flag;
+}
+
 int32_t evsets_add( evsets_t self, event_t ev, int32_t tv )
 {
     int32_t rc = 0x00;
@@ -281,6 +408,7 @@ int32_t evsets_add( evsets_t self, event_t ev, int32_t tv )
     }
 
     e->evsets = (struct eventset *)self;
+    e->status &= ~EVSTATUS_REARMING;
 
     // 监听fd的网络事件的前提是fd合法
     if ( ( e->fd > 0 )
@@ -337,23 +465,57 @@ int32_t evsets_del( evsets_t self, event_t ev )
         return sets->evselect->del( sets->evsets, e );
     }
 
+    // 回调中删除已经删除的非常驻事件(例如关闭描述符之前), 提交后端推迟的删除
+    if ( e->status & EVSTATUS_REARMING ) {
+        e->status &= ~EVSTATUS_REARMING;
+        if ( e == sets->rearming ) {
+            sets->rearming = NULL;
+            return sets->evselect->del( sets->evsets, e );
+        }
+    }
+
     return 0;
 }
 
 int32_t evsets_dispatch( evsets_t self )
+{
+    return _dispatch( (struct eventset *)self, 1 );
+}
+
+int32_t evsets_poll( evsets_t self )
+{
+    return _dispatch( (struct eventset *)self, 0 );
+}
+
+int32_t _dispatch( struct eventset * sets, int8_t block )
 {
     int32_t res = 0;
     int32_t seconds4wait = 0;
-    struct eventset * sets = (struct eventset *)self;
 
     // 没有激活事件的情况下等待超时时间
-    if ( TAILQ_EMPTY( &sets->activelist ) ) {
-        // 根据定时器的超时时间, 确认IO的等待时间
-        seconds4wait = (int32_t)( sets->expire_time - _get_current( sets, 1 ) );
-        if ( seconds4wait < 0 ) {
-            seconds4wait = 0;
-        } else if ( seconds4wait > sets->timer_precision ) {
-            seconds4wait = sets->timer_precision;
+    if ( block && TAILQ_EMPTY( &sets->activelist ) ) {
+        // 根据定时器中最近的超时时间, 确认IO的等待时间
+        // 没有定时器的情况下一直等待, 直到IO事件或者任务唤醒
+        int32_t ticks = evtimer_next( sets->core_timer );
+
+        if ( sets->timerfd_event != NULL ) {
+            // timerfd在最近的定时器到期时唤醒, 没有定时器时停止
+            seconds4wait = -1;
+            _arm_timerfd( sets, ticks < 0 ? 0 : sets->expire_time + (int64_t)ticks * sets->timer_tick );
+        } else {
+            // 向上取整到毫秒
+            if ( ticks < 0 ) {
+                seconds4wait = -1;
+            } else {
+                int64_t usecs4wait = sets->expire_time
+                    + (int64_t)ticks * sets->timer_tick - monotonic_microseconds();
+                if ( usecs4wait < 0 ) {
+                    usecs4wait = 0;
+                } else if ( usecs4wait > (int64_t)INT32_MAX * 1000 ) {
+                    usecs4wait = (int64_t)INT32_MAX * 1000;
+                }
+                seconds4wait = (int32_t)( ( usecs4wait + 999 ) / 1000 );
+            }
         }
     }
 
@@ -364,12 +526,24 @@ int32_t evsets_dispatch( evsets_t self )
         syslog( LOG_WARNING, "%s() eventsets dispatch error <%d>", __FUNCTION__, res );
     }
 
+    // 已经醒来, 回调期间不再需要被唤醒
+    if ( sets->sleepflag != NULL ) {
+        atomic_store_explicit( sets->sleepflag, 0, memory_order_relaxed );
+    }
+
+    // 缓存的时间戳失效
+    sets->cache_current = 0;
+
     // 事件集的超时时间是要及时更新的
-    int64_t now = _get_current( sets, 1 );
+    // 处理所有经过的时钟周期, 避免回调过慢时定时器越来越滞后
+    // 长时间空闲后, 没有定时器的时钟周期直接跳过
+    int64_t now = monotonic_microseconds();
     if ( sets->expire_time <= now ) {
+        int64_t ticks = ( now - sets->expire_time ) / sets->timer_tick + 1;
+
         // 定时器时间到了, 分发事件
-        evtimer_dispatch( sets->core_timer );
-        sets->expire_time = now + sets->timer_precision;
+        evtimer_advance( sets->core_timer, (uint32_t)ticks );
+        sets->expire_time += ticks * sets->timer_tick;
     }
 
     // 处理所有事件, 并回调定义好的函数
@@ -381,6 +555,9 @@ void evsets_destroy( evsets_t self )
     struct event * ev = NULL;
     struct eventset * sets = (struct eventset *)self;
 
+    // 停止高精度定时器
+    _stop_timerfd( sets );
+
     // 删除所有事件
     for ( ev = TAILQ_FIRST( &( sets->eventlist ) ); ev; ) {
         struct event * next = TAILQ_NEXT( ev, eventlink );
@@ -414,7 +591,9 @@ void evsets_destroy( evsets_t self )
     }
 
     // 销毁IO实例
-    sets->evselect->final( sets->evsets );
+    if ( sets->evsets ) {
+        sets->evselect->final( sets->evsets );
+    }
     free( sets );
 }
 
@@ -426,6 +605,10 @@ int32_t evsets_process_active( struct eventset * self )
 
     for ( ev = TAILQ_FIRST( activelist ); ev; ev = TAILQ_FIRST( activelist ) ) {
         if ( !( ev->events & EV_PERSIST ) ) {
+            if ( ev->status & EVSTATUS_INSERTED ) {
+                self->rearming = ev;
+                ev->status |= EVSTATUS_REARMING;
+            }
             evsets_del( self, (event_t)ev );
         } else {
             event_queue_remove( self, ev, EVSTATUS_ACTIVE );
@@ -441,9 +624,12 @@ int32_t evsets_process_active( struct eventset * self )
             }
         }
 
-        // 回调
-        ++rc;
+        // 回调, timerfd仅用于唤醒, 不计入激活的事件
+        if ( likely( ev != self->timerfd_event ) ) {
+            ++rc;
+        }
         ( *ev->cb )( ev->fd, ev->results, ev->arg );
+        self->rearming = NULL;
     }
 
     return rc;
@@ -0,0 +1,569 @@
+#include "config.h"
+
+#if defined EVENT_HAVE_IOURING
+
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <syslog.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#include "utils.h"
+#include "event-internal.h"
+
+//
+// io_uring只用于就绪通知(IORING_OP_POLL_ADD), 读写仍然由channel完成
+// POLL_ADD是一次性的, 完成后需要重新提交才能模拟水平触发
+// 所有的修改只标记描述符, 在io_uring_enter()之前统一生成SQE批量提交
+//
+struct uringpair {
+    struct event * evread;
+    struct event * evwrite;
+
+    uint16_t dirty;      // 是否在修改列表中
+    uint16_t armed;      // 已经提交给内核的poll掩码
+    uint32_t generation; // poll请求的版本号, 用于过滤过期的完成事件
+};
+
+struct uringer {
+    int32_t ringfd;
+
+    // 提交队列
+    uint32_t * sq_head;
+    uint32_t * sq_tail;
+    uint32_t sq_mask;
+    uint32_t sq_entries;
+    uint32_t * sq_array;
+    uint32_t sq_pending; // 未提交的SQE个数
+    struct io_uring_sqe * sqes;
+
+    // 完成队列
+    uint32_t * cq_head;
+    uint32_t * cq_tail;
+    uint32_t cq_mask;
+    struct io_uring_cqe * cqes;
+
+    // 映射的内存
+    void * sq_ring;
+    size_t sq_ringsize;
+    void * cq_ring;
+    size_t cq_ringsize;
+    size_t sqes_size;
+
+    // 管理的所有事件对, 这个是基于描述符的
+    int32_t npairs;
+    struct uringpair * pairs;
+
+    // 修改列表
+    int32_t nchanges;
+    int32_t maxchanges;
+    int32_t * changes;
+};
+
+void * iouring_init();
+int32_t iouring_add( void * arg, struct event * ev );
+int32_t iouring_del( void * arg, struct event * ev );
+int32_t iouring_dispatch( struct eventset * sets, void * arg, int32_t tv );
+void iouring_final( void * arg );
+
+static inline int32_t _iouring_insert( struct uringer * self, int32_t max );
+static inline int32_t _iouring_change( struct uringer * self, int32_t fd );
+static inline int32_t _iouring_submit( struct uringer * self, uint32_t wait, int32_t tv );
+static inline struct io_uring_sqe * _iouring_get_sqe( struct uringer * self );
+static inline int32_t _iouring_update( struct uringer * self, int32_t fd );
+static inline int32_t _iouring_reap( struct uringer * self );
+
+const struct eventop iouringops = {
+    iouring_init,
+    iouring_add,
+    iouring_del,
+    iouring_dispatch,
+    iouring_final
+};
+
+#define MAX_IOURING_WAIT 35 * 60 * 1000
+
+// POLL_REMOVE请求自身的完成事件不需要处理
+#define IOURING_IGNORE_DATA ( (uint64_t)-1 )
+#define IOURING_USER_DATA( gen, fd ) ( ( (uint64_t)( gen ) << 32 ) | (uint32_t)( fd ) )
+
+// 描述符上的事件全部删除后, 描述符可能马上被关闭, 描述符号被新的文件重新使用
+// 内核中的poll请求引用的是旧的文件, 不能沿用, 必须取消后重新提交
+#define IOURING_STALE 0x8000
+
+static inline int32_t _io_uring_setup( uint32_t entries, struct io_uring_params * p )
+{
+    return (int32_t)syscall( __NR_io_uring_setup, entries, p );
+}
+
+static inline int32_t _io_uring_enter( int32_t fd, uint32_t submit, uint32_t wait, uint32_t flags, void * arg, size_t size )
+{
+    return (int32_t)syscall( __NR_io_uring_enter, fd, submit, wait, flags, arg, size );
+}
+
+void * iouring_init()
+{
+    int32_t ringfd = -1;
+    struct io_uring_params params;
+    struct uringer * poller = NULL;
+
+    memset( &params, 0, sizeof( params ) );
+    ringfd = _io_uring_setup( INIT_EVENTS, &params );
+    if ( ringfd == -1 ) {
+        return NULL;
+    }
+
+    // 依赖io_uring_enter()的超时参数(since Linux 5.11)
+    if ( !( params.features & IORING_FEAT_EXT_ARG ) ) {
+        close( ringfd );
+        return NULL;
+    }
+
+    // CLOSEONEXEC
+    set_cloexec( ringfd );
+
+    poller = (struct uringer *)calloc( 1, sizeof( struct uringer ) );
+    if ( poller == NULL ) {
+        close( ringfd );
+        return NULL;
+    }
+
+    poller->ringfd = ringfd;
+    poller->sq_ring = MAP_FAILED;
+    poller->cq_ring = MAP_FAILED;
+    poller->sqes = MAP_FAILED;
+
+    // 映射提交队列和完成队列
+    poller->sq_ringsize = params.sq_off.array + params.sq_entries * sizeof( uint32_t );
+    poller->cq_ringsize = params.cq_off.cqes + params.cq_entries * sizeof( struct io_uring_cqe );
+    if ( params.features & IORING_FEAT_SINGLE_MMAP ) {
+        poller->sq_ringsize = MAX( poller->sq_ringsize, poller->cq_ringsize );
+        poller->cq_ringsize = poller->sq_ringsize;
+    }
+
+    poller->sq_ring = mmap( NULL, poller->sq_ringsize,
+        PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringfd, IORING_OFF_SQ_RING );
+    if ( poller->sq_ring == MAP_FAILED ) {
+        iouring_final( poller );
+        return NULL;
+    }
+
+    if ( params.features & IORING_FEAT_SINGLE_MMAP ) {
+        poller->cq_ring = poller->sq_ring;
+    } else {
+        poller->cq_ring = mmap( NULL, poller->cq_ringsize,
+            PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringfd, IORING_OFF_CQ_RING );
+        if ( poller->cq_ring == MAP_FAILED ) {
+            iouring_final( poller );
+            return NULL;
+        }
+    }
+
+    poller->sqes_size = params.sq_entries * sizeof( struct io_uring_sqe );
+    poller->sqes = (struct io_uring_sqe *)mmap( NULL, poller->sqes_size,
+        PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringfd, IORING_OFF_SQES );
+    if ( poller->sqes == MAP_FAILED ) {
+        iouring_final( poller );
+        return NULL;
+    }
+
+    poller->sq_head = (uint32_t *)( (char *)poller->sq_ring + params.sq_off.head );
+    poller->sq_tail = (uint32_t *)( (char *)poller->sq_ring + params.sq_off.tail );
+    poller->sq_mask = *(uint32_t *)( (char *)poller->sq_ring + params.sq_off.ring_mask );
+    poller->sq_entries = params.sq_entries;
+    poller->sq_array = (uint32_t *)( (char *)poller->sq_ring + params.sq_off.array );
+    poller->cq_head = (uint32_t *)( (char *)poller->cq_ring + params.cq_off.head );
+    poller->cq_tail = (uint32_t *)( (char *)poller->cq_ring + params.cq_off.tail );
+    poller->cq_mask = *(uint32_t *)( (char *)poller->cq_ring + params.cq_off.ring_mask );
+    poller->cqes = (struct io_uring_cqe *)( (char *)poller->cq_ring + params.cq_off.cqes );
+
+    poller->pairs = (struct uringpair *)calloc( INIT_EVENTS, sizeof( struct uringpair ) );
+    poller->changes = (int32_t *)malloc( INIT_EVENTS * sizeof( int32_t ) );
+    if ( poller->pairs == NULL || poller->changes == NULL ) {
+        iouring_final( poller );
+        return NULL;
+    }
+
+    poller->npairs = INIT_EVENTS;
+    poller->maxchanges = INIT_EVENTS;
+
+    return poller;
+}
+
+int32_t _iouring_insert( struct uringer * self, int32_t max )
+{
+    int32_t npairs = 0;
+    struct uringpair * pairs = NULL;
+
+    npairs = self->npairs;
+    for ( ; npairs <= max; ) {
+        npairs <<= 1;
+    }
+
+    pairs = (struct uringpair *)realloc(
+        self->pairs, npairs * sizeof( struct uringpair ) );
+    if ( unlikely( pairs == NULL ) ) {
+        return -1;
+    }
+
+    self->pairs = pairs;
+    memset( pairs + self->npairs, 0, ( npairs - self->npairs ) * sizeof( struct uringpair ) );
+    self->npairs = npairs;
+
+    return 0;
+}
+
+int32_t _iouring_change( struct uringer * self, int32_t fd )
+{
+    struct uringpair * pair = &( self->pairs[fd] );
+
+    if ( pair->dirty ) {
+        return 0;
+    }
+
+    if ( unlikely( self->nchanges == self->maxchanges ) ) {
+        int32_t maxchanges = self->maxchanges << 1;
+        int32_t * changes = (int32_t *)realloc(
+            self->changes, maxchanges * sizeof( int32_t ) );
+        if ( changes == NULL ) {
+            return -1;
+        }
+
+        self->changes = changes;
+        self->maxchanges = maxchanges;
+    }
+
+    pair->dirty = 1;
+    self->changes[self->nchanges++] = fd;
+
+    return 0;
+}
+
+int32_t _iouring_submit( struct uringer * self, uint32_t wait, int32_t tv )
+{
+    int32_t rc = 0;
+    uint32_t flags = 0;
+    struct __kernel_timespec ts;
+    struct io_uring_getevents_arg arg;
+
+    memset( &arg, 0, sizeof( arg ) );
+
+    if ( wait > 0 ) {
+        flags = IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG;
+
+        if ( tv >= 0 ) {
+            ts.tv_sec = tv / 1000;
+            ts.tv_nsec = ( tv % 1000 ) * 1000000;
+            arg.ts = (uint64_t)(uintptr_t)&ts;
+        }
+    } else if ( self->sq_pending == 0 ) {
+        return 0;
+    }
+
+    rc = _io_uring_enter( self->ringfd, self->sq_pending, wait, flags, &arg, sizeof( arg ) );
+    if ( rc >= 0 ) {
+        self->sq_pending -= (uint32_t)rc;
+        return 0;
+    }
+
+    // 超时或者被信号中断
+    if ( errno == ETIME || errno == EINTR ) {
+        return 0;
+    }
+
+    // 完成队列溢出, 需要先收割完成事件
+    if ( errno == EBUSY || errno == EAGAIN ) {
+        return 0;
+    }
+
+    return -1;
+}
+
+struct io_uring_sqe * _iouring_get_sqe( struct uringer * self )
+{
+    uint32_t head, tail;
+    struct io_uring_sqe * sqe = NULL;
+
+    tail = *( self->sq_tail );
+    head = __atomic_load_n( self->sq_head, __ATOMIC_ACQUIRE );
+
+    if ( unlikely( tail - head >= self->sq_entries ) ) {
+        // 提交队列已满, 先提交一部分
+        if ( _iouring_submit( self, 0, 0 ) != 0 ) {
+            return NULL;
+        }
+
+        head = __atomic_load_n( self->sq_head, __ATOMIC_ACQUIRE );
+        if ( tail - head >= self->sq_entries ) {
+            return NULL;
+        }
+    }
+
+    sqe = &( self->sqes[tail & self->sq_mask] );
+    memset( sqe, 0, sizeof( struct io_uring_sqe ) );
+    self->sq_array[tail & self->sq_mask] = tail & self->sq_mask;
+
+    ++self->sq_pending;
+    __atomic_store_n( self->sq_tail, tail + 1, __ATOMIC_RELEASE );
+
+    return sqe;
+}
+
+int32_t _iouring_update( struct uringer * self, int32_t fd )
+{
+    uint16_t events = 0;
+    struct io_uring_sqe * sqe = NULL;
+    struct uringpair * pair = &( self->pairs[fd] );
+
+    if ( pair->evread != NULL ) {
+        events |= POLLIN;
+    }
+    if ( pair->evwrite != NULL ) {
+        events |= POLLOUT;
+    }
+
+    if ( pair->armed == events ) {
+        pair->dirty = 0;
+        return 0;
+    }
+
+    // 关注的事件发生了变化, 取消内核中的poll请求
+    if ( pair->armed != 0 ) {
+        sqe = _iouring_get_sqe( self );
+        if ( unlikely( sqe == NULL ) ) {
+            syslog( LOG_WARNING, "%s() the submission queue of io_uring is full .", __FUNCTION__ );
+            return -1;
+        }
+
+        sqe->opcode = IORING_OP_POLL_REMOVE;
+        sqe->fd = -1;
+        sqe->addr = IOURING_USER_DATA( pair->generation, fd );
+        sqe->user_data = IOURING_IGNORE_DATA;
+
+        pair->armed = 0;
+        ++pair->generation;
+    }
+
+    if ( events != 0 ) {
+        sqe = _iouring_get_sqe( self );
+        if ( unlikely( sqe == NULL ) ) {
+            syslog( LOG_WARNING, "%s() the submission queue of io_uring is full .", __FUNCTION__ );
+            return -1;
+        }
+
+        sqe->opcode = IORING_OP_POLL_ADD;
+        sqe->fd = fd;
+        sqe->poll32_events = events;
+        sqe->user_data = IOURING_USER_DATA( pair->generation, fd );
+
+        pair->armed = events;
+    }
+
+    pair->dirty = 0;
+    return 0;
+}
+
+int32_t _iouring_reap( struct uringer * self )
+{
+    int32_t nactives = 0;
+    uint32_t head, tail;
+
+    head = *( self->cq_head );
+    tail = __atomic_load_n( self->cq_tail, __ATOMIC_ACQUIRE );
+
+    for ( ; head != tail; ++head ) {
+        int32_t fd, res;
+        uint32_t generation;
+
+        struct uringpair * pair = NULL;
+        struct event *evread = NULL, *evwrite = NULL;
+        struct io_uring_cqe * cqe = &( self->cqes[head & self->cq_mask] );
+
+        if ( cqe->user_data == IOURING_IGNORE_DATA ) {
+            continue;
+        }
+
+        res = cqe->res;
+        fd = (int32_t)( cqe->user_data & 0xffffffff );
+        generation = (uint32_t)( cqe->user_data >> 32 );
+
+        if ( fd < 0 || fd >= self->npairs ) {
+            continue;
+        }
+
+        // 过期的poll请求(已经被取消或者替换)
+        pair = &( self->pairs[fd] );
+        if ( generation != pair->generation ) {
+            continue;
+        }
+
+        // poll请求已经完成, 重新提交
+        pair->armed = 0;
+        ++pair->generation;
+        _iouring_change( self, fd );
+
+        if ( res == -ECANCELED ) {
+            continue;
+        }
+
+        if ( res < 0 || ( res & ( POLLHUP | POLLERR | POLLNVAL ) ) ) {
+            evread = pair->evread;
+            evwrite = pair->evwrite;
+        } else {
+            if ( res & ( POLLIN | POLLPRI ) ) {
+                evread = pair->evread;
+            }
+            if ( res & POLLOUT ) {
+                evwrite = pair->evwrite;
+            }
+        }
+
+        if ( evread ) {
+            ++nactives;
+            event_active( evread, EV_READ );
+        }
+        if ( evwrite ) {
+            ++nactives;
+            event_active( evwrite, EV_WRITE );
+        }
+    }
+
+    __atomic_store_n( self->cq_head, head, __ATOMIC_RELEASE );
+
+    return nactives;
+}
+
+int32_t iouring_add( void * arg, struct event * ev )
+{
+    int32_t fd = 0;
+    struct uringpair * pair = NULL;
+    struct uringer * poller = (struct uringer *)arg;
+
+    fd = event_get_fd( (event_t)ev );
+    if ( fd < 0 ) {
+        return -3;
+    } else if ( fd >= poller->npairs ) {
+        if ( _iouring_insert( poller, fd ) != 0 ) {
+            return -1;
+        }
+    }
+
+    if ( _iouring_change( poller, fd ) != 0 ) {
+        return -2;
+    }
+
+    pair = &( poller->pairs[fd] );
+
+    if ( ev->events & EV_READ ) {
+        pair->evread = ev;
+    }
+    if ( ev->events & EV_WRITE ) {
+        pair->evwrite = ev;
+    }
+
+    return 0;
+}
+
+int32_t iouring_del( void * arg, struct event * ev )
+{
+    int32_t fd = 0;
+    struct uringpair * pair = NULL;
+    struct uringer * poller = (struct uringer *)arg;
+
+    fd = event_get_fd( (event_t)ev );
+    if ( fd >= poller->npairs ) {
+        return -1;
+    }
+
+    if ( _iouring_change( poller, fd ) != 0 ) {
+        return -2;
+    }
+
+    pair = &( poller->pairs[fd] );
+
+    if ( ev->events & EV_READ ) {
+        pair->evread = NULL;
+    }
+    if ( ev->events & EV_WRITE ) {
+        pair->evwrite = NULL;
+    }
+
+    // 不再关注任何事件, 重新添加时必须提交新的poll请求
+    if ( pair->evread == NULL
+        && pair->evwrite == NULL && pair->armed != 0 ) {
+        pair->armed |= IOURING_STALE;
+    }
+
+    return 0;
+}
+
+int32_t iouring_dispatch( struct eventset * sets, void * arg, int32_t tv )
+{
+    int32_t i, nchanges, res = 0;
+    struct uringer * poller = (struct uringer *)arg;
+
+    if ( unlikely( tv > MAX_IOURING_WAIT ) ) {
+        tv = MAX_IOURING_WAIT;
+    }
+
+    // 生成所有修改的SQE
+    // 提交队列已满的描述符保留在修改列表中, 下一次再提交
+    for ( i = 0, nchanges = 0; i < poller->nchanges; ++i ) {
+        int32_t fd = poller->changes[i];
+
+        if ( poller->pairs[fd].dirty
+            && _iouring_update( poller, fd ) != 0 ) {
+            poller->changes[nchanges++] = fd;
+        }
+    }
+    poller->nchanges = nchanges;
+    if ( unlikely( nchanges > 0 ) ) {
+        tv = 0;
+    }
+
+    // 批量提交的同时等待完成事件
+    if ( _iouring_submit( poller, tv == 0 ? 0 : 1, tv ) != 0 ) {
+        syslog( LOG_WARNING, "%s() io_uring_enter() error <%d, %s>", __FUNCTION__, errno, strerror( errno ) );
+        return -1;
+    }
+
+    res = _iouring_reap( poller );
+
+    return res;
+}
+
+void iouring_final( void * arg )
+{
+    struct uringer * poller = (struct uringer *)arg;
+
+    if ( poller->pairs ) {
+        free( poller->pairs );
+    }
+    if ( poller->changes ) {
+        free( poller->changes );
+    }
+    if ( poller->sqes != MAP_FAILED ) {
+        munmap( poller->sqes, poller->sqes_size );
+    }
+    if ( poller->cq_ring != MAP_FAILED
+        && poller->cq_ring != poller->sq_ring ) {
+        munmap( poller->cq_ring, poller->cq_ringsize );
+    }
+    if ( poller->sq_ring != MAP_FAILED ) {
+        munmap( poller->sq_ring, poller->sq_ringsize );
+    }
+    if ( poller->ringfd >= 0 ) {
+        close( poller->ringfd );
+    }
+
+    free( poller );
+}
+
+#endif
@@ -6,6 +6,7 @@
 #include <sys/types.h>
 #include <sys/uio.h>
 #include <unistd.h>
+#include <stdatomic.h>
 
 #include "message.h"
 #include "network-internal.h"
@@ -16,6 +17,7 @@ static inline ssize_t _left( struct buffer * self );
 static inline int32_t _expand( struct buffer * self, size_t length );
 static inline ssize_t _read_withvector( struct buffer * self, int32_t fd );
 static inline ssize_t _read_withsize( struct buffer * self, int32_t fd, ssize_t nbytes );
+static inline void _release_buffer( struct message * self );
 
 void _align( struct buffer * self )
 {
@@ -245,6 +247,53 @@ ssize_t buffer_receive( struct buffer * self, int32_t fd, struct sockaddr_storag
 // -----------------------------------------------------------------------------
 // -----------------------------------------------------------------------------
 
+struct payload {
+    _Atomic int32_t refcount;
+    size_t length;
+    char data[];
+};
+
+struct payload * payload_create( const char * buffer, size_t len )
+{
+    struct payload * self = (struct payload *)malloc( sizeof( struct payload ) + len );
+    if ( self != NULL ) {
+        self->length = len;
+        memcpy( self->data, buffer, len );
+        atomic_init( &self->refcount, 1 );
+    }
+
+    return self;
+}
+
+void payload_retain( struct payload * self )
+{
+    atomic_fetch_add_explicit( &self->refcount, 1, memory_order_relaxed );
+}
+
+void payload_release( struct payload * self )
+{
+    // 最后一个引用释放数据
+    if ( atomic_fetch_sub_explicit( &self->refcount, 1, memory_order_acq_rel ) == 1 ) {
+        free( self );
+    }
+}
+
+void _release_buffer( struct message * self )
+{
+    if ( self->payload != NULL ) {
+        payload_release( self->payload );
+        self->payload = NULL;
+    } else if ( self->buffer != NULL ) {
+        free( self->buffer );
+    }
+
+    self->buffer = NULL;
+}
+
+// -----------------------------------------------------------------------------
+// -----------------------------------------------------------------------------
+// -----------------------------------------------------------------------------
+
 struct message * message_create()
 {
     struct message * self = (struct message *)malloc( sizeof( struct message ) );
@@ -253,6 +302,8 @@ struct message * message_create()
         self->nsuccess = 0;
         self->length = 0;
         self->buffer = NULL;
+        self->payload = NULL;
+        self->nreceivers = 0;
         self->tolist = NULL;
     }
 
@@ -272,10 +323,7 @@ void message_destroy( struct message * self )
     //     self->failurelist = NULL;
     // }
 
-    if ( self->buffer ) {
-        free( self->buffer );
-        self->buffer = NULL;
-    }
+    _release_buffer( self );
 
     free( self );
 }
@@ -337,9 +385,7 @@ int32_t message_reserve_receivers( struct message * self, uint32_t count )
 
 int32_t message_set_buffer( struct message * self, char * buffer, size_t len )
 {
-    if ( self->buffer ) {
-        free( self->buffer );
-    }
+    _release_buffer( self );
 
     self->length = len;
     self->buffer = buffer;
@@ -349,9 +395,7 @@ int32_t message_set_buffer( struct message * self, char * buffer, size_t len )
 
 int32_t message_add_buffer( struct message * self, const char * buffer, size_t len )
 {
-    if ( self->buffer ) {
-        free( self->buffer );
-    }
+    _release_buffer( self );
 
     self->length = len;
     self->buffer = (char *)malloc( len );
@@ -361,6 +405,18 @@ int32_t message_add_buffer( struct message * self, const char * buffer, size_t l
     return 0;
 }
 
+int32_t message_set_payload( struct message * self, struct payload * payload )
+{
+    payload_retain( payload );
+    _release_buffer( self );
+
+    self->payload = payload;
+    self->length = payload->length;
+    self->buffer = payload->data;
+
+    return 0;
+}
+
 // int32_t message_add_failure( struct message * self, sid_t id )
 // {
 //     if ( self->failurelist == NULL )
@@ -385,6 +441,5 @@ int32_t message_add_buffer( struct message * self, const char * buffer, size_t l
 
 int32_t message_is_complete( struct message * self )
 {
-    int32_t totalcount = self->tolist ? sidlist_count( self->tolist ) : 0;
-    return ( totalcount == self->nsuccess + self->nfailure );
+    return ( (int32_t)message_get_receivers( self ) == self->nsuccess + self->nfailure );
 }
@@ -60,6 +60,16 @@ ssize_t buffer_receive( struct buffer * self, int32_t fd, struct sockaddr_storag
 
 // TODO: 是否有必要写一个对象池来管理所有缓冲区的分配与释放
 
+//
+// 共享数据
+// 创建后不可修改, 多个网络线程的消息共享同一份数据, 引用计数归零时释放
+//
+struct payload;
+
+struct payload * payload_create( const char * buffer, size_t len );
+void payload_retain( struct payload * self );
+void payload_release( struct payload * self );
+
 //
 // 消息
 //
@@ -69,6 +79,8 @@ struct message {
 
     char * buffer;
     size_t length;
+    struct payload * payload; // 共享的数据(buffer指向共享数据)
+    uint32_t nreceivers;      // 不记录会话ID的接收者个数
     struct sidlist * tolist;
     // struct sidlist * failurelist;
 };
@@ -83,6 +95,8 @@ int32_t message_add_receiver( struct message * self, sid_t id );
 int32_t message_add_receivers( struct message * self, sid_t * ids, uint32_t count );
 int32_t message_set_receivers( struct message * self, struct sidlist * ids );
 int32_t message_reserve_receivers( struct message * self, uint32_t count );
+// 增加接收者的个数(不需要接收列表, 例如广播给所有会话)
+#define message_count_receiver( self ) ++( ( self )->nreceivers )
 
 // 增加消息计数器
 // int32_t message_add_failure( struct message * self, sid_t id );
@@ -92,6 +106,12 @@ int32_t message_reserve_receivers( struct message * self, uint32_t count );
 // 设置消息的数据
 int32_t message_set_buffer( struct message * self, char * buffer, size_t len );
 int32_t message_add_buffer( struct message * self, const char * buffer, size_t len );
+// 设置消息的共享数据(增加引用计数)
+int32_t message_set_payload( struct message * self, struct payload * payload );
+
+// 消息的接收者个数
+#define message_get_receivers( self ) \
+    ( ( self )->nreceivers + ( ( self )->tolist ? sidlist_count( ( self )->tolist ) : 0 ) )
 
 // 消息是否完全发送
 int32_t message_is_complete( struct message * self );
@@ -5,6 +5,9 @@
 
 QUEUE_GENERATE( taskqueue, struct task )
 
+static inline int32_t _msgqueue_init( struct msgqueue * self, uint32_t size );
+static inline void _msgqueue_final( struct msgqueue * self );
+
 struct msgqueue * msgqueue_create( uint32_t size )
 {
     struct msgqueue * self = NULL;
@@ -13,9 +16,10 @@ struct msgqueue * msgqueue_create( uint32_t size )
     if ( self ) {
         self->popfd = -1;
         self->pushfd = -1;
+        self->capacity = 0;
         evlock_init( &self->lock );
 
-        if ( QUEUE_INIT( taskqueue )( &self->queue, size ) != 0 ) {
+        if ( _msgqueue_init( self, size ) != 0 ) {
             msgqueue_destroy( self );
             self = NULL;
         } else {
@@ -50,28 +54,357 @@ struct msgqueue * msgqueue_create( uint32_t size )
     return self;
 }
 
-int32_t msgqueue_push( struct msgqueue * self, struct task * task )
+void msgqueue_set_capacity( struct msgqueue * self, uint32_t capacity )
+{
+    self->capacity = capacity;
+}
+
+void msgqueue_notify( struct msgqueue * self )
+{
+    uint64_t one = 1;
+
+    if ( sizeof( one )
+        != write( self->pushfd, &one, sizeof( one ) ) ) {
+        // 写出错了
+        syslog( LOG_WARNING, "%s() : write to Pipe(fd:%u) error .", __FUNCTION__, self->pushfd );
+    }
+}
+
+#if defined USE_LOCKFREE_QUEUE
+
+//
+// 无锁环形队列(Dmitry Vyukov's bounded MPMC queue)
+// 每个槽位的序号标识了槽位的状态:
+//      sequence == pos     - 空闲, 生产者可以写入
+//      sequence == pos + 1 - 已写入, 消费者可以取走
+//
+
+struct msgslot {
+    _Atomic uint32_t sequence;
+    struct task task;
+};
+
+static inline int32_t _ring_push( struct msgqueue * self, struct task * task );
+static inline int32_t _ring_pop( struct msgqueue * self, struct task * task );
+static inline uint32_t _overflow_take( struct msgqueue * self, struct taskqueue * queue, uint32_t count );
+
+int32_t _msgqueue_init( struct msgqueue * self, uint32_t size )
+{
+    size = size ? size : 8;
+    assert( ( size & ( size - 1 ) ) == 0 );
+
+    self->mask = size - 1;
+    self->head = 0;
+    atomic_init( &self->tail, 0 );
+    atomic_init( &self->count, 0 );
+    atomic_init( &self->overflowing, 0 );
+
+    self->slots = (struct msgslot *)malloc( size * sizeof( struct msgslot ) );
+    if ( self->slots == NULL ) {
+        QUEUE_INIT( taskqueue )( &self->overflow, 8 );
+        return -1;
+    }
+    for ( uint32_t i = 0; i < size; ++i ) {
+        atomic_init( &self->slots[i].sequence, i );
+    }
+
+    return QUEUE_INIT( taskqueue )( &self->overflow, 64 );
+}
+
+void _msgqueue_final( struct msgqueue * self )
+{
+    if ( self->slots != NULL ) {
+        free( self->slots );
+        self->slots = NULL;
+    }
+
+    QUEUE_CLEAR( taskqueue ) ( &self->overflow );
+}
+
+int32_t _ring_push( struct msgqueue * self, struct task * task )
+{
+    struct msgslot * slot = NULL;
+    uint32_t pos = atomic_load_explicit( &self->tail, memory_order_relaxed );
+
+    for ( ;; ) {
+        slot = &( self->slots[pos & self->mask] );
+        int32_t diff = (int32_t)( atomic_load_explicit( &slot->sequence, memory_order_acquire ) - pos );
+
+        if ( diff == 0 ) {
+            // 抢占槽位
+            if ( atomic_compare_exchange_weak_explicit( &self->tail,
+                     &pos, pos + 1, memory_order_relaxed, memory_order_relaxed ) ) {
+                break;
+            }
+        } else if ( diff < 0 ) {
+            // 环形队列满了
+            return -1;
+        } else {
+            pos = atomic_load_explicit( &self->tail, memory_order_relaxed );
+        }
+    }
+
+    slot->task = *task;
+    atomic_store_explicit( &slot->sequence, pos + 1, memory_order_release );
+
+    return 0;
+}
+
+int32_t _ring_pop( struct msgqueue * self, struct task * task )
+{
+    uint32_t pos = self->head;
+    struct msgslot * slot = &( self->slots[pos & self->mask] );
+
+    // 槽位还未写入(空或者生产者正在写)
+    if ( atomic_load_explicit( &slot->sequence, memory_order_acquire ) != pos + 1 ) {
+        return 0;
+    }
+
+    *task = slot->task;
+    atomic_store_explicit( &slot->sequence, pos + self->mask + 1, memory_order_release );
+    self->head = pos + 1;
+
+    return 1;
+}
+
+uint32_t _overflow_take( struct msgqueue * self, struct taskqueue * queue, uint32_t count )
+{
+    uint32_t n = 0;
+
+    // 环形队列中还有被抢占但未写完的槽位时, 不能取溢出队列,
+    // 保证同一个生产者的任务是有序的
+    if ( !atomic_load_explicit( &self->overflowing, memory_order_acquire )
+        || atomic_load_explicit( &self->tail, memory_order_acquire ) != self->head ) {
+        return 0;
+    }
+
+    evlock_lock( &self->lock );
+    for ( ; n < count; ++n ) {
+        struct task task;
+        if ( QUEUE_POP( taskqueue )( &self->overflow, &task ) == 0 ) {
+            break;
+        }
+        QUEUE_PUSH( taskqueue )( queue, &task );
+    }
+    if ( QUEUE_COUNT( taskqueue )( &self->overflow ) == 0 ) {
+        atomic_store_explicit( &self->overflowing, 0, memory_order_release );
+    }
+    evlock_unlock( &self->lock );
+
+    return n;
+}
+
+int32_t msgqueue_push( struct msgqueue * self, struct task * task, int32_t flags )
+{
+    int32_t rc = 0;
+
+    // 队列已满
+    if ( self->capacity > 0
+        && !( flags & MSGQUEUE_NOLIMIT )
+        && atomic_load_explicit( &self->count, memory_order_relaxed ) >= (int32_t)self->capacity ) {
+        return -2;
+    }
+
+    // 溢出期间, 所有的任务都进入溢出队列, 保证有序
+    if ( atomic_load_explicit( &self->overflowing, memory_order_acquire )
+        || _ring_push( self, task ) != 0 ) {
+        evlock_lock( &self->lock );
+        rc = QUEUE_PUSH( taskqueue )( &self->overflow, task );
+        if ( rc == 0 ) {
+            atomic_store_explicit( &self->overflowing, 1, memory_order_release );
+        }
+        evlock_unlock( &self->lock );
+    }
+
+    // 写入后计数, 由空变为非空时通知消费者
+    if ( likely( rc == 0 )
+        && atomic_fetch_add( &self->count, 1 ) == 0 && ( flags & MSGQUEUE_NOTIFY ) ) {
+        msgqueue_notify( self );
+    }
+
+    return rc;
+}
+
+uint32_t msgqueue_pushs( struct msgqueue * self, struct task * tasks, uint32_t count, int32_t flags )
+{
+    uint32_t n = 0;
+
+    // 队列的剩余空间
+    if ( self->capacity > 0 && !( flags & MSGQUEUE_NOLIMIT ) ) {
+        int32_t used = atomic_load_explicit( &self->count, memory_order_relaxed );
+        uint32_t room = used < (int32_t)self->capacity ? self->capacity - used : 0;
+        count = MIN( count, room );
+    }
+
+    for ( ; n < count; ++n ) {
+        if ( !atomic_load_explicit( &self->overflowing, memory_order_acquire )
+            && _ring_push( self, &tasks[n] ) == 0 ) {
+            continue;
+        }
+
+        // 溢出期间, 剩余的任务都进入溢出队列
+        evlock_lock( &self->lock );
+        for ( ; n < count; ++n ) {
+            if ( QUEUE_PUSH( taskqueue )( &self->overflow, &tasks[n] ) != 0 ) {
+                break;
+            }
+            atomic_store_explicit( &self->overflowing, 1, memory_order_release );
+        }
+        evlock_unlock( &self->lock );
+        break;
+    }
+
+    if ( n > 0
+        && atomic_fetch_add( &self->count, (int32_t)n ) == 0 && ( flags & MSGQUEUE_NOTIFY ) ) {
+        msgqueue_notify( self );
+    }
+
+    return n;
+}
+
+int32_t msgqueue_drop( struct msgqueue * self, struct task * task )
+{
+    // 环形队列只能由消费者出队
+    return 0;
+}
+
+int32_t msgqueue_pop( struct msgqueue * self, struct task * task )
+{
+    return msgqueue_pops( self, task, 1 );
+}
+
+int32_t msgqueue_pops( struct msgqueue * self, struct task * tasks, uint32_t count )
+{
+    uint32_t i = 0;
+
+    for ( ; i < count; ++i ) {
+        if ( _ring_pop( self, &tasks[i] ) == 0 ) {
+            break;
+        }
+    }
+
+    if ( i < count ) {
+        struct taskqueue queue;
+        QUEUE_INIT( taskqueue )( &queue, 64 );
+        uint32_t n = _overflow_take( self, &queue, count - i );
+        for ( ; n > 0; --n ) {
+            QUEUE_POP( taskqueue )( &queue, &tasks[i++] );
+        }
+        QUEUE_CLEAR( taskqueue )( &queue );
+    }
+
+    if ( i > 0 ) {
+        atomic_fetch_sub( &self->count, (int32_t)i );
+    }
+
+    return i;
+}
+
+int32_t msgqueue_swap( struct msgqueue * self, struct taskqueue * queue )
+{
+    uint32_t n = 0, capacity = self->mask + 1;
+
+    // 最多取走一圈, 避免生产者过快时消费者无法返回
+    for ( ; n < capacity; ++n ) {
+        struct task task;
+        if ( _ring_pop( self, &task ) == 0 ) {
+            break;
+        }
+        QUEUE_PUSH( taskqueue )( queue, &task );
+    }
+    n += _overflow_take( self, queue, UINT32_MAX );
+
+    // 还有任务没有取走(生产者尚未写完, 或者超出一圈)时, 生产者不会再通知,
+    // 消费者在阻塞之前通过msgqueue_count()检查
+    if ( n > 0 ) {
+        atomic_fetch_sub( &self->count, (int32_t)n );
+    }
+
+    return 0;
+}
+
+uint32_t msgqueue_count( struct msgqueue * self )
+{
+    int32_t rc = atomic_load( &self->count );
+    return rc > 0 ? (uint32_t)rc : 0;
+}
+
+#else
+
+int32_t _msgqueue_init( struct msgqueue * self, uint32_t size )
+{
+    return QUEUE_INIT( taskqueue )( &self->queue, size );
+}
+
+void _msgqueue_final( struct msgqueue * self )
+{
+    QUEUE_CLEAR( taskqueue ) ( &self->queue );
+}
+
+int32_t msgqueue_push( struct msgqueue * self, struct task * task, int32_t flags )
 {
     int32_t rc = -1;
     uint32_t isbc = 0;
 
     evlock_lock( &self->lock );
 
-    rc = QUEUE_PUSH( taskqueue )( &self->queue, task );
     isbc = QUEUE_COUNT( taskqueue )( &self->queue );
+    if ( self->capacity > 0
+        && !( flags & MSGQUEUE_NOLIMIT )
+        && isbc >= self->capacity ) {
+        // 队列已满
+        rc = -2;
+    } else {
+        rc = QUEUE_PUSH( taskqueue )( &self->queue, task );
+        isbc = QUEUE_COUNT( taskqueue )( &self->queue );
+    }
 
     evlock_unlock( &self->lock );
 
-    if ( unlikely( rc == 0 && isbc == 1 ) ) {
-        uint64_t one = 1;
+    if ( unlikely( rc == 0 && isbc == 1 && ( flags & MSGQUEUE_NOTIFY ) ) ) {
+        msgqueue_notify( self );
+    }
+
+    return rc;
+}
+
+uint32_t msgqueue_pushs( struct msgqueue * self, struct task * tasks, uint32_t count, int32_t flags )
+{
+    uint32_t n = 0, isbc = 0;
 
-        if ( sizeof( one )
-            != write( self->pushfd, &one, sizeof( one ) ) ) {
-            // 写出错了
-            syslog( LOG_WARNING, "%s() : write to Pipe(fd:%u) error .", __FUNCTION__, self->pushfd );
+    evlock_lock( &self->lock );
+
+    isbc = QUEUE_COUNT( taskqueue )( &self->queue );
+    if ( self->capacity > 0 && !( flags & MSGQUEUE_NOLIMIT ) ) {
+        // 队列的剩余空间
+        count = MIN( count, isbc < self->capacity ? self->capacity - isbc : 0 );
+    }
+    for ( ; n < count; ++n ) {
+        if ( QUEUE_PUSH( taskqueue )( &self->queue, &tasks[n] ) != 0 ) {
+            break;
         }
     }
 
+    evlock_unlock( &self->lock );
+
+    if ( n > 0 && isbc == 0 && ( flags & MSGQUEUE_NOTIFY ) ) {
+        msgqueue_notify( self );
+    }
+
+    return n;
+}
+
+int32_t msgqueue_drop( struct msgqueue * self, struct task * task )
+{
+    int32_t rc = 0;
+
+    evlock_lock( &self->lock );
+    if ( QUEUE_TOP( taskqueue )( &self->queue, task ) == 0
+        && ( task->flags & eTaskFlag_Droppable ) ) {
+        rc = QUEUE_POP( taskqueue )( &self->queue, task );
+    }
+    evlock_unlock( &self->lock );
+
     return rc;
 }
 
@@ -121,6 +454,8 @@ uint32_t msgqueue_count( struct msgqueue * self )
     return rc;
 }
 
+#endif
+
 int32_t msgqueue_popfd( struct msgqueue * self )
 {
     int32_t rc = 0;
@@ -145,10 +480,9 @@ int32_t msgqueue_destroy( struct msgqueue * self )
     self->popfd = -1;
     self->pushfd = -1;
 
-    QUEUE_CLEAR( taskqueue ) ( &self->queue );
+    _msgqueue_final( self );
     evlock_destroy( &self->lock );
     free( self );
 
     return 0;
 }
-
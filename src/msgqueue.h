@@ -3,6 +3,7 @@
 #define MSGQUEUE_H
 
 #include <stdint.h>
+#include <stdatomic.h>
 
 #include "lock.h"
 #include "queue.h"
@@ -18,6 +19,15 @@ enum {
     eTaskType_Data = 2, // 数据任务
 };
 
+// 任务标志
+enum {
+    eTaskFlag_Droppable = 0x01, // 队列满时可以被丢弃
+};
+
+// 提交任务的选项
+#define MSGQUEUE_NOTIFY  0x01 // 队列由空变为非空时通知消费者
+#define MSGQUEUE_NOLIMIT 0x02 // 不受队列容量的限制
+
 // 任务填充长度
 #if __SIZEOF_POINTER__ == 4
     #define TASK_PADDING_SIZE 60
@@ -31,6 +41,7 @@ enum {
 struct task {
     int16_t type;  // 2bytes
     int16_t utype; // 2bytes
+    int16_t flags; // 2bytes
     union {
         void * taskdata;
         char data[TASK_PADDING_SIZE];
@@ -44,7 +55,38 @@ QUEUE_PROTOTYPE( taskqueue, struct task )
 // 消息队列
 // 线程安全的消息队列, 有通知的功能
 //
+// USE_LOCKFREE_QUEUE - 多生产者单消费者的无锁环形队列,
+//                      环形队列满了以后, 退化为加锁的溢出队列
+//
+#if defined USE_LOCKFREE_QUEUE
+
+struct msgslot;
+struct msgqueue {
+    uint32_t mask;
+    uint32_t capacity; // 队列容量, 0-不限制
+    struct msgslot * slots;
+
+    // 生产者和消费者的位置, 独占缓存行
+    _Atomic uint32_t tail __attribute__((aligned(64)));
+    uint32_t head __attribute__((aligned(64)));
+
+    // 尚未取走的任务数, 由空变为非空时通知消费者
+    _Atomic int32_t count __attribute__((aligned(64)));
+
+    // 溢出队列
+    _Atomic int32_t overflowing;
+    struct taskqueue overflow;
+
+    int32_t popfd;
+    int32_t pushfd;
+
+    struct evlock lock;
+};
+
+#else
+
 struct msgqueue {
+    uint32_t capacity; // 队列容量, 0-不限制
     struct taskqueue queue;
     int32_t popfd;
     int32_t pushfd;
@@ -52,12 +94,33 @@ struct msgqueue {
     struct evlock lock;
 };
 
+#endif
+
 // 创建消息队列
 struct msgqueue * msgqueue_create( uint32_t size );
 
+// 设置队列容量, 0-不限制(默认)
+// 无锁队列的容量是软限制, 并发提交时可能略微超出
+void msgqueue_set_capacity( struct msgqueue * self, uint32_t capacity );
+
 // 生产者发送任务
-// isnotify - 是否需要通知消费者
-int32_t msgqueue_push( struct msgqueue * self, struct task * task );
+// flags    - MSGQUEUE_NOTIFY: 队列由空变为非空时通知消费者;
+//            不通知时, 由调用者自行决定何时调用msgqueue_notify()
+//            MSGQUEUE_NOLIMIT: 不受队列容量的限制
+// 返回值: 0-成功, -1-失败, -2-队列已满
+// 消费者阻塞等待通知之前, 需要先检查msgqueue_count()
+int32_t msgqueue_push( struct msgqueue * self, struct task * task, int32_t flags );
+
+// 生产者批量发送任务, 只加锁一次, 最多通知一次
+// 返回值: 成功发送的任务数, 队列满时只发送前面的部分任务
+uint32_t msgqueue_pushs( struct msgqueue * self, struct task * tasks, uint32_t count, int32_t flags );
+
+// 生产者丢弃最早的任务(必须是可丢弃的任务), 返回丢弃的任务数(0或者1)
+// 无锁队列只有一个消费者, 不支持丢弃
+int32_t msgqueue_drop( struct msgqueue * self, struct task * task );
+
+// 通知消费者
+void msgqueue_notify( struct msgqueue * self );
 
 // 消费者从消息队列中取一定量的任务
 int32_t msgqueue_pop( struct msgqueue * self, struct task * task );
@@ -20,6 +20,9 @@
 // 尝试重连的间隔时间,默认为200ms
 #define TRY_RECONNECT_INTERVAL 200
 
+// 终止会话时检查零拷贝完成通知的间隔时间,默认为10ms
+#define ZEROCOPY_LINGER_INTERVAL 10
+
 // UDP发送接收缓冲区设置
 #define SEND_BUFFER_SIZE 4194304 // 4M
 #define RECV_BUFFER_SIZE 4194304 // 4M
@@ -43,6 +46,13 @@ enum {
     eIOTaskType_Broadcast2 = 9,
     eIOTaskType_Invoke = 10,
     eIOTaskType_Perform = 11,
+    eIOTaskType_Migrate = 12,   // 迁出会话
+    eIOTaskType_Adopt = 13,     // 迁入会话
+    eIOTaskType_Unforward = 14, // 删除会话的转发
+    eIOTaskType_Retire = 15,    // 退役网络线程
+    eIOTaskType_Join = 16,      // 加入广播组
+    eIOTaskType_Leave = 17,     // 离开广播组
+    eIOTaskType_Publish = 18,   // 广播组广播
 };
 
 // 网络服务错误码定义
@@ -63,14 +73,33 @@ enum {
     eIOError_SendQueueLimit = 0x0001000E,  // 发送队列过大
 };
 
+// 监听记录, 增加网络线程时重新监听
+struct listener {
+    uint8_t type;
+    uint16_t port;
+    char * host;
+    int32_t hasoptions;
+    options_t options;
+    acceptor_t cb;
+    void * context;
+    struct listener * next;
+};
+
 // 网络层
 struct iolayer {
     // 网络层状态
     uint8_t status;
     // 基础配置
-    uint8_t nthreads;
+    _Atomic uint8_t nthreads;    // 运行期间可以增加, 其他线程acquire读取
     uint32_t nclients;
+    struct listener * listeners;
     _Atomic uint32_t roundrobin; // 轮询负载均衡
+    uint8_t edgetrigger;         // 会话的边缘触发模式
+    int32_t busypoll;            // 忙轮询的时间(微秒)
+    uint8_t incomingcpu;         // 监听套接字和网络线程绑定相同的CPU
+    int32_t placement;           // 会话的分配策略
+    placer_t placer;             // 自定义的分配方法
+    void * placercontext;
 
     // 网络线程组
     iothreads_t threads;
@@ -189,8 +218,10 @@ struct task_assign {
     uint8_t type;
     uint16_t port;
     char * host;
-    struct acceptor * acceptor;
+    struct acceptor * acceptor; // 只有KCP会话使用, TCP的接收器退役时会被回收
     struct transfer * transfer;
+    acceptor_t cb;
+    void * context;
 };
 
 struct task_send {
@@ -203,6 +234,7 @@ struct task_send {
 struct task_invoke {
     void * task;
     taskexecutor_t perform;
+    sid_t id; // 绑定的会话ID, 0-不绑定会话
 };
 
 struct task_perform {
@@ -213,9 +245,29 @@ struct task_perform {
     taskrecycler_t recycle;
 };
 
+struct task_migrate {
+    sid_t id;
+    uint8_t index;
+};
+
+struct task_group {
+    sid_t id;
+    uint64_t group;
+};
+
+struct task_publish {
+    uint64_t group;
+    struct message * msg;
+};
+
 // 描述符分发策略
 // 分发到IO线程后会分配到唯一的会话ID
 #define DISPATCH_POLICY( layer, seq ) ( ( seq ) % ( ( layer )->nthreads ) )
+// 是否按照负载分配
+#define DISPATCH_BYLOAD( layer ) \
+    ( ( layer )->placer != NULL || ( layer )->placement != IOLAYER_PLACEMENT_MODULO )
+// 按照分配策略选择网络线程(跳过退役的网络线程)
+uint8_t iolayer_dispatch( struct iolayer * self, uint32_t seq );
 
 // socket选项
 int32_t iolayer_udp_option( int32_t fd );
@@ -235,6 +287,10 @@ void iolayer_free_associater( struct associater * associater );
 // 处理EMFILE
 void iolayer_accept_fdlimits( struct acceptor * acceptor );
 
+// 会话终止时, 删除迁移留下的转发
+struct sidlist;
+void iolayer_unforward_session( struct iolayer * self, uint8_t index, struct sidlist * aliases );
+
 // 给当前线程分发一个会话
 int32_t iolayer_assign_session( struct iolayer * self, uint8_t acceptidx, uint8_t index, struct task_assign * task );
 
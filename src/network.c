@@ -20,6 +20,12 @@
 #include "threads-internal.h"
 #include "network-internal.h"
 
+// 一个网络线程中的一次广播
+struct broadcaster {
+    struct message * msg;
+    struct transformcache cache; // 相同改造类型的会话共享改造结果
+};
+
 // -----------------------------------------------------------------------------
 // -----------------------------------------------------------------------------
 // -----------------------------------------------------------------------------
@@ -27,6 +33,7 @@
 static inline struct session * _get_session_local( iolayer_t self, sid_t id );
 static inline void _udpentry_helper( int method, struct endpoint * endpoint );
 static inline int32_t _send_buffer( struct iolayer * self, sid_t id, const char * buf, size_t nbytes, int32_t isfree );
+static inline int32_t _post_group( struct iolayer * self, int16_t type, uint64_t group, sid_t id );
 static inline int32_t _broadcast2_loop( void * context, struct session * s );
 static inline void _free_task_assign( struct task_assign * task );
 static inline void _free_transfer( struct transfer * transfer );
@@ -42,14 +49,28 @@ static int32_t _associate_direct( evsets_t sets, struct associater * associater
 static int32_t _assign_direct( struct iolayer * self, uint8_t index, evsets_t sets, struct task_assign * task );
 
 static ssize_t _send_direct( struct iolayer * self, struct session_manager * manager, struct task_send * task );
-static int32_t _broadcast_direct( struct iolayer * self, uint8_t index, struct session_manager * manager, struct message * msg );
+static int32_t _broadcast_direct( struct iolayer * self, struct session_manager * manager, struct message * msg );
+static void _forward_broadcast( struct iolayer * self, struct session_manager * manager, struct message * msg );
 static int32_t _broadcast2_direct( struct iolayer * self, struct session_manager * manager, struct message * msg );
+static int32_t _group_direct( struct iolayer * self, struct session_manager * manager, int16_t type, struct task_group * task );
+static int32_t _publish_direct( struct iolayer * self, struct session_manager * manager, struct task_publish * task );
 static void _invoke_direct( struct iolayer * self, uint8_t index, struct task_invoke * task );
 static int32_t _perform_direct( struct iolayer * self, struct session_manager * manager, struct task_perform * task );
-static int32_t _shutdown_direct( struct session_manager * manager, sid_t id );
-static int32_t _shutdowns_direct( uint8_t index, struct session_manager * manager, struct sidlist * ids );
+static int32_t _shutdown_direct( struct iolayer * self, struct session_manager * manager, sid_t id );
+static int32_t _shutdowns_direct( struct iolayer * self, struct session_manager * manager, struct sidlist * ids );
+static int32_t _migrate_direct( struct iolayer * self, uint8_t index, struct task_migrate * task );
+static void _adopt_direct( struct iolayer * self, uint8_t index, struct session * session );
+static void _unforward_direct( struct session_manager * manager, struct sidlist * ids );
+static void _retire_direct( struct iolayer * self, uint8_t index );
+static inline int32_t _migratable( struct session * session );
+static inline uint8_t _active_thread( struct iolayer * self, uint8_t index );
+static inline int32_t _retire_loop( void * context, struct session * s );
+static inline void _drain_acceptor( struct iolayer * self, struct acceptor * acceptor );
+static inline int32_t _forward_task( struct iolayer * self, struct session_manager * manager, sid_t id, int16_t type, void * task, int32_t size );
+static inline void * _partition_sids( uint8_t nthreads, const void * items, size_t size, uint32_t count, uint32_t * offsets );
 
 static void _concrete_processor( void * context, uint8_t index, int16_t type, void * task );
+static void _concrete_dropper( void * context, uint8_t index, int16_t type, void * task );
 
 // -----------------------------------------------------------------------------
 // -----------------------------------------------------------------------------
@@ -58,7 +79,17 @@ static void _concrete_processor( void * context, uint8_t index, int16_t type, vo
 // 创建网络通信层
 iolayer_t iolayer_create( uint8_t nthreads, uint32_t nclients, int32_t precision )
 {
-    uint32_t sessions_per_thread = nclients / nthreads;
+    return iolayer_create2( nthreads, nclients, precision, NULL );
+}
+
+iolayer_t iolayer_create2( uint8_t nthreads, uint32_t nclients, int32_t precision, const ioconfig_t * config )
+{
+    int32_t evflags = 0;
+    const int32_t * cpus = NULL;
+    // 没有网络线程时, 嵌入调用者的线程中运行
+    uint8_t embedded = nthreads == 0 ? 1 : 0;
+    uint8_t maxthreads = nthreads;
+    uint32_t sessions_per_thread = embedded ? nclients : nclients / nthreads;
 
     struct iolayer * self = (struct iolayer *)malloc( sizeof( struct iolayer ) );
     if ( self == NULL ) {
@@ -67,23 +98,63 @@ iolayer_t iolayer_create( uint8_t nthreads, uint32_t nclients, int32_t precision
 
     self->context = NULL;
     self->transform = NULL;
-    self->nthreads = nthreads;
+    atomic_init( &self->nthreads, embedded ? 1 : nthreads );
     self->nclients = nclients;
+    self->listeners = NULL;
     self->status = eIOStatus_Running;
     self->threads = NULL;
+    self->edgetrigger = 0;
+    self->busypoll = 0;
+    self->incomingcpu = 0;
+    self->placement = IOLAYER_PLACEMENT_MODULO;
+    self->placer = NULL;
+    self->placercontext = NULL;
     atomic_init( &self->roundrobin, 0 );
 
+    if ( config != NULL ) {
+        if ( config->iouring ) {
+            evflags |= EVSETS_IOURING;
+        }
+        if ( config->highres ) {
+            evflags |= EVSETS_HIGHRES;
+        }
+        self->edgetrigger = config->edgetrigger != 0 ? 1 : 0;
+        self->busypoll = config->busypoll > 0 ? config->busypoll : 0;
+        self->incomingcpu = config->incomingcpu != 0 && config->cpus != NULL ? 1 : 0;
+        self->placement = config->placement;
+        maxthreads = MAX( nthreads, config->maxthreads );
+        cpus = config->cpus;
+    }
+
     // 创建网络线程组
-    self->threads = iothreads_start( self->nthreads, sessions_per_thread, precision );
+    if ( embedded ) {
+        self->threads = iothreads_embed( sessions_per_thread, precision, evflags );
+    } else {
+        self->threads = iothreads_start4( self->nthreads, maxthreads, sessions_per_thread, precision, evflags, cpus );
+    }
     if ( self->threads == NULL ) {
         iolayer_destroy( self );
         return NULL;
     }
     iothreads_set_processor( self->threads, _concrete_processor, self );
+    iothreads_set_dropper( self->threads, _concrete_dropper );
+    iothreads_set_busypoll( self->threads, self->busypoll );
+    if ( config != NULL && config->queuelimit > 0 ) {
+        iothreads_set_queuelimit( self->threads,
+            config->queuelimit, config->queuepolicy, config->queuetimeout );
+    }
 
     return self;
 }
 
+int32_t iolayer_poll( iolayer_t self, int32_t timeout )
+{
+    struct iolayer * layer = (struct iolayer *)self;
+
+    assert( layer != NULL && "Illegal IOLayer" );
+    return iothreads_poll( layer->threads, timeout );
+}
+
 // 停止网络服务
 void iolayer_stop( iolayer_t self )
 {
@@ -104,6 +175,13 @@ void iolayer_destroy( iolayer_t self )
         layer->threads = NULL;
     }
 
+    while ( layer->listeners != NULL ) {
+        struct listener * next = layer->listeners->next;
+        free( layer->listeners->host );
+        free( layer->listeners );
+        layer->listeners = next;
+    }
+
     free( layer );
 }
 
@@ -129,17 +207,37 @@ int32_t iolayer_listen( iolayer_t self, uint8_t type, const char * host, uint16_
         "%s(host:'%s', port:%d) use SO_REUSEPORT .",
         __FUNCTION__, host == NULL ? "" : host, port );
     for ( uint8_t i = 0; i < layer->nthreads; ++i ) {
+        if ( iothread_is_retired( iothreads_get( layer->threads, i ) ) ) {
+            continue;
+        }
         int32_t rc = _server_listen( layer, type, i, host, port, options, callback, context );
         if ( rc < 0 ) {
             return rc;
         }
     }
+
+    // 记录监听的参数, 增加网络线程时重新监听
+    struct listener * listener = (struct listener *)calloc( 1, sizeof( struct listener ) );
+    if ( listener != NULL ) {
+        listener->type = type;
+        listener->port = port;
+        listener->host = host != NULL ? strdup( host ) : NULL;
+        listener->hasoptions = options != NULL;
+        if ( options != NULL ) {
+            listener->options = *options;
+        }
+        listener->cb = callback;
+        listener->context = context;
+        listener->next = layer->listeners;
+        layer->listeners = listener;
+    }
     return 0;
 #else
     // normal
     uint32_t current = atomic_fetch_add_explicit(
         &layer->roundrobin, 1, memory_order_relaxed );
-    return _server_listen( layer, type, DISPATCH_POLICY( layer, current ), host, port, options, callback, context );
+    return _server_listen( layer, type,
+        _active_thread( layer, DISPATCH_POLICY( layer, current ) ), host, port, options, callback, context );
 #endif
 
     return -1;
@@ -185,15 +283,15 @@ int32_t iolayer_connect( iolayer_t self, const char * host, uint16_t port, conne
     connector->state = 0;
 
     // 就地投递给本网络线程
-    int8_t index = iothreads_get_index( layer->threads );
-    if ( index >= 0 ) {
+    int32_t index = iothreads_current( layer->threads );
+    if ( index >= 0 && !iothread_is_retired( iothreads_get( layer->threads, index ) ) ) {
         connector->index = index;
         _connect_direct( iothreads_get_sets( layer->threads, index ), connector );
     } else {
         uint32_t current = atomic_fetch_add_explicit(
             &layer->roundrobin, 1, memory_order_relaxed );
-        connector->index = DISPATCH_POLICY( layer, current );
-        iothreads_post( layer->threads, connector->index, eIOTaskType_Connect, connector, 0 );
+        connector->index = iolayer_dispatch( layer, current );
+        iothreads_post2( layer->threads, connector->index, eIOTaskType_Connect, connector, 0, IOTHREADS_POST_NOLIMIT );
     }
 
     return 0;
@@ -236,19 +334,57 @@ int32_t iolayer_associate( iolayer_t self, int32_t fd, void * privdata, reattach
     associater->state = 0;
 
     // 就地投递给本网络线程
-    int8_t index = iothreads_get_index( layer->threads );
-    if ( index >= 0 ) {
+    int32_t index = iothreads_current( layer->threads );
+    if ( index >= 0 && !iothread_is_retired( iothreads_get( layer->threads, index ) ) ) {
         associater->index = index;
         _associate_direct( iothreads_get_sets( layer->threads, index ), associater );
     } else {
         // 随机找一个io线程
         uint32_t current = atomic_fetch_add_explicit(
             &layer->roundrobin, 1, memory_order_relaxed );
-        associater->index = DISPATCH_POLICY( layer, current );
+        associater->index = iolayer_dispatch( layer, current );
         // 提交到网络层
-        iothreads_post( layer->threads, associater->index, eIOTaskType_Associate, associater, 0 );
+        iothreads_post2( layer->threads, associater->index, eIOTaskType_Associate, associater, 0, IOTHREADS_POST_NOLIMIT );
+    }
+
+    return 0;
+}
+
+int32_t iolayer_set_placement( iolayer_t self, int32_t policy )
+{
+    struct iolayer * layer = (struct iolayer *)self;
+
+    if ( policy < IOLAYER_PLACEMENT_MODULO
+        || policy > IOLAYER_PLACEMENT_LEASTQUEUE ) {
+        return -1;
     }
 
+    layer->placement = policy;
+    return 0;
+}
+
+int32_t iolayer_set_placer( iolayer_t self, placer_t placer, void * context )
+{
+    struct iolayer * layer = (struct iolayer *)self;
+
+    layer->placer = placer;
+    layer->placercontext = context;
+    return 0;
+}
+
+int32_t iolayer_get_load( iolayer_t self, uint8_t index, ioload_t * load )
+{
+    struct iolayer * layer = (struct iolayer *)self;
+
+    if ( unlikely( index >= layer->nthreads ) ) {
+        return -1;
+    }
+
+    struct iothread * thread = iothreads_get( layer->threads, index );
+    load->nsessions = atomic_load_explicit( &thread->nsessions, memory_order_relaxed );
+    load->cpuload = iothread_get_cpuload( thread );
+    load->queuesize = msgqueue_count( thread->queue );
+
     return 0;
 }
 
@@ -309,7 +445,10 @@ int32_t iolayer_set_persist( iolayer_t self, sid_t id, int32_t onoff )
     struct session * session = _get_session_local( self, id );
 
     if ( likely( session != NULL ) ) {
-        session->setting.persist_mode = onoff == 0 ? 0 : EV_PERSIST;
+        // 边缘触发模式下读事件必须常驻事件集
+        if ( session->setting.edge_trigger == 0 ) {
+            session->setting.persist_mode = onoff == 0 ? 0 : EV_PERSIST;
+        }
     } else {
         rc = -1;
         syslog( LOG_WARNING, "%s(SID=%ld) failed, the Session is invalid .", __FUNCTION__, id );
@@ -334,6 +473,41 @@ int32_t iolayer_set_sndqlimit( iolayer_t self, sid_t id, int32_t queuelimit )
     return rc;
 }
 
+int32_t iolayer_set_transformkey( iolayer_t self, sid_t id, uint64_t key )
+{
+    // NOT Thread-Safe
+    int32_t rc = 0;
+    struct session * session = _get_session_local( self, id );
+
+    if ( likely( session != NULL ) ) {
+        session->setting.transformkey = key;
+    } else {
+        rc = -1;
+        syslog( LOG_WARNING, "%s(SID=%ld) failed, the Session is invalid .", __FUNCTION__, id );
+    }
+
+    return rc;
+}
+
+int32_t iolayer_set_zerocopy( iolayer_t self, sid_t id, size_t threshold )
+{
+    // NOT Thread-Safe
+    int32_t rc = 0;
+    struct session * session = _get_session_local( self, id );
+
+    if ( likely( session != NULL ) ) {
+        rc = session_set_zerocopy( session, threshold );
+        if ( rc != 0 ) {
+            syslog( LOG_WARNING, "%s(SID=%ld) failed, the Session doesn't support MSG_ZEROCOPY .", __FUNCTION__, id );
+        }
+    } else {
+        rc = -1;
+        syslog( LOG_WARNING, "%s(SID=%ld) failed, the Session is invalid .", __FUNCTION__, id );
+    }
+
+    return rc;
+}
+
 int32_t iolayer_set_mtu( iolayer_t self, sid_t id, int32_t mtu )
 {
     // NOT Thread-Safe
@@ -433,64 +607,230 @@ int32_t iolayer_send( iolayer_t self, sid_t id, const char * buf, size_t nbytes,
     return _send_buffer( (struct iolayer *)self, id, buf, nbytes, isfree );
 }
 
+int32_t iolayer_sendmany( iolayer_t self, const iomessage_t * messages, uint32_t count, int32_t isfree )
+{
+    int32_t nsent = 0;
+    struct iolayer * layer = (struct iolayer *)self;
+    int32_t current = iothreads_current( layer->threads );
+
+    if ( unlikely( messages == NULL || count == 0 ) ) {
+        return 0;
+    }
+
+    uint32_t ntasks = 0;
+    uint32_t offsets[256 + 1];
+    uint8_t nthreads = layer->nthreads;
+    struct task_send * tasks = (struct task_send *)malloc( count * sizeof( struct task_send ) );
+    assert( tasks != NULL && "allocate tasks failed" );
+
+    for ( uint32_t i = 0; i < count; ++i ) {
+        uint8_t index = SID_INDEX( messages[i].id );
+
+        if ( unlikely( index >= nthreads ) ) {
+            syslog( LOG_WARNING, "%s(SID=%ld) failed, the Session's index[%u] is invalid .", __FUNCTION__, messages[i].id, index );
+            if ( isfree != 0 ) free( (void *)messages[i].buf );
+            continue;
+        }
+
+        struct task_send * task = &( tasks[ntasks++] );
+        task->id = messages[i].id;
+        task->buf = (char *)messages[i].buf;
+        task->nbytes = messages[i].nbytes;
+        task->isfree = isfree;
+    }
+
+    if ( unlikely( ntasks == 0 ) ) {
+        free( tasks );
+        return 0;
+    }
+
+    // 按照网络线程分组
+    struct task_send * sorted = (struct task_send *)_partition_sids(
+        nthreads, tasks, sizeof( struct task_send ), ntasks, offsets );
+    free( tasks );
+    tasks = sorted;
+
+    for ( uint8_t i = 0; i < nthreads; ++i ) {
+        uint32_t start = offsets[i], end = offsets[i + 1];
+        struct iothread * thread = iothreads_get( layer->threads, i );
+
+        if ( start == end ) {
+            continue;
+        }
+
+        if ( i == current ) {
+            // 本线程内直接发送
+            for ( uint32_t j = start; j < end; ++j ) {
+                nsent += _send_direct( layer, thread->manager, &tasks[j] ) > 0 ? 1 : 0;
+            }
+            continue;
+        }
+
+        // 跨线程提交发送任务
+        if ( isfree == 0 ) {
+            for ( uint32_t j = start; j < end; ++j ) {
+                char * buf = (char *)malloc( tasks[j].nbytes );
+                assert( buf != NULL && "allocate task.buf failed" );
+                memcpy( buf, tasks[j].buf, tasks[j].nbytes );
+                tasks[j].buf = buf;
+                tasks[j].isfree = 1;
+            }
+        }
+
+        int32_t result = iothreads_post_batch( layer->threads, i,
+            eIOTaskType_Send, &tasks[start], end - start, sizeof( struct task_send ), IOTHREADS_POST_DROPPABLE );
+        result = result > 0 ? result : 0;
+        nsent += result;
+
+        // 队列满了, 释放未提交的缓冲区
+        for ( uint32_t j = start + result; j < end; ++j ) {
+            free( tasks[j].buf );
+        }
+    }
+
+    free( tasks );
+    return nsent;
+}
+
 int32_t iolayer_broadcast( iolayer_t self, sid_t * ids, uint32_t count, const char * buf, size_t nbytes )
 {
     if ( unlikely( ids == NULL || count == 0 ) ) {
         return 0;
     }
 
-    pthread_t threadid = pthread_self();
+    int32_t rc = 0;
     struct iolayer * layer = (struct iolayer *)self;
+    int32_t current = iothreads_current( layer->threads );
 
-    for ( uint8_t i = 0; i < layer->nthreads; ++i ) {
+    // 按照网络线程分组, 每个网络线程只接收自己的会话ID
+    uint32_t offsets[256 + 1];
+    uint8_t nthreads = layer->nthreads;
+    sid_t * sids = (sid_t *)_partition_sids( nthreads, ids, sizeof( sid_t ), count, offsets );
+
+    // 所有网络线程共享同一份数据
+    struct payload * payload = payload_create( buf, nbytes );
+    assert( payload != NULL && "payload_create() failed" );
+
+    for ( uint8_t i = 0; i < nthreads; ++i ) {
+        uint32_t start = offsets[i], end = offsets[i + 1];
         struct iothread * thread = iothreads_get( layer->threads, i );
 
+        if ( start == end ) {
+            continue;
+        }
+
         struct message * msg = message_create();
         assert( msg != NULL && "message_create() failed" );
 
-        message_add_buffer( msg, buf, nbytes );
-        message_add_receivers( msg, ids, count );
+        message_set_payload( msg, payload );
+        message_add_receivers( msg, sids + start, end - start );
 
-        if ( threadid == thread->id ) {
+        if ( i == current ) {
             // 本线程内直接广播
-            _broadcast_direct( layer, i, thread->manager, msg );
+            _broadcast_direct( layer, thread->manager, msg );
         } else {
             // 跨线程提交广播任务
-            int32_t result = iothreads_post( layer->threads, i, eIOTaskType_Broadcast, msg, 0 );
+            int32_t result = iothreads_post2( layer->threads, i, eIOTaskType_Broadcast, msg, 0, IOTHREADS_POST_DROPPABLE );
             if ( unlikely( result != 0 ) ) {
+                rc = result;
                 message_destroy( msg ); continue;
             }
         }
     }
 
-    return 0;
+    payload_release( payload );
+    free( sids );
+    return rc;
 }
 
 int32_t iolayer_broadcast2( iolayer_t self, const char * buf, size_t nbytes )
 {
-    pthread_t threadid = pthread_self();
+    int32_t rc = 0;
     struct iolayer * layer = (struct iolayer *)self;
+    int32_t current = iothreads_current( layer->threads );
+    uint8_t nthreads = atomic_load_explicit( &layer->nthreads, memory_order_acquire );
 
-    for ( uint8_t i = 0; i < layer->nthreads; ++i ) {
+    // 所有网络线程共享同一份数据
+    struct payload * payload = payload_create( buf, nbytes );
+    assert( payload != NULL && "payload_create() failed" );
+
+    for ( uint8_t i = 0; i < nthreads; ++i ) {
         struct iothread * thread = iothreads_get( layer->threads, i );
 
         struct message * msg = message_create();
         assert( msg != NULL && "message_create() failed" );
-        message_add_buffer( msg, buf, nbytes );
+        message_set_payload( msg, payload );
 
-        if ( threadid == thread->id ) {
+        if ( i == current ) {
             // 本线程内直接广播
             _broadcast2_direct( layer, thread->manager, msg );
         } else {
             // 跨线程提交广播任务
-            int32_t result = iothreads_post( layer->threads, i, eIOTaskType_Broadcast2, msg, 0 );
+            int32_t result = iothreads_post2( layer->threads, i, eIOTaskType_Broadcast2, msg, 0, IOTHREADS_POST_DROPPABLE );
             if ( unlikely( result != 0 ) ) {
+                rc = result;
                 message_destroy( msg ); continue;
             }
         }
     }
 
-    return 0;
+    payload_release( payload );
+    return rc;
+}
+
+int32_t iolayer_join_group( iolayer_t self, uint64_t group, sid_t id )
+{
+    return _post_group( (struct iolayer *)self, eIOTaskType_Join, group, id );
+}
+
+int32_t iolayer_leave_group( iolayer_t self, uint64_t group, sid_t id )
+{
+    return _post_group( (struct iolayer *)self, eIOTaskType_Leave, group, id );
+}
+
+int32_t iolayer_broadcast_group( iolayer_t self, uint64_t group, const char * buf, size_t nbytes )
+{
+    int32_t rc = 0;
+    struct iolayer * layer = (struct iolayer *)self;
+    int32_t current = iothreads_current( layer->threads );
+
+    // 所有网络线程共享同一份数据
+    struct payload * payload = payload_create( buf, nbytes );
+    assert( payload != NULL && "payload_create() failed" );
+
+    for ( uint8_t i = 0; i < layer->nthreads; ++i ) {
+        struct iothread * thread = iothreads_get( layer->threads, i );
+
+        struct task_publish task = { group, message_create() };
+        assert( task.msg != NULL && "message_create() failed" );
+        message_set_payload( task.msg, payload );
+
+        if ( i == current ) {
+            // 本线程内直接广播
+            _publish_direct( layer, thread->manager, &task );
+        } else {
+            // 跨线程提交广播任务
+            int32_t result = iothreads_post2( layer->threads, i, eIOTaskType_Publish, &task, sizeof( task ), IOTHREADS_POST_DROPPABLE );
+            if ( unlikely( result != 0 ) ) {
+                rc = result;
+                message_destroy( task.msg ); continue;
+            }
+        }
+    }
+
+    payload_release( payload );
+    return rc;
+}
+
+uint32_t iolayer_get_queuesize( iolayer_t self, uint8_t index )
+{
+    struct iolayer * layer = (struct iolayer *)self;
+
+    if ( unlikely( index >= layer->nthreads ) ) {
+        return 0;
+    }
+
+    return iothreads_get_queuesize( layer->threads, index );
 }
 
 int32_t iolayer_invoke( iolayer_t self, void * task, taskcloner_t clone, taskexecutor_t execute )
@@ -499,33 +839,27 @@ int32_t iolayer_invoke( iolayer_t self, void * task, taskcloner_t clone, taskexe
     assert( execute != NULL && "Illegal specified Execute-Function" );
 
     struct task_invoke tasklist[256]; // 栈中分配更快
-    pthread_t threadid = pthread_self();
     struct iolayer * layer = (struct iolayer *)self;
+    int32_t current = iothreads_current( layer->threads );
 
     if ( clone == NULL ) {
-        uint8_t index = milliseconds() % layer->nthreads;
-        struct task_invoke inner_task = { task, execute };
-
-        if ( threadid == iothreads_get_id( layer->threads, index ) ) {
-            // 本线程内直接执行
-            _invoke_direct( layer, index, &inner_task );
-        } else {
-            // 跨线程提交执行任务
-            iothreads_post( layer->threads, index, eIOTaskType_Invoke, &inner_task, sizeof( struct task_invoke ) );
-        }
+        struct task_invoke inner_task = { task, execute, 0 };
+        // 提交到可窃取的任务队列
+        return iothreads_submit( layer->threads, eIOTaskType_Invoke, &inner_task, sizeof( struct task_invoke ) );
     } else {
         for ( uint8_t i = 0; i < layer->nthreads; ++i ) {
+            tasklist[i].id = 0;
             tasklist[i].perform = execute;
             tasklist[i].task = i == 0 ? task : clone( task );
         }
 
         for ( uint8_t i = 0; i < layer->nthreads; ++i ) {
-            if ( threadid == iothreads_get_id( layer->threads, i ) ) {
+            if ( i == current ) {
                 // 本线程内直接广播
                 _invoke_direct( layer, i, &( tasklist[i] ) );
             } else {
                 // 跨线程提交广播任务
-                iothreads_post( layer->threads, i, eIOTaskType_Invoke, &( tasklist[i] ), sizeof( struct task_invoke ) );
+                iothreads_post2( layer->threads, i, eIOTaskType_Invoke, &( tasklist[i] ), sizeof( struct task_invoke ), IOTHREADS_POST_NOLIMIT );
             }
         }
     }
@@ -533,6 +867,50 @@ int32_t iolayer_invoke( iolayer_t self, void * task, taskcloner_t clone, taskexe
     return 0;
 }
 
+int32_t iolayer_invoke_thread( iolayer_t self, uint8_t index, void * task, taskexecutor_t execute )
+{
+    struct iolayer * layer = (struct iolayer *)self;
+    struct task_invoke inner_task = { task, execute, 0 };
+
+    assert( execute != NULL && "Illegal specified Execute-Function" );
+
+    if ( unlikely( index >= layer->nthreads ) ) {
+        syslog( LOG_WARNING, "%s(INDEX=%u) failed, the index is invalid .", __FUNCTION__, index );
+        return -1;
+    }
+
+    if ( index == iothreads_current( layer->threads ) ) {
+        // 本线程内直接执行
+        _invoke_direct( layer, index, &inner_task );
+        return 0;
+    }
+
+    // 跨线程提交执行任务
+    return iothreads_post2( layer->threads, index, eIOTaskType_Invoke, &inner_task, sizeof( struct task_invoke ), IOTHREADS_POST_NOLIMIT );
+}
+
+int32_t iolayer_invoke_session( iolayer_t self, sid_t id, void * task, taskexecutor_t execute )
+{
+    uint8_t index = SID_INDEX( id );
+    struct iolayer * layer = (struct iolayer *)self;
+    struct task_invoke inner_task = { task, execute, id };
+
+    assert( execute != NULL && "Illegal specified Execute-Function" );
+
+    if ( unlikely( index >= layer->nthreads ) ) {
+        syslog( LOG_WARNING, "%s(SID=%ld) failed, the Session's index[%u] is invalid .", __FUNCTION__, id, index );
+        return -1;
+    }
+
+    if ( index == iothreads_current( layer->threads ) ) {
+        _invoke_direct( layer, index, &inner_task );
+        return 0;
+    }
+
+    // 跨线程提交执行任务
+    return iothreads_post2( layer->threads, index, eIOTaskType_Invoke, &inner_task, sizeof( struct task_invoke ), IOTHREADS_POST_NOLIMIT );
+}
+
 int32_t iolayer_perform( iolayer_t self, sid_t id, int32_t type, void * task, int32_t interval, taskrecycler_t recycle )
 {
     uint8_t index = SID_INDEX( id );
@@ -543,10 +921,10 @@ int32_t iolayer_perform( iolayer_t self, sid_t id, int32_t type, void * task, in
         return -1;
     }
 
-    struct iothread * thread = iothreads_get( layer->threads, index );
     struct task_perform ptask = { id, type, task, interval, recycle };
 
-    if ( pthread_self() == thread->id ) {
+    if ( index == iothreads_current( layer->threads ) ) {
+        struct iothread * thread = iothreads_get( layer->threads, index );
         return _perform_direct( layer, thread->manager, &ptask );
     }
 
@@ -554,6 +932,95 @@ int32_t iolayer_perform( iolayer_t self, sid_t id, int32_t type, void * task, in
     return iothreads_post( layer->threads, index, eIOTaskType_Perform, (void *)&ptask, sizeof( ptask ) );
 }
 
+int32_t iolayer_migrate( iolayer_t self, sid_t id, uint8_t index )
+{
+    uint8_t from = SID_INDEX( id );
+    struct iolayer * layer = (struct iolayer *)self;
+
+    if ( unlikely( from >= layer->nthreads || index >= layer->nthreads ) ) {
+        syslog( LOG_WARNING, "%s(SID=%ld, INDEX=%u) failed, the Session's index[%u] is invalid .", __FUNCTION__, id, index, from );
+        return -1;
+    }
+
+    // 迁移任务总是提交到会话所在的网络线程中执行,
+    // 避免在回调函数中迁移会话
+    struct task_migrate task = { id, index };
+    return iothreads_post2( layer->threads, from, eIOTaskType_Migrate, (void *)&task, sizeof( task ), IOTHREADS_POST_NOLIMIT );
+}
+
+int32_t iolayer_add_thread( iolayer_t self, int32_t cpu, void * iocontext )
+{
+    int32_t index = -1;
+    struct iolayer * layer = (struct iolayer *)self;
+
+    assert( layer != NULL && "Illegal IOLayer" );
+
+    // 优先恢复退役的网络线程
+    for ( uint8_t i = 0; i < layer->nthreads; ++i ) {
+        if ( iothread_is_retired( iothreads_get( layer->threads, i ) ) ) {
+            index = i;
+            break;
+        }
+    }
+
+    int32_t revived = index >= 0;
+    if ( !revived ) {
+        index = iothreads_grow( layer->threads, cpu, layer->nclients / layer->nthreads );
+        if ( index < 0 ) {
+            syslog( LOG_WARNING, "%s(CPU%d) failed, can't start the IOThread .", __FUNCTION__, cpu );
+            return -1;
+        }
+        atomic_store_explicit( &layer->nthreads, index + 1, memory_order_release );
+    }
+    iothreads_set_context( layer->threads, index, iocontext );
+
+#ifdef EVENT_HAVE_REUSEPORT
+    // 重新监听所有的端口, 退役时保留了KCP的监听
+    for ( struct listener * l = layer->listeners; l != NULL; l = l->next ) {
+        if ( revived && l->type != NETWORK_TCP ) {
+            continue;
+        }
+        _server_listen( layer, l->type, index,
+            l->host, l->port, l->hasoptions ? &l->options : NULL, l->cb, l->context );
+    }
+#endif
+
+    // 参与会话的分配
+    atomic_store_explicit( &( iothreads_get( layer->threads, index )->retired ), 0, memory_order_release );
+    return index;
+}
+
+int32_t iolayer_retire_thread( iolayer_t self, uint8_t index )
+{
+    struct iolayer * layer = (struct iolayer *)self;
+
+    assert( layer != NULL && "Illegal IOLayer" );
+
+    if ( unlikely( index >= layer->nthreads ) ) {
+        syslog( LOG_WARNING, "%s(INDEX=%u) failed, the IOThread's index is invalid .", __FUNCTION__, index );
+        return -1;
+    }
+
+    struct iothread * thread = iothreads_get( layer->threads, index );
+    if ( iothread_is_retired( thread ) ) {
+        return -2;
+    }
+
+    // 至少保留一个网络线程
+    uint8_t nactive = 0;
+    for ( uint8_t i = 0; i < layer->nthreads; ++i ) {
+        nactive += iothread_is_retired( iothreads_get( layer->threads, i ) ) ? 0 : 1;
+    }
+    if ( nactive <= 1 ) {
+        syslog( LOG_WARNING, "%s(INDEX=%u) failed, it's the last active IOThread .", __FUNCTION__, index );
+        return -3;
+    }
+
+    // 先停止分配, 再由退役的网络线程迁出会话
+    atomic_store_explicit( &thread->retired, 1, memory_order_release );
+    return iothreads_post2( layer->threads, index, eIOTaskType_Retire, NULL, 0, IOTHREADS_POST_NOLIMIT );
+}
+
 int32_t iolayer_shutdown( iolayer_t self, sid_t id )
 {
     uint8_t index = SID_INDEX( id );
@@ -575,7 +1042,7 @@ int32_t iolayer_shutdown( iolayer_t self, sid_t id )
 #endif
 
     // 跨线程提交终止任务
-    return iothreads_post( layer->threads, index, eIOTaskType_Shutdown, (void *)&id, sizeof( id ) );
+    return iothreads_post2( layer->threads, index, eIOTaskType_Shutdown, (void *)&id, sizeof( id ), IOTHREADS_POST_NOLIMIT );
 }
 
 int32_t iolayer_shutdowns( iolayer_t self, sid_t * ids, uint32_t count )
@@ -586,18 +1053,30 @@ int32_t iolayer_shutdowns( iolayer_t self, sid_t * ids, uint32_t count )
 
     struct iolayer * layer = (struct iolayer *)self;
 
-    for ( uint8_t i = 0; i < layer->nthreads; ++i ) {
-        struct sidlist * list = sidlist_create( count );
+    // 按照网络线程分组, 每个网络线程只接收自己的会话ID
+    uint32_t offsets[256 + 1];
+    uint8_t nthreads = layer->nthreads;
+    sid_t * sids = (sid_t *)_partition_sids( nthreads, ids, sizeof( sid_t ), count, offsets );
+
+    for ( uint8_t i = 0; i < nthreads; ++i ) {
+        uint32_t start = offsets[i], end = offsets[i + 1];
+
+        if ( start == end ) {
+            continue;
+        }
+
+        struct sidlist * list = sidlist_create( end - start );
         assert( list != NULL && "sidlist_create() failed" );
-        sidlist_adds( list, ids, count );
+        sidlist_adds( list, sids + start, end - start );
 
         // 跨线程提交批量终止任务
-        int32_t result = iothreads_post( layer->threads, i, eIOTaskType_Shutdowns, list, 0 );
+        int32_t result = iothreads_post2( layer->threads, i, eIOTaskType_Shutdowns, list, 0, IOTHREADS_POST_NOLIMIT );
         if ( unlikely( result != 0 ) ) {
             sidlist_destroy( list ); continue;
         }
     }
 
+    free( sids );
     return 0;
 }
 
@@ -800,18 +1279,82 @@ void iolayer_accept_fdlimits( struct acceptor * acceptor )
     acceptor->idlefd = open( "/dev/null", O_RDONLY | O_CLOEXEC );
 }
 
-int32_t iolayer_assign_session( struct iolayer * self, uint8_t acceptidx, uint8_t index, struct task_assign * task )
+uint8_t iolayer_dispatch( struct iolayer * self, uint32_t seq )
 {
-#ifdef EVENT_HAVE_REUSEPORT
-    return _assign_direct( self, acceptidx, iothreads_get_sets( self->threads, acceptidx ), task );
-#else
-    if ( acceptidx == index ) {
-        return _assign_direct( self, acceptidx, iothreads_get_sets( self->threads, acceptidx ), task );
+    uint8_t nthreads = atomic_load_explicit( &self->nthreads, memory_order_acquire );
+    uint8_t index = _active_thread( self, seq % nthreads );
+
+    if ( !DISPATCH_BYLOAD( self ) ) {
+        return index;
     }
-    // 跨线程提交发送任务
-    return iothreads_post( self->threads, index, eIOTaskType_Assign, task, sizeof( struct task_assign ) );
-#endif
-}
+
+    ioload_t loads[256];
+    for ( uint8_t i = 0; i < nthreads; ++i ) {
+        iolayer_get_load( self, i, &loads[i] );
+    }
+
+    if ( self->placer != NULL ) {
+        uint8_t placed = self->placer( self->placercontext, loads, nthreads );
+        if ( placed < nthreads
+            && !iothread_is_retired( iothreads_get( self->threads, placed ) ) ) {
+            index = placed;
+        }
+    } else {
+        // 负载相同时从seq开始轮询, 避免集中到第一个网络线程
+        uint8_t start = index;
+        uint64_t minload = UINT64_MAX;
+        for ( uint8_t n = 0; n < nthreads; ++n ) {
+            uint64_t load = 0;
+            uint8_t i = ( start + n ) % nthreads;
+
+            if ( iothread_is_retired( iothreads_get( self->threads, i ) ) ) {
+                continue;
+            }
+
+            switch ( self->placement ) {
+                case IOLAYER_PLACEMENT_LEASTSESSIONS :
+                    load = loads[i].nsessions;
+                    break;
+                case IOLAYER_PLACEMENT_LEASTCPU :
+                    // 占用率相同时比较会话数
+                    load = ( (uint64_t)loads[i].cpuload << 32 ) | loads[i].nsessions;
+                    break;
+                case IOLAYER_PLACEMENT_LEASTQUEUE :
+                    load = loads[i].queuesize;
+                    break;
+            }
+
+            if ( load < minload ) {
+                index = i;
+                minload = load;
+            }
+        }
+    }
+
+    // 预先计入会话数, 避免连续分配到同一个网络线程, 网络线程会定期校正
+    atomic_fetch_add_explicit(
+        &( iothreads_get( self->threads, index )->nsessions ), 1, memory_order_relaxed );
+
+    return index;
+}
+
+int32_t iolayer_assign_session( struct iolayer * self, uint8_t acceptidx, uint8_t index, struct task_assign * task )
+{
+#ifdef EVENT_HAVE_REUSEPORT
+    // 每个网络线程都有监听套接字, 默认由接受连接的网络线程管理会话
+    if ( !DISPATCH_BYLOAD( self ) || acceptidx == index ) {
+        return _assign_direct( self, acceptidx, iothreads_get_sets( self->threads, acceptidx ), task );
+    }
+    // 跨线程提交分配任务
+    return iothreads_post2( self->threads, index, eIOTaskType_Assign, task, sizeof( struct task_assign ), IOTHREADS_POST_NOLIMIT );
+#else
+    if ( acceptidx == index ) {
+        return _assign_direct( self, acceptidx, iothreads_get_sets( self->threads, acceptidx ), task );
+    }
+    // 跨线程提交发送任务
+    return iothreads_post2( self->threads, index, eIOTaskType_Assign, task, sizeof( struct task_assign ), IOTHREADS_POST_NOLIMIT );
+#endif
+}
 
 // -----------------------------------------------------------------------------
 // -----------------------------------------------------------------------------
@@ -833,10 +1376,15 @@ struct session * _get_session_local( iolayer_t self, sid_t id )
         return NULL;
     }
 
-    struct iothread * thread = iothreads_get( layer->threads, index );
+    // 只能在网络线程中调用(ioservice_t的回调), 其他线程访问会话是不安全的
+    int32_t current = iothreads_current( layer->threads );
+    if ( unlikely( current < 0 ) ) {
+        syslog( LOG_WARNING, "%s(SID=%ld) failed, the Caller isn't an IOThread .", __FUNCTION__, id );
+        return NULL;
+    }
 
-    // 检查是否在本线程中
-    assert( pthread_equal( thread->id, pthread_self() ) != 0 );
+    // 迁移过的会话, 使用旧的会话ID访问, 在当前线程中查找
+    struct iothread * thread = iothreads_get( layer->threads, current );
 
     return session_manager_get( thread->manager, id );
 }
@@ -890,6 +1438,16 @@ int32_t _server_listen( struct iolayer * layer, uint8_t type, uint8_t index, con
             iolayer_free_acceptor( acceptor );
             return -3;
         }
+
+#if defined EVENT_HAVE_REUSEPORT && defined SO_INCOMING_CPU
+        // 内核优先把连接分派给和网卡队列的CPU相同的监听套接字
+        if ( layer->incomingcpu ) {
+            int32_t cpu = iothreads_get_cpu( layer->threads, index );
+            if ( cpu >= 0 ) {
+                setsockopt( acceptor->fd, SOL_SOCKET, SO_INCOMING_CPU, (void *)&cpu, sizeof( cpu ) );
+            }
+        }
+#endif
     } else if ( type == NETWORK_KCP ) {
         // 设置KCP默认参数
         if ( options == NULL && type == NETWORK_KCP ) {
@@ -938,8 +1496,14 @@ int32_t _server_listen( struct iolayer * layer, uint8_t type, uint8_t index, con
         }
     }
 
+    // 本线程内直接监听
+    if ( acceptor->index == iothreads_current( layer->threads ) ) {
+        struct iothread * thread = iothreads_get( layer->threads, acceptor->index );
+        return _listen_direct( &thread->acceptorlist, thread->sets, acceptor );
+    }
+
     // 提交
-    iothreads_post( layer->threads, acceptor->index, eIOTaskType_Listen, acceptor, 0 );
+    iothreads_post2( layer->threads, acceptor->index, eIOTaskType_Listen, acceptor, 0, IOTHREADS_POST_NOLIMIT );
     return 0;
 }
 
@@ -955,9 +1519,9 @@ int32_t _send_buffer( struct iolayer * self, sid_t id, const char * buf, size_t
     }
 
     struct task_send task = { id, (char *)buf, nbytes, isfree };
-    struct iothread * thread = iothreads_get( self->threads, index );
 
-    if ( pthread_self() == thread->id ) {
+    if ( index == iothreads_current( self->threads ) ) {
+        struct iothread * thread = iothreads_get( self->threads, index );
         return _send_direct( self, thread->manager, &task ) > 0 ? 0 : -3;
     }
 
@@ -970,7 +1534,7 @@ int32_t _send_buffer( struct iolayer * self, sid_t id, const char * buf, size_t
         memcpy( task.buf, buf, nbytes );
     }
 
-    result = iothreads_post( self->threads, index, eIOTaskType_Send, (void *)&task, sizeof( task ) );
+    result = iothreads_post2( self->threads, index, eIOTaskType_Send, (void *)&task, sizeof( task ), IOTHREADS_POST_DROPPABLE );
     if ( unlikely( result != 0 ) ) {
         free( task.buf );
     }
@@ -978,15 +1542,35 @@ int32_t _send_buffer( struct iolayer * self, sid_t id, const char * buf, size_t
     return result;
 }
 
+int32_t _post_group( struct iolayer * self, int16_t type, uint64_t group, sid_t id )
+{
+    uint8_t index = SID_INDEX( id );
+
+    if ( unlikely( index >= self->nthreads ) ) {
+        syslog( LOG_WARNING, "%s(SID=%ld) failed, the Session's index[%u] is invalid .", __FUNCTION__, id, index );
+        return -1;
+    }
+
+    struct task_group task = { id, group };
+
+    if ( index == iothreads_current( self->threads ) ) {
+        struct iothread * thread = iothreads_get( self->threads, index );
+        return _group_direct( self, thread->manager, type, &task );
+    }
+
+    // 广播组的成员关系不能丢弃
+    return iothreads_post2( self->threads, index, type, (void *)&task, sizeof( task ), IOTHREADS_POST_NOLIMIT );
+}
+
 int32_t _broadcast2_loop( void * context, struct session * s )
 {
-    struct message * msg = (struct message *)context;
+    struct broadcaster * b = (struct broadcaster *)context;
 
-    // 添加接收者
-    message_add_receiver( msg, s->id );
+    // 接收者计数
+    message_count_receiver( b->msg );
 
     // 尝试发送消息
-    session_sendmessage( s, msg );
+    session_sendmessage2( s, b->msg, &( b->cache ) );
 
     return 0;
 }
@@ -1063,6 +1647,24 @@ struct transfer * _get_transfer( struct acceptor * acceptor, int32_t fd )
 
 int32_t _listen_direct( struct acceptorlist * acceptlist, evsets_t sets, struct acceptor * acceptor )
 {
+#ifdef EVENT_HAVE_REUSEPORT
+    if ( acceptor->type == NETWORK_TCP ) {
+        // 退役任务执行之前又被恢复, 旧的监听套接字还在, 不再重复监听,
+        // 新的监听套接字已经加入了REUSEPORT组, 关闭之前分配掉接收队列中的连接
+        struct acceptor * a = STAILQ_FIRST( acceptlist );
+        for ( ; a != NULL; a = STAILQ_NEXT( a, linker ) ) {
+            if ( a->type == NETWORK_TCP && a->fd > 0
+                && a->port == acceptor->port && a->cb == acceptor->cb && a->context == acceptor->context
+                && ( a->host == acceptor->host
+                    || ( a->host != NULL && acceptor->host != NULL && strcmp( a->host, acceptor->host ) == 0 ) ) ) {
+                _drain_acceptor( acceptor->parent, acceptor );
+                iolayer_free_acceptor( acceptor );
+                return 0;
+            }
+        }
+    }
+#endif
+
     // 开始关注accept事件
     acceptor->evsets = sets;
     STAILQ_INSERT_TAIL( acceptlist, acceptor, linker );
@@ -1113,7 +1715,6 @@ int32_t _associate_direct( evsets_t sets, struct associater * associater )
 int32_t _assign_direct( struct iolayer * layer, uint8_t index, evsets_t sets, struct task_assign * task )
 {
     int32_t rc = 0;
-    struct acceptor * acceptor = task->acceptor;
     struct iothread * thread = iothreads_get( layer->threads, index );
 
     // 会话管理器分配会话
@@ -1126,7 +1727,7 @@ int32_t _assign_direct( struct iolayer * layer, uint8_t index, evsets_t sets, st
     }
 
     // 回调逻辑层, 确定是否接收这个会话
-    rc = acceptor->cb( acceptor->context,
+    rc = task->cb( task->context,
         iothreads_get_context( layer->threads, index ), session->id, task->host, task->port );
     if ( rc != 0 ) {
         // 逻辑层不接受这个会话
@@ -1174,6 +1775,7 @@ int32_t _assign_direct( struct iolayer * layer, uint8_t index, evsets_t sets, st
 
 ssize_t _send_direct( struct iolayer * self, struct session_manager * manager, struct task_send * task )
 {
+    int32_t index = -1;
     ssize_t writen = 0;
     struct session * session = session_manager_get( manager, task->id );
 
@@ -1187,13 +1789,34 @@ ssize_t _send_direct( struct iolayer * self, struct session_manager * manager, s
         }
 
         if ( buffer != NULL ) {
-            writen = session_send( session, buffer, nbytes );
+            // 改造后的数据以及指定底层释放的数据, 由会话接管(零拷贝发送时不需要复制)
+            int32_t isfree = buffer != task->buf || task->isfree != 0;
+            writen = session_send2( session, buffer, nbytes, isfree );
             if ( writen < 0 ) {
                 syslog( LOG_WARNING, "%s(SID=%ld) failed, the Session drop this message(LENGTH=%lu) .\n", __FUNCTION__, task->id, nbytes );
             }
-            // 销毁改造后的数据
-            if ( buffer != task->buf ) free( buffer );
+            if ( buffer == task->buf && isfree ) {
+                return writen;
+            }
+        }
+    } else if ( ( index = session_manager_route( manager, task->id ) ) >= 0 ) {
+        // 会话已经迁出, 转发到会话所在的网络线程
+        struct task_send ftask = *task;
+
+        if ( ftask.isfree == 0 ) {
+            ftask.isfree = 1;
+            ftask.buf = (char *)malloc( task->nbytes );
+            assert( ftask.buf != NULL && "allocate task.buf failed" );
+            memcpy( ftask.buf, task->buf, task->nbytes );
         }
+
+        if ( iothreads_post2( self->threads, index,
+                 eIOTaskType_Send, (void *)&ftask, sizeof( ftask ), IOTHREADS_POST_NOLIMIT ) != 0 ) {
+            free( ftask.buf );
+            return -1;
+        }
+
+        return task->nbytes;
     } else {
         syslog( LOG_WARNING, "%s(SID=%ld) failed, the Session is invalid .", __FUNCTION__, task->id );
     }
@@ -1204,9 +1827,15 @@ ssize_t _send_direct( struct iolayer * self, struct session_manager * manager, s
     return writen;
 }
 
-int32_t _broadcast_direct( struct iolayer * self, uint8_t index, struct session_manager * manager, struct message * msg )
+int32_t _broadcast_direct( struct iolayer * self, struct session_manager * manager, struct message * msg )
 {
     int32_t count = 0;
+
+    // 迁出的会话, 在数据改造前转发到会话所在的网络线程
+    if ( unlikely( manager->nforwards > 0 ) ) {
+        _forward_broadcast( self, manager, msg );
+    }
+
     uint32_t totalcount = sidlist_count( msg->tolist );
 
     // 数据改造
@@ -1225,25 +1854,69 @@ int32_t _broadcast_direct( struct iolayer * self, uint8_t index, struct session_
         }
     }
 
+    struct transformcache cache;
+    transformcache_init( &cache );
+
     for ( uint32_t i = 0; i < totalcount; ++i ) {
         sid_t id = sidlist_get( msg->tolist, i );
-        if ( SID_INDEX( id ) == index ) {
-            struct session * s = session_manager_get( manager, id );
-            if ( likely( s != NULL ) ) {
-                if ( session_sendmessage( s, msg ) >= 0 ) {
-                    ++count; continue;
-                }
+        // 迁入的会话使用旧的会话ID
+        struct session * s = session_manager_get( manager, id );
+        if ( likely( s != NULL ) ) {
+            if ( session_sendmessage2( s, msg, &cache ) >= 0 ) {
+                ++count;
             }
+            continue;
         }
         message_add_failure( msg, id );
     }
 
+    transformcache_clear( &cache );
+
     // 消息发送完毕, 直接销毁
     if ( message_is_complete( msg ) ) message_destroy( msg );
 
     return count;
 }
 
+void _forward_broadcast( struct iolayer * self, struct session_manager * manager, struct message * msg )
+{
+    struct message * forwards[256] = { NULL };
+
+    for ( uint32_t i = 0; i < sidlist_count( msg->tolist ); ) {
+        sid_t id = sidlist_get( msg->tolist, i );
+        int32_t index = session_manager_route( manager, id );
+
+        if ( likely( index < 0 ) ) {
+            ++i; continue;
+        }
+
+        if ( forwards[index] == NULL ) {
+            forwards[index] = message_create();
+            assert( forwards[index] != NULL && "message_create() failed" );
+            if ( msg->payload != NULL ) {
+                message_set_payload( forwards[index], msg->payload );
+            } else {
+                message_add_buffer( forwards[index], message_get_buffer( msg ), message_get_length( msg ) );
+            }
+        }
+
+        // 从本线程的接收者中移除
+        message_add_receiver( forwards[index], id );
+        sidlist_del( msg->tolist, i );
+    }
+
+    for ( uint8_t i = 0; i < self->nthreads; ++i ) {
+        if ( forwards[i] == NULL ) {
+            continue;
+        }
+
+        if ( iothreads_post2( self->threads, i, eIOTaskType_Broadcast, forwards[i], 0, IOTHREADS_POST_NOLIMIT ) != 0 ) {
+            syslog( LOG_WARNING, "%s(COUNT=%u) failed, can't forward to the IOThread[%d] .", __FUNCTION__, sidlist_count( forwards[i]->tolist ), i );
+            message_destroy( forwards[i] );
+        }
+    }
+}
+
 int32_t _broadcast2_direct( struct iolayer * self, struct session_manager * manager, struct message * msg )
 {
     int32_t count = 0;
@@ -1265,12 +1938,74 @@ int32_t _broadcast2_direct( struct iolayer * self, struct session_manager * mana
         }
     }
 
-    // 优化接受者列表初始化
-    message_reserve_receivers(
-        msg, session_manager_count( manager ) );
-
     // 遍历在线会话
-    count = session_manager_foreach( manager, _broadcast2_loop, msg );
+    struct broadcaster b = { .msg = msg };
+    transformcache_init( &b.cache );
+    count = session_manager_foreach( manager, _broadcast2_loop, &b );
+    transformcache_clear( &b.cache );
+
+    // 消息发送完毕, 直接销毁
+    if ( message_is_complete( msg ) ) {
+        message_destroy( msg );
+    }
+
+    return count;
+}
+
+int32_t _group_direct( struct iolayer * self, struct session_manager * manager, int16_t type, struct task_group * task )
+{
+    int32_t rc = -1;
+    struct session * session = session_manager_get( manager, task->id );
+
+    if ( likely( session != NULL ) ) {
+        if ( type == eIOTaskType_Join ) {
+            rc = session_manager_join( manager, task->group, session );
+        } else {
+            rc = session_manager_leave( manager, task->group, session );
+        }
+        if ( rc < 0 ) {
+            syslog( LOG_WARNING, "%s(SID=%ld, GROUP=%lu, TASK:%d) failed .", __FUNCTION__, task->id, task->group, type );
+        }
+    } else if ( !_forward_task( self, manager, task->id, type, task, sizeof( struct task_group ) ) ) {
+        syslog( LOG_WARNING, "%s(SID=%ld, GROUP=%lu) failed, the Session is invalid .", __FUNCTION__, task->id, task->group );
+    }
+
+    return rc;
+}
+
+int32_t _publish_direct( struct iolayer * self, struct session_manager * manager, struct task_publish * task )
+{
+    int32_t count = 0;
+    struct message * msg = task->msg;
+
+    // 本线程中没有组成员
+    if ( session_manager_members( manager, task->group ) == 0 ) {
+        message_destroy( msg );
+        return 0;
+    }
+
+    // 数据改造
+    if ( self->transform != NULL ) {
+        // 数据需要改造
+        size_t nbytes = message_get_length( msg );
+        char * buffer = self->transform( self->context, message_get_buffer( msg ), &nbytes );
+
+        if ( buffer == NULL ) {
+            // 数据改造失败
+            message_destroy( msg );
+            return -1;
+        }
+        if ( buffer != message_get_buffer( msg ) ) {
+            // 数据改造成功
+            message_set_buffer( msg, buffer, nbytes );
+        }
+    }
+
+    // 遍历本线程中的组成员
+    struct broadcaster b = { .msg = msg };
+    transformcache_init( &b.cache );
+    count = session_manager_foreach_group( manager, task->group, _broadcast2_loop, &b );
+    transformcache_clear( &b.cache );
 
     // 消息发送完毕, 直接销毁
     if ( message_is_complete( msg ) ) {
@@ -1282,6 +2017,13 @@ int32_t _broadcast2_direct( struct iolayer * self, struct session_manager * mana
 
 void _invoke_direct( struct iolayer * self, uint8_t index, struct task_invoke * task )
 {
+    // 会话已经迁出, 转发到会话所在的网络线程
+    if ( task->id != 0
+        && _forward_task( self, iothreads_get( self->threads, index )->manager,
+            task->id, eIOTaskType_Invoke, task, sizeof( struct task_invoke ) ) ) {
+        return;
+    }
+
     task->perform( iothreads_get_context( self->threads, index ), task->task );
 }
 
@@ -1308,6 +2050,10 @@ int32_t _perform_direct( struct iolayer * self, struct session_manager * manager
                 syslog( LOG_WARNING, "%s(SID=%ld, TASK:%u) failed, schedule task failed .", __FUNCTION__, task->id, task->type );
             }
         }
+    } else if ( _forward_task( self, manager,
+                    task->id, eIOTaskType_Perform, task, sizeof( struct task_perform ) ) ) {
+        // 会话已经迁出, 转发到会话所在的网络线程
+        return 0;
     } else {
         // 非法会话
         rc = -1;
@@ -1321,11 +2067,13 @@ int32_t _perform_direct( struct iolayer * self, struct session_manager * manager
     return rc;
 }
 
-int32_t _shutdown_direct( struct session_manager * manager, sid_t id )
+int32_t _shutdown_direct( struct iolayer * self, struct session_manager * manager, sid_t id )
 {
     struct session * session = session_manager_get( manager, id );
 
     if ( session == NULL ) {
+        // 会话已经迁出, 转发到会话所在的网络线程
+        _forward_task( self, manager, id, eIOTaskType_Shutdown, &id, sizeof( id ) );
         // syslog(LOG_WARNING, "%s(SID=%ld) failed, the Session is invalid .", __FUNCTION__,id );
         return -1;
     }
@@ -1335,21 +2083,23 @@ int32_t _shutdown_direct( struct session_manager * manager, sid_t id )
     return session_shutdown( session );
 }
 
-int32_t _shutdowns_direct( uint8_t index, struct session_manager * manager, struct sidlist * ids )
+int32_t _shutdowns_direct( struct iolayer * self, struct session_manager * manager, struct sidlist * ids )
 {
     int32_t count = 0;
     uint32_t totalcount = sidlist_count( ids );
 
     for ( uint32_t i = 0; i < totalcount; ++i ) {
         sid_t id = sidlist_get( ids, i );
-        if ( SID_INDEX( id ) == index ) {
-            struct session * s = session_manager_get( manager, id );
-            if ( likely( s != NULL ) ) {
-                // 直接终止
-                ++count;
-                session_close( s );
-                session_shutdown( s );
-            }
+        // 迁入的会话使用旧的会话ID
+        struct session * s = session_manager_get( manager, id );
+        if ( likely( s != NULL ) ) {
+            // 直接终止
+            ++count;
+            session_close( s );
+            session_shutdown( s );
+        } else if ( unlikely( manager->nforwards > 0 ) ) {
+            // 会话已经迁出, 转发到会话所在的网络线程
+            _forward_task( self, manager, id, eIOTaskType_Shutdown, &id, sizeof( id ) );
         }
     }
     sidlist_destroy( ids );
@@ -1357,6 +2107,263 @@ int32_t _shutdowns_direct( uint8_t index, struct session_manager * manager, stru
     return count;
 }
 
+int32_t _forward_task( struct iolayer * self, struct session_manager * manager, sid_t id, int16_t type, void * task, int32_t size )
+{
+    int32_t index = session_manager_route( manager, id );
+
+    if ( likely( index < 0 ) ) {
+        return 0;
+    }
+
+    if ( iothreads_post2( self->threads, index, type, task, size, IOTHREADS_POST_NOLIMIT ) != 0 ) {
+        syslog( LOG_WARNING, "%s(SID=%ld, TASK:%d) failed, can't forward to the IOThread[%d] .", __FUNCTION__, id, type, index );
+    }
+
+    return 1;
+}
+
+void * _partition_sids( uint8_t nthreads, const void * items, size_t size, uint32_t count, uint32_t * offsets )
+{
+    uint32_t positions[256];
+    const char * from = (const char *)items;
+    char * sorted = (char *)malloc( count * size );
+    assert( sorted != NULL && "allocate sorted items failed" );
+
+    // 按照网络线程分组(计数排序), 非法的会话ID直接丢弃
+    // 元素的第一个成员是会话ID
+    memset( offsets, 0, ( nthreads + 1 ) * sizeof( uint32_t ) );
+    for ( uint32_t i = 0; i < count; ++i ) {
+        uint8_t index = SID_INDEX( *(const sid_t *)( from + i * size ) );
+        if ( likely( index < nthreads ) ) {
+            ++offsets[index + 1];
+        }
+    }
+    for ( uint8_t i = 0; i < nthreads; ++i ) {
+        offsets[i + 1] += offsets[i];
+    }
+
+    memcpy( positions, offsets, nthreads * sizeof( uint32_t ) );
+    for ( uint32_t i = 0; i < count; ++i ) {
+        uint8_t index = SID_INDEX( *(const sid_t *)( from + i * size ) );
+        if ( likely( index < nthreads ) ) {
+            memcpy( sorted + ( positions[index]++ ) * size, from + i * size, size );
+        }
+    }
+
+    return sorted;
+}
+
+int32_t _migrate_direct( struct iolayer * self, uint8_t index, struct task_migrate * task )
+{
+    struct iothread * thread = iothreads_get( self->threads, index );
+    struct session * session = session_manager_get( thread->manager, task->id );
+
+    if ( session == NULL ) {
+        // 会话已经迁出, 继续转发
+        if ( !_forward_task( self, thread->manager,
+                 task->id, eIOTaskType_Migrate, task, sizeof( struct task_migrate ) ) ) {
+            syslog( LOG_WARNING, "%s(SID=%ld) failed, the Session is invalid .", __FUNCTION__, task->id );
+        }
+        return -1;
+    }
+
+    if ( task->index == index ) {
+        return 0;
+    }
+
+    if ( !_migratable( session ) ) {
+        syslog( LOG_WARNING, "%s(SID=%ld) failed, the Session can't be migrated .", __FUNCTION__, task->id );
+        return -2;
+    }
+
+    // 记录旧的会话ID
+    if ( session->aliases == NULL ) {
+        session->aliases = sidlist_create( 4 );
+        assert( session->aliases != NULL && "sidlist_create() failed" );
+    }
+    sidlist_add( session->aliases, session->id );
+
+    // 从本线程中摘除会话
+    session_detach( session );
+    session_manager_remove( thread->manager, session );
+
+    // 旧的会话ID都转发到目标网络线程
+    for ( uint32_t i = 0; i < sidlist_count( session->aliases ); ++i ) {
+        session_manager_forward( thread->manager, sidlist_get( session->aliases, i ), task->index );
+    }
+
+    if ( iothreads_post2( self->threads, task->index,
+             eIOTaskType_Adopt, session, 0, IOTHREADS_POST_NOLIMIT ) != 0 ) {
+        // 提交失败, 会话重新迁入本线程
+        _adopt_direct( self, index, session );
+        return -1;
+    }
+
+    return 0;
+}
+
+void _adopt_direct( struct iolayer * self, uint8_t index, struct session * session )
+{
+    struct iothread * thread = iothreads_get( self->threads, index );
+
+    if ( likely( session_manager_adopt( thread->manager, session ) == 0 ) ) {
+        session_attach( session, thread->sets );
+        return;
+    }
+
+    // 无法分配会话ID, 直接终止会话
+    syslog( LOG_WARNING, "%s(INDEX=%u) failed, the SessionManager is full .", __FUNCTION__, index );
+    session_attach( session, thread->sets );
+    iolayer_unforward_session( self, index, session->aliases );
+    session->service.shutdown( session->context, 1 );
+    session_end( session, 0, 0 );
+}
+
+int32_t _migratable( struct session * session )
+{
+    // 只支持已经建立连接的TCP会话
+    // 等待零拷贝完成通知的消息可能是共享的, 而且内核还在读取, 不能复制
+    return session->driver == NULL
+        && session->fd > 0
+        && session->type != eSessionType_Shared
+        && !( session->status & ( SESSION_SHUTDOWNING | SESSION_EXITING ) )
+        && !session_zerocopy_pending( session )
+        && QUEUE_COUNT( zcqueue )( &session->zcqueue ) == 0;
+}
+
+uint8_t _active_thread( struct iolayer * self, uint8_t index )
+{
+    // 从index开始找到第一个没有退役的网络线程
+    uint8_t nthreads = atomic_load_explicit( &self->nthreads, memory_order_acquire );
+    for ( uint8_t n = 0; n < nthreads; ++n ) {
+        uint8_t i = ( index + n ) % nthreads;
+        if ( !iothread_is_retired( iothreads_get( self->threads, i ) ) ) {
+            return i;
+        }
+    }
+
+    return index;
+}
+
+int32_t _retire_loop( void * context, struct session * s )
+{
+    if ( _migratable( s ) ) {
+        sidlist_add( (struct sidlist *)context, s->id );
+    }
+
+    return 0;
+}
+
+void _retire_direct( struct iolayer * self, uint8_t index )
+{
+    struct iothread * thread = iothreads_get( self->threads, index );
+
+    // 退役之前又被恢复了
+    if ( !iothread_is_retired( thread ) ) {
+        return;
+    }
+
+    struct acceptor * acceptor = STAILQ_FIRST( &thread->acceptorlist );
+    for ( ; acceptor != NULL; ) {
+        struct acceptor * next = STAILQ_NEXT( acceptor, linker );
+
+        // KCP会话共享UDP套接字, 保留监听
+        if ( acceptor->type != NETWORK_TCP || acceptor->fd <= 0 ) {
+            acceptor = next;
+            continue;
+        }
+
+#ifdef EVENT_HAVE_REUSEPORT
+        // 接收队列中已经完成握手的连接分配给其他网络线程
+        // 最后一次accept()和close()之间完成握手的连接会被内核重置,
+        // 开启net.ipv4.tcp_migrate_req(Linux 5.14)后由内核转交给同一组的其他监听套接字
+        evsets_del( acceptor->evsets, acceptor->event );
+        _drain_acceptor( self, acceptor );
+
+        // 分配任务不引用TCP的接收器, 直接回收
+        STAILQ_REMOVE( &thread->acceptorlist, acceptor, acceptor, linker );
+        iolayer_free_acceptor( acceptor );
+#else
+        // 监听套接字转交给其他网络线程
+        evsets_del( acceptor->evsets, acceptor->event );
+        STAILQ_REMOVE( &thread->acceptorlist, acceptor, acceptor, linker );
+        acceptor->index = _active_thread( self, index );
+        iothreads_post2( self->threads, acceptor->index, eIOTaskType_Listen, acceptor, 0, IOTHREADS_POST_NOLIMIT );
+#endif
+        acceptor = next;
+    }
+
+    // 迁出所有的TCP会话
+    struct sidlist * ids = sidlist_create( 64 );
+    assert( ids != NULL && "sidlist_create() failed" );
+    session_manager_foreach( thread->manager, _retire_loop, ids );
+
+    for ( uint32_t i = 0; i < sidlist_count( ids ); ++i ) {
+        sid_t id = sidlist_get( ids, i );
+        struct task_migrate task = { id, iolayer_dispatch( self, (uint32_t)id ) };
+        _migrate_direct( self, index, &task );
+    }
+
+    syslog( LOG_INFO, "%s(INDEX=%u) : the IOThread retired, %u Sessions migrated, %u Sessions remained .",
+        __FUNCTION__, index, sidlist_count( ids ), session_manager_count( thread->manager ) );
+    sidlist_destroy( ids );
+}
+
+void _drain_acceptor( struct iolayer * self, struct acceptor * acceptor )
+{
+    for ( ;; ) {
+        uint16_t port = 0;
+        char * host = (char *)malloc( INET6_ADDRSTRLEN );
+        assert( host != NULL && "allocate host failed" );
+
+        int32_t cfd = tcp_accept( acceptor->fd, host, &port );
+        if ( cfd <= 0 ) {
+            free( host );
+            break;
+        }
+#if !defined EVENT_OS_BSD
+        set_non_block( cfd );
+#endif
+        struct task_assign task = { cfd, acceptor->type, port, host, NULL, NULL, acceptor->cb, acceptor->context };
+        if ( iothreads_post2( self->threads, iolayer_dispatch( self, cfd ),
+                 eIOTaskType_Assign, &task, sizeof( task ), IOTHREADS_POST_NOLIMIT ) != 0 ) {
+            _free_task_assign( &task );
+        }
+    }
+}
+
+void _unforward_direct( struct session_manager * manager, struct sidlist * ids )
+{
+    for ( uint32_t i = 0; i < sidlist_count( ids ); ++i ) {
+        session_manager_unforward( manager, sidlist_get( ids, i ) );
+    }
+
+    sidlist_destroy( ids );
+}
+
+void iolayer_unforward_session( struct iolayer * self, uint8_t index, struct sidlist * aliases )
+{
+    for ( uint8_t i = 0; i < self->nthreads; ++i ) {
+        if ( i == index ) {
+            // 本线程的别名
+            for ( uint32_t j = 0; j < sidlist_count( aliases ); ++j ) {
+                session_manager_unforward(
+                    iothreads_get( self->threads, i )->manager, sidlist_get( aliases, j ) );
+            }
+            continue;
+        }
+
+        struct sidlist * list = sidlist_create( sidlist_count( aliases ) );
+        assert( list != NULL && "sidlist_create() failed" );
+        sidlist_append( list, aliases );
+
+        // 其他线程的转发
+        if ( iothreads_post2( self->threads, i, eIOTaskType_Unforward, list, 0, IOTHREADS_POST_NOLIMIT ) != 0 ) {
+            sidlist_destroy( list );
+        }
+    }
+}
+
 void _concrete_processor( void * context, uint8_t index, int16_t type, void * task )
 {
     struct iolayer * layer = (struct iolayer *)context;
@@ -1381,6 +2388,16 @@ void _concrete_processor( void * context, uint8_t index, int16_t type, void * ta
 
             // 分配一个描述符
         case eIOTaskType_Assign :
+            if ( unlikely( iothread_is_retired( thread ) )
+                && ( (struct task_assign *)task )->transfer == NULL ) {
+                // 退役前分配的TCP会话, 重新分配给其他网络线程
+                struct task_assign * assign = (struct task_assign *)task;
+                if ( iothreads_post2( layer->threads, iolayer_dispatch( layer, assign->fd ),
+                         eIOTaskType_Assign, assign, sizeof( struct task_assign ), IOTHREADS_POST_NOLIMIT ) != 0 ) {
+                    _free_task_assign( assign );
+                }
+                break;
+            }
             _assign_direct( layer, index, thread->sets, (struct task_assign *)task );
             break;
 
@@ -1391,17 +2408,17 @@ void _concrete_processor( void * context, uint8_t index, int16_t type, void * ta
 
             // 广播数据
         case eIOTaskType_Broadcast :
-            _broadcast_direct( layer, index, thread->manager, (struct message *)task );
+            _broadcast_direct( layer, thread->manager, (struct message *)task );
             break;
 
             // 终止一个会话
         case eIOTaskType_Shutdown :
-            _shutdown_direct( thread->manager, *( (sid_t *)task ) );
+            _shutdown_direct( layer, thread->manager, *( (sid_t *)task ) );
             break;
 
             // 批量终止多个会话
         case eIOTaskType_Shutdowns :
-            _shutdowns_direct( index, thread->manager, (struct sidlist *)task );
+            _shutdowns_direct( layer, thread->manager, (struct sidlist *)task );
             break;
 
             // 广播数据
@@ -1418,5 +2435,55 @@ void _concrete_processor( void * context, uint8_t index, int16_t type, void * ta
         case eIOTaskType_Perform :
             _perform_direct( layer, thread->manager, (struct task_perform *)task );
             break;
+
+            // 迁出会话
+        case eIOTaskType_Migrate :
+            _migrate_direct( layer, index, (struct task_migrate *)task );
+            break;
+
+            // 迁入会话
+        case eIOTaskType_Adopt :
+            _adopt_direct( layer, index, (struct session *)task );
+            break;
+
+            // 删除会话的转发
+        case eIOTaskType_Unforward :
+            _unforward_direct( thread->manager, (struct sidlist *)task );
+            break;
+
+            // 退役网络线程
+        case eIOTaskType_Retire :
+            _retire_direct( layer, index );
+            break;
+
+            // 加入/离开广播组
+        case eIOTaskType_Join :
+        case eIOTaskType_Leave :
+            _group_direct( layer, thread->manager, type, (struct task_group *)task );
+            break;
+
+            // 广播组广播
+        case eIOTaskType_Publish :
+            _publish_direct( layer, thread->manager, (struct task_publish *)task );
+            break;
+    }
+}
+
+void _concrete_dropper( void * context, uint8_t index, int16_t type, void * task )
+{
+    // 回收队列满时被丢弃的数据任务
+    switch ( type ) {
+        case eIOTaskType_Send :
+            free( ( (struct task_send *)task )->buf );
+            break;
+
+        case eIOTaskType_Broadcast :
+        case eIOTaskType_Broadcast2 :
+            message_destroy( (struct message *)task );
+            break;
+
+        case eIOTaskType_Publish :
+            message_destroy( ( (struct task_publish *)task )->msg );
+            break;
     }
 }
@@ -6,8 +6,10 @@
 #include <unistd.h>
 #include <stdlib.h>
 
+#include "utils.h"
 #include "driver.h"
 #include "channel.h"
+#include "sidlist.h"
 #include "session.h"
 #include "network-internal.h"
 
@@ -16,6 +18,7 @@ static inline int32_t _del_session( struct session * self );
 static inline int32_t _reset_session( struct session * self );
 static inline void _stop( struct session * self );
 static inline void _init_settings( struct session_setting * self );
+static inline void _session_manager_bind( struct session_manager * self, struct session * session );
 
 // 发送数据
 // _send_only()仅发送,
@@ -23,10 +26,22 @@ static inline void _init_settings( struct session_setting * self );
 // _send_buffer()发送数据, 未发送成功的创建消息, 添加到发送队列中
 static inline ssize_t _send_only( struct session * self, char * buf, size_t nbytes );
 static inline ssize_t _send_message( struct session * self, struct message * message );
-static inline ssize_t _send_buffer( struct session * self, char * buf, size_t nbytes );
+static inline ssize_t _send_buffer( struct session * self, char * buf, size_t nbytes, int32_t isfree );
+
+// 广播时缓存相同改造类型的改造结果
+static inline struct transformed * _transformcache_find( struct transformcache * self, uint64_t key );
+static inline int32_t _transformcache_reserve( struct transformcache * self );
+static inline struct transformed * _transformcache_add( struct session * self, struct message * message, struct transformcache * cache );
+
+// 迁移之前把发送队列中和其他会话共享的消息替换为私有的消息
+static inline void _privatize_sendqueue( struct session * self );
+
+// 没有等到零拷贝的完成通知, 重置连接后释放消息
+static inline void _abort_zerocopy( int32_t fd, sid_t id, struct zcqueue * queue );
 
 //
 QUEUE_GENERATE( sendqueue, struct message * )
+QUEUE_GENERATE( zcqueue, struct zcentry )
 
 //
 struct session * _new_session()
@@ -42,14 +57,13 @@ struct session * _new_session()
     _init_settings( &self->setting );
 
     // 初始化网络事件
-    self->evread = event_create();
-    self->evwrite = event_create();
-    self->evkeepalive = event_create();
-    assert( self->evread != NULL
-        && self->evwrite != NULL && self->evkeepalive != NULL );
+    event_init( &self->evread );
+    event_init( &self->evwrite );
+    event_init( &self->evkeepalive );
 
     // 初始化发送队列
     QUEUE_INIT( sendqueue )( &self->sendqueue, DEFAULT_SENDQUEUE_SIZE );
+    QUEUE_INIT( zcqueue )( &self->zcqueue, 8 );
 
     return self;
 }
@@ -61,6 +75,12 @@ int32_t _reset_session( struct session * self )
     self->status = 0;
     self->msgoffset = 0;
 
+    if ( self->aliases != NULL ) {
+        sidlist_destroy( self->aliases );
+        self->aliases = NULL;
+    }
+    self->ngroups = 0;
+
     // 初始化设置
     _init_settings( &self->setting );
 
@@ -68,22 +88,17 @@ int32_t _reset_session( struct session * self )
         free( self->host );
         self->host = NULL;
     }
-    // 销毁网络事件
-    if ( likely( self->evread != NULL ) ) {
-        event_reset( self->evread );
-    }
-    if ( likely( self->evwrite != NULL ) ) {
-        event_reset( self->evwrite );
-    }
-    if ( likely( self->evkeepalive != NULL ) ) {
-        event_reset( self->evkeepalive );
-    }
+    // 重置网络事件
+    event_reset( &self->evread );
+    event_reset( &self->evwrite );
+    event_reset( &self->evkeepalive );
 
     buffer_erase( &self->inbuffer,
         buffer_length( &self->inbuffer ) );
     // 收缩发送队列
     QUEUE_RESET( sendqueue ) ( &self->sendqueue );
     QUEUE_SHRINK( sendqueue ) ( &self->sendqueue, DEFAULT_SENDQUEUE_SIZE );
+    QUEUE_RESET( zcqueue ) ( &self->zcqueue );
 
     return 0;
 }
@@ -95,28 +110,24 @@ int32_t _del_session( struct session * self )
     self->status = 0;
     self->msgoffset = 0;
 
+    if ( self->aliases != NULL ) {
+        sidlist_destroy( self->aliases );
+        self->aliases = NULL;
+    }
+    if ( self->groups != NULL ) {
+        free( self->groups );
+        self->groups = NULL;
+    }
+
     // 销毁host
     if ( likely( self->host != NULL ) ) {
         free( self->host );
         self->host = NULL;
     }
 
-    // 销毁网络事件
-    if ( likely( self->evread != NULL ) ) {
-        event_destroy( self->evread );
-        self->evread = NULL;
-    }
-    if ( likely( self->evwrite != NULL ) ) {
-        event_destroy( self->evwrite );
-        self->evwrite = NULL;
-    }
-    if ( likely( self->evkeepalive != NULL ) ) {
-        event_destroy( self->evkeepalive );
-        self->evkeepalive = NULL;
-    }
-
     buffer_clear( &self->inbuffer );
     QUEUE_CLEAR( sendqueue ) ( &self->sendqueue );
+    QUEUE_CLEAR( zcqueue ) ( &self->zcqueue );
     free( self );
 
     return 0;
@@ -128,11 +139,7 @@ void _stop( struct session * self )
     struct schedule_task * loop = NULL;
     struct schedule_task * temp = NULL;
     SLIST_FOREACH_SAFE( loop, &self->tasklist, tasklink, temp ) {
-        if ( likely( loop->evschedule != NULL ) ) {
-            evsets_del( self->evsets, loop->evschedule );
-            event_destroy( loop->evschedule );
-            loop->evschedule = NULL;
-        }
+        event_reset( &loop->evschedule );
         loop->recycle( loop->type, loop->task, loop->interval );
         free( loop );
     }
@@ -140,15 +147,18 @@ void _stop( struct session * self )
 
     // 删除网络事件
     if ( self->status & SESSION_READING ) {
-        evsets_del( self->evsets, self->evread );
+        evsets_del( self->evsets, &self->evread );
         self->status &= ~SESSION_READING;
+    } else if ( self->evread.evsets != NULL ) {
+        // 读事件的回调中终止会话, 关闭描述符之前提交推迟的删除
+        evsets_del( self->evread.evsets, &self->evread );
     }
     if ( self->status & SESSION_WRITING ) {
-        evsets_del( self->evsets, self->evwrite );
+        evsets_del( self->evsets, &self->evwrite );
         self->status &= ~SESSION_WRITING;
     }
     if ( self->status & SESSION_KEEPALIVING ) {
-        evsets_del( self->evsets, self->evkeepalive );
+        evsets_del( self->evsets, &self->evkeepalive );
         self->status &= ~SESSION_KEEPALIVING;
     }
 
@@ -160,6 +170,15 @@ void _stop( struct session * self )
         driver_destroy( self->driver );
     }
 
+    // 零拷贝发送的消息通常已经交给管理器等待完成通知(session_manager_linger())
+    // 剩下的只能重置连接, 让内核丢弃发送队列后再释放
+    if ( QUEUE_COUNT( zcqueue )( &self->zcqueue ) > 0 ) {
+        _abort_zerocopy(
+            self->type != eSessionType_Shared ? self->fd : -1, self->id, &self->zcqueue );
+    }
+    self->zcseq = self->zcdone = 0;
+    self->zclinger = 0;
+
     // 关闭描述符
     if ( self->fd > 0
         && self->type != eSessionType_Shared ) {
@@ -173,10 +192,13 @@ void _stop( struct session * self )
 void _init_settings( struct session_setting * self )
 {
     self->persist_mode = 0;
+    self->edge_trigger = 0;
     self->timeout_msecs = -1;
     self->keepalive_msecs = -1;
     self->max_inbuffer_len = 0;
     self->sendqueue_limit = 0;
+    self->zerocopy = 0;
+    self->transformkey = 0;
     self->send = NULL;
     self->transmit = NULL;
 }
@@ -234,24 +256,40 @@ ssize_t _send_message( struct session * self, struct message * message )
     return ntry;
 }
 
-ssize_t _send_buffer( struct session * self, char * buf, size_t nbytes )
+ssize_t _send_buffer( struct session * self, char * buf, size_t nbytes, int32_t isfree )
 {
-    // 发送
-    ssize_t ntry = _send_only( self, buf, nbytes );
+    ssize_t ntry = 0;
+
+    // 零拷贝发送的消息由发送队列发送, 完成通知之前缓冲区不能释放
+    if ( unlikely( session_zerocopy_eligible( self, nbytes ) ) ) {
+        ntry = ( self->status & SESSION_EXITING ) ? -1 : 0;
+    } else {
+        ntry = _send_only( self, buf, nbytes );
+    }
+
     if ( ntry >= 0 && ntry < (ssize_t)nbytes ) {
         // 未全部发送成功的情况下
 
         // 创建message, 添加到发送队列中
         struct message * message = message_create();
         if ( message == NULL ) {
+            if ( isfree != 0 ) free( buf );
             return -2;
         }
-        message_add_buffer( message, buf + ntry, nbytes - ntry );
+        if ( isfree != 0 && ntry == 0 ) {
+            // 直接接管缓冲区
+            message_set_buffer( message, buf, nbytes );
+            isfree = 0;
+        } else {
+            message_add_buffer( message, buf + ntry, nbytes - ntry );
+        }
         message_add_receiver( message, self->id );
         QUEUE_PUSH( sendqueue ) ( &self->sendqueue, &message );
         session_add_event( self, EV_WRITE );
     }
 
+    if ( isfree != 0 ) free( buf );
+
     return ntry;
 }
 
@@ -277,6 +315,15 @@ int32_t session_start( struct session * self, int8_t type, int32_t fd, evsets_t
     if ( self->driver == NULL ) {
         self->setting.send = channel_send;
         self->setting.transmit = channel_transmit;
+        // TCP会话的边缘触发模式, 读事件常驻事件集
+        if ( ( (struct iolayer *)self->iolayer )->edgetrigger ) {
+            self->setting.edge_trigger = 1;
+            self->setting.persist_mode = EV_PERSIST;
+        }
+        // 忙轮询模式下, 由内核在读取时轮询网卡队列
+        if ( ( (struct iolayer *)self->iolayer )->busypoll > 0 ) {
+            set_busypoll( fd, ( (struct iolayer *)self->iolayer )->busypoll );
+        }
     } else {
         self->setting.send = driver_send;
         self->setting.transmit = driver_transmit;
@@ -341,6 +388,28 @@ void session_set_reattach( struct session * self, reattacher_t reattach, void *
     self->reattach = reattach;
 }
 
+int32_t session_set_zerocopy( struct session * self, size_t threshold )
+{
+#if defined EVENT_HAVE_ZEROCOPY
+    if ( self->driver != NULL || self->fd <= 0 ) {
+        return -1;
+    }
+
+    if ( threshold > 0 && self->setting.transmit != channel_zerocopy_transmit ) {
+        if ( set_zerocopy( self->fd ) != 0 ) {
+            return -2;
+        }
+        self->setting.transmit = channel_zerocopy_transmit;
+    }
+
+    // 关闭后仍然由channel_zerocopy_transmit()发送, 等待已经发出的完成通知
+    self->setting.zerocopy = threshold;
+    return 0;
+#else
+    return threshold > 0 ? -1 : 0;
+#endif
+}
+
 void session_sendqueue_take( struct session * self, struct sendqueue * q )
 {
     // 当前的消息需要重发
@@ -362,6 +431,11 @@ void session_sendqueue_merge( struct session * self, struct sendqueue * q )
 }
 
 ssize_t session_send( struct session * self, char * buf, size_t nbytes )
+{
+    return session_send2( self, buf, nbytes, 0 );
+}
+
+ssize_t session_send2( struct session * self, char * buf, size_t nbytes, int32_t isfree )
 {
     ssize_t rc = -1;
     char * _buf = buf;
@@ -374,20 +448,130 @@ ssize_t session_send( struct session * self, char * buf, size_t nbytes )
     }
 
     if ( likely( _buf != NULL ) ) {
-        // 发送数据
-        // TODO: _send_buffer()可以根据具体情况决定是否copy内存
-        rc = _send_buffer( self, _buf, _nbytes );
+        // 发送数据, 改造的消息由_send_buffer()销毁
+        rc = _send_buffer( self, _buf, _nbytes, _buf != buf || isfree != 0 );
+    }
 
-        if ( _buf != buf ) {
-            // 销毁改造的消息
-            free( _buf );
-        }
+    if ( _buf != buf && isfree != 0 ) {
+        free( buf );
     }
 
     return rc;
 }
 
 //
+void transformcache_clear( struct transformcache * self )
+{
+    for ( uint32_t i = 0; i < self->count; ++i ) {
+        struct message * message = self->entries[i].message;
+        if ( message != NULL && message_is_complete( message ) ) {
+            message_destroy( message );
+        }
+    }
+
+    free( self->entries );
+    transformcache_init( self );
+}
+
+struct transformed * _transformcache_find( struct transformcache * self, uint64_t key )
+{
+    // 共享改造结果的类型一般很少, 顺序查找
+    for ( uint32_t i = 0; i < self->count; ++i ) {
+        if ( self->entries[i].key == key ) {
+            return &( self->entries[i] );
+        }
+    }
+
+    return NULL;
+}
+
+int32_t _transformcache_reserve( struct transformcache * self )
+{
+    if ( self->count == self->size ) {
+        uint32_t size = self->size == 0 ? 8 : self->size << 1;
+        struct transformed * entries = (struct transformed *)realloc( self->entries, size * sizeof( struct transformed ) );
+        if ( entries == NULL ) {
+            return -1;
+        }
+        self->size = size;
+        self->entries = entries;
+    }
+
+    return 0;
+}
+
+struct transformed * _transformcache_add( struct session * self, struct message * message, struct transformcache * cache )
+{
+    size_t nbytes = message_get_length( message );
+    char * buf = message_get_buffer( message );
+    char * buffer = self->service.transform( self->context, (const char *)buf, &nbytes );
+    if ( buffer == NULL ) {
+        // 改造失败不缓存
+        return NULL;
+    }
+
+    struct transformed * entry = &( cache->entries[cache->count++] );
+    entry->key = self->setting.transformkey;
+    entry->message = NULL;
+
+    if ( buffer != buf ) {
+        entry->message = message_create();
+        assert( entry->message != NULL && "message_create() failed" );
+        message_set_buffer( entry->message, buffer, nbytes );
+    }
+
+    return entry;
+}
+
+ssize_t session_sendmessage2( struct session * self, struct message * message, struct transformcache * cache )
+{
+    ssize_t rc = -1;
+
+    if ( cache == NULL
+        || self->service.transform == NULL
+        || self->setting.transformkey == 0 ) {
+        return session_sendmessage( self, message );
+    }
+
+    struct transformed * entry = _transformcache_find( cache, self->setting.transformkey );
+    if ( entry == NULL ) {
+        if ( _transformcache_reserve( cache ) != 0 ) {
+            // 缓存扩容失败, 不共享改造结果, 单独改造发送
+            return session_sendmessage( self, message );
+        }
+        entry = _transformcache_add( self, message, cache );
+    }
+
+    if ( entry == NULL ) {
+        // 数据改造失败
+        message_add_failure( message, self->id );
+        return -1;
+    }
+
+    if ( entry->message == NULL ) {
+        // 消息未进行改造
+        rc = QUEUE_PUSH( sendqueue )( &self->sendqueue, &message );
+        if ( rc != 0 ) {
+            message_add_failure( message, self->id );
+            return -1;
+        }
+    } else {
+        // 共享改造后的消息, 原始消息由改造后的消息单独发送
+        message_count_receiver( entry->message );
+        rc = QUEUE_PUSH( sendqueue )( &self->sendqueue, &( entry->message ) );
+        if ( rc != 0 ) {
+            message_add_failure( entry->message, self->id );
+            message_add_failure( message, self->id );
+            return -1;
+        }
+        message_add_success( message );
+    }
+
+    // 注册写事件
+    session_add_event( self, EV_WRITE );
+    return 0;
+}
+
 ssize_t session_sendmessage( struct session * self, struct message * message )
 {
     char * buf = message_get_buffer( message );
@@ -414,13 +598,11 @@ ssize_t session_sendmessage( struct session * self, struct message * message )
     } else if ( buffer != NULL ) {
         // 消息改造成功
 
-        rc = _send_buffer( self, buffer, nbytes );
+        rc = _send_buffer( self, buffer, nbytes, 1 );
         if ( rc >= 0 ) {
             // 改造后的消息已经单独发送
             message_add_success( message );
         }
-
-        free( buffer );
     }
 
     if ( rc < 0 ) {
@@ -444,18 +626,27 @@ void session_add_event( struct session * self, int16_t ev )
         if ( self->type != eSessionType_Shared ) {
             fd = self->fd;
             event = ev | self->setting.persist_mode;
+            if ( self->setting.edge_trigger ) {
+                event = EV_READ | EV_PERSIST | EV_ET;
+            }
         }
-        event_set( self->evread, fd, event );
-        event_set_callback( self->evread, channel_on_read, self );
-        evsets_add( self->evsets, self->evread, self->setting.timeout_msecs );
+        event_set( &self->evread, fd, event );
+        event_set_callback( &self->evread, channel_on_read, self );
+        evsets_add( self->evsets, &self->evread, self->setting.timeout_msecs );
         // 修改读状态
         self->status |= SESSION_READING;
     }
 
     // 注册写事件
     if ( ( ev & EV_WRITE ) && !( status & SESSION_WRITING ) ) {
+        int16_t event = ev;
         int32_t wait_for_shutdown = -1;
 
+        // 边缘触发模式下, 写事件常驻事件集直到发送队列为空
+        if ( self->setting.edge_trigger ) {
+            event = EV_WRITE | EV_PERSIST | EV_ET;
+        }
+
         // 在等待退出的会话上总是会添加10s的定时器
         if ( status & SESSION_EXITING ) {
             // 对端主机崩溃 + Socket缓冲区满的情况下
@@ -463,9 +654,9 @@ void session_add_event( struct session * self, int16_t ev )
             wait_for_shutdown = MAX_SECONDS_WAIT_FOR_SHUTDOWN;
         }
 
-        event_set( self->evwrite, self->fd, ev );
-        event_set_callback( self->evwrite, channel_on_write, self );
-        evsets_add( self->evsets, self->evwrite, wait_for_shutdown );
+        event_set( &self->evwrite, self->fd, event );
+        event_set_callback( &self->evwrite, channel_on_write, self );
+        evsets_add( self->evsets, &self->evwrite, wait_for_shutdown );
         // 修改写状态
         self->status |= SESSION_WRITING;
     }
@@ -478,12 +669,12 @@ void session_del_event( struct session * self, int16_t ev )
     evsets_t sets = self->evsets;
 
     if ( ( ev & EV_READ ) && ( status & SESSION_READING ) ) {
-        evsets_del( sets, self->evread );
+        evsets_del( sets, &self->evread );
         self->status &= ~SESSION_READING;
     }
 
     if ( ( ev & EV_WRITE ) && ( status & SESSION_WRITING ) ) {
-        evsets_del( sets, self->evwrite );
+        evsets_del( sets, &self->evwrite );
         self->status &= ~SESSION_WRITING;
     }
 }
@@ -506,9 +697,9 @@ int32_t session_start_keepalive( struct session * self )
     evsets_t sets = self->evsets;
 
     if ( self->setting.keepalive_msecs >= 0 && !( status & SESSION_KEEPALIVING ) ) {
-        event_set( self->evkeepalive, -1, 0 );
-        event_set_callback( self->evkeepalive, channel_on_keepalive, self );
-        evsets_add( sets, self->evkeepalive, self->setting.keepalive_msecs );
+        event_set( &self->evkeepalive, -1, 0 );
+        event_set_callback( &self->evkeepalive, channel_on_keepalive, self );
+        evsets_add( sets, &self->evkeepalive, self->setting.keepalive_msecs );
 
         self->status |= SESSION_KEEPALIVING;
     }
@@ -535,13 +726,15 @@ int32_t session_start_reconnect( struct session * self )
         self->fd = -1;
     }
 
+    // 零拷贝发送的消息等待完成通知后再释放
+    session_manager_linger( self->manager, self );
     // 停止会话
     _stop( self );
 
     // 200毫秒后尝试重连, 避免进入重连死循环
-    event_set( self->evwrite, -1, 0 );
-    event_set_callback( self->evwrite, channel_on_reconnect, self );
-    evsets_add( sets, self->evwrite, TRY_RECONNECT_INTERVAL );
+    event_set( &self->evwrite, -1, 0 );
+    event_set_callback( &self->evwrite, channel_on_reconnect, self );
+    evsets_add( sets, &self->evwrite, TRY_RECONNECT_INTERVAL );
     self->status |= SESSION_WRITING; // 让session忙起来
 
     return 0;
@@ -552,11 +745,7 @@ int32_t session_cancel_task( struct session * self, struct schedule_task * task
     SLIST_REMOVE(
         &self->tasklist, task, schedule_task, tasklink );
 
-    if ( task->evschedule != NULL ) {
-        evsets_del( self->evsets, task->evschedule );
-        event_destroy( task->evschedule );
-        task->evschedule = NULL;
-    }
+    event_reset( &task->evschedule );
 
     task->recycle( task->type, task->task, task->interval );
     free( task );
@@ -579,17 +768,14 @@ int32_t session_schedule_task( struct session * self, int32_t type, void * t, in
     task->recycle = recycle;
     task->interval = interval;
     task->session = self;
-    task->evschedule = event_create();
-    if ( task->evschedule == NULL ) {
-        return -3;
-    }
+    event_init( &task->evschedule );
 
     // 压入链表
     SLIST_INSERT_HEAD( &self->tasklist, task, tasklink );
     // 定时
-    event_set( task->evschedule, -1, 0 );
-    event_set_callback( task->evschedule, channel_on_schedule, task );
-    evsets_add( self->evsets, task->evschedule, task->interval );
+    event_set( &task->evschedule, -1, 0 );
+    event_set_callback( &task->evschedule, channel_on_schedule, task );
+    evsets_add( self->evsets, &task->evschedule, task->interval );
 
     return 0;
 }
@@ -603,8 +789,19 @@ int32_t session_shutdown( struct session * self )
         self->status |= SESSION_EXITING;
 
         // 优先把数据发出去
+        // 重新注册写事件, 确保等待退出的定时器生效
         session_del_event( self, EV_READ );
-        session_add_event( self, EV_WRITE );
+        session_readd_event( self, EV_WRITE );
+
+        return 1;
+    }
+
+    if ( !( self->status & SESSION_EXITING )
+        && session_zerocopy_pending( self ) ) {
+        // 发送队列为空, 等待零拷贝发送的完成通知后再终止会话
+        self->status |= SESSION_EXITING;
+        session_del_event( self, EV_READ | EV_WRITE );
+        channel_zerocopy_linger( self );
 
         return 1;
     }
@@ -651,6 +848,94 @@ int32_t session_end( struct session * self, sid_t id, int8_t recycle )
     return 0;
 }
 
+static inline void _detach_event( struct event * ev )
+{
+    // 记录定时器的超时时间, 迁移后重新计时
+    int32_t tv = ( ev->status & EVSTATUS_TIMER ) ? EVENT_TIMEOUT( ev ) : -1;
+
+    evsets_del( ev->evsets, ev );
+    ev->results = 0;
+    ev->timer_msecs = tv;
+}
+
+int32_t session_detach( struct session * self )
+{
+    struct schedule_task * task = NULL;
+
+    if ( self->status & SESSION_READING ) {
+        _detach_event( &self->evread );
+    }
+    if ( self->status & SESSION_WRITING ) {
+        _detach_event( &self->evwrite );
+    }
+    if ( self->status & SESSION_KEEPALIVING ) {
+        _detach_event( &self->evkeepalive );
+    }
+    SLIST_FOREACH( task, &self->tasklist, tasklink ) {
+        _detach_event( &task->evschedule );
+    }
+
+    _privatize_sendqueue( self );
+
+    self->evsets = NULL;
+    return 0;
+}
+
+void _privatize_sendqueue( struct session * self )
+{
+    // 共享的消息由创建它的网络线程计数和销毁, 不能带到其他网络线程
+    uint32_t count = session_sendqueue_count( self );
+
+    for ( uint32_t i = 0; i < count; ++i ) {
+        struct message * message = NULL;
+        QUEUE_POP( sendqueue ) ( &self->sendqueue, &message );
+
+        if ( message_get_receivers( message ) > 1 ) {
+            struct message * copy = message_create();
+            assert( copy != NULL && "message_create() failed" );
+
+            // 共享数据的引用计数是原子的, 不需要复制
+            if ( message->payload != NULL ) {
+                message_set_payload( copy, message->payload );
+            } else {
+                message_add_buffer( copy, message_get_buffer( message ), message_get_length( message ) );
+            }
+            message_add_receiver( copy, self->id );
+
+            // 本会话的发送由副本负责
+            message_add_success( message );
+            if ( message_is_complete( message ) ) {
+                message_destroy( message );
+            }
+            message = copy;
+        }
+
+        QUEUE_PUSH( sendqueue ) ( &self->sendqueue, &message );
+    }
+}
+
+int32_t session_attach( struct session * self, evsets_t sets )
+{
+    struct schedule_task * task = NULL;
+
+    self->evsets = sets;
+
+    if ( self->status & SESSION_READING ) {
+        evsets_add( sets, &self->evread, EVENT_TIMEOUT( &self->evread ) );
+    }
+    if ( self->status & SESSION_WRITING ) {
+        evsets_add( sets, &self->evwrite, EVENT_TIMEOUT( &self->evwrite ) );
+    }
+    if ( self->status & SESSION_KEEPALIVING ) {
+        evsets_add( sets, &self->evkeepalive, EVENT_TIMEOUT( &self->evkeepalive ) );
+    }
+    SLIST_FOREACH( task, &self->tasklist, tasklink ) {
+        evsets_add( sets, &task->evschedule, EVENT_TIMEOUT( &task->evschedule ) );
+    }
+
+    return 0;
+}
+
 // -----------------------------------------------------------------------------
 // -----------------------------------------------------------------------------
 // -----------------------------------------------------------------------------
@@ -662,8 +947,159 @@ struct slot {
     };
     uint16_t version;
     uint8_t is_active;
+    uint32_t active; // 在活跃会话数组中的下标
 };
 
+// 转发表的桶数
+#define FORWARD_BUCKETS 1024
+// 广播组的桶数
+#define GROUP_BUCKETS 1024
+
+struct forward {
+    sid_t id;
+    sid_t newid;   // 别名: 本线程中的会话ID
+    uint8_t index; // 会话所在的网络线程
+    struct forward * next;
+};
+
+struct group {
+    uint64_t id;
+    uint32_t count;
+    uint32_t size;
+    struct session ** members; // 本线程中的组成员
+    struct group * next;
+};
+
+static inline struct forward * _forward_find( struct session_manager * self, sid_t id )
+{
+    if ( self->forwards == NULL ) {
+        return NULL;
+    }
+
+    struct forward * f = self->forwards[id & ( FORWARD_BUCKETS - 1 )];
+    for ( ; f != NULL; f = f->next ) {
+        if ( f->id == id ) {
+            return f;
+        }
+    }
+
+    return NULL;
+}
+
+static inline struct forward * _forward_insert( struct session_manager * self, sid_t id )
+{
+    struct forward * f = _forward_find( self, id );
+    if ( f != NULL ) {
+        return f;
+    }
+
+    if ( self->forwards == NULL ) {
+        self->forwards = (struct forward **)calloc( FORWARD_BUCKETS, sizeof( struct forward * ) );
+        if ( self->forwards == NULL ) {
+            return NULL;
+        }
+    }
+
+    f = (struct forward *)calloc( 1, sizeof( struct forward ) );
+    if ( f != NULL ) {
+        struct forward ** bucket = &( self->forwards[id & ( FORWARD_BUCKETS - 1 )] );
+        f->id = id;
+        f->next = *bucket;
+        *bucket = f;
+        ++self->nforwards;
+    }
+
+    return f;
+}
+
+static inline struct group * _group_find( struct session_manager * self, uint64_t id )
+{
+    if ( self->groups == NULL ) {
+        return NULL;
+    }
+
+    struct group * g = self->groups[id & ( GROUP_BUCKETS - 1 )];
+    for ( ; g != NULL; g = g->next ) {
+        if ( g->id == id ) {
+            return g;
+        }
+    }
+
+    return NULL;
+}
+
+static inline int32_t _group_add( struct session_manager * self, struct membership * m, struct session * session )
+{
+    struct group * g = _group_find( self, m->id );
+
+    if ( g == NULL ) {
+        if ( self->groups == NULL ) {
+            self->groups = (struct group **)calloc( GROUP_BUCKETS, sizeof( struct group * ) );
+            if ( self->groups == NULL ) {
+                return -1;
+            }
+        }
+
+        g = (struct group *)calloc( 1, sizeof( struct group ) );
+        if ( g == NULL ) {
+            return -1;
+        }
+
+        struct group ** bucket = &( self->groups[m->id & ( GROUP_BUCKETS - 1 )] );
+        g->id = m->id;
+        g->next = *bucket;
+        *bucket = g;
+    }
+
+    if ( g->count == g->size ) {
+        uint32_t size = g->size == 0 ? 8 : g->size << 1;
+        struct session ** members = (struct session **)realloc( g->members, size * sizeof( struct session * ) );
+        if ( members == NULL ) {
+            return -1;
+        }
+        g->size = size;
+        g->members = members;
+    }
+
+    m->group = g;
+    m->index = g->count;
+    g->members[g->count++] = session;
+    return 0;
+}
+
+static inline void _group_del( struct session_manager * self, struct membership * m )
+{
+    struct group * g = m->group;
+
+    if ( g == NULL ) {
+        return;
+    }
+
+    // Swap Remove, 更新被移动的成员的下标
+    struct session * last = g->members[--g->count];
+    g->members[m->index] = last;
+    for ( uint32_t i = 0; i < last->ngroups; ++i ) {
+        if ( last->groups[i].group == g ) {
+            last->groups[i].index = m->index;
+            break;
+        }
+    }
+    m->group = NULL;
+
+    // 没有成员的广播组直接删除
+    if ( g->count == 0 ) {
+        struct group ** link = &( self->groups[g->id & ( GROUP_BUCKETS - 1 )] );
+        for ( ; *link != NULL; link = &( ( *link )->next ) ) {
+            if ( *link == g ) {
+                *link = g->next;
+                break;
+            }
+        }
+        free( g->members );
+        free( g );
+    }
+}
+
 inline int32_t _session_manager_expand( struct session_manager * self )
 {
     if ( self->capacity >= MAX_SLOT_CAPACITY ) {
@@ -686,6 +1122,14 @@ inline int32_t _session_manager_expand( struct session_manager * self )
     }
     self->table = new_pool;
 
+    // 活跃会话数组和槽位等长
+    struct session ** new_actives = (struct session **)realloc( self->actives, new_capacity * sizeof( struct session * ) );
+    if ( new_actives == NULL ) {
+        syslog( LOG_ERR, "%s: realloc failed, Out Of Memory.", __FUNCTION__ );
+        return -2;
+    }
+    self->actives = new_actives;
+
     // 初始化新扩容出来的尾部槽位
     for ( uint32_t i = old_capacity; i < new_capacity; ++i ) {
         self->table[i].version = 0;
@@ -716,6 +1160,9 @@ struct session_manager * session_manager_create( uint8_t index, uint32_t size )
     self->table = (struct slot *)calloc( size, sizeof(struct slot) );
     assert( self->table != NULL && "allocate struct slot failed" );
 
+    self->actives = (struct session **)calloc( size, sizeof(struct session *) );
+    assert( self->actives != NULL && "allocate actives failed" );
+
     self->count = 0;
     self->free_head = 0;
     self->index = index;
@@ -731,6 +1178,10 @@ struct session_manager * session_manager_create( uint8_t index, uint32_t size )
 
     self->recyclesize = 0;
     STAILQ_INIT( &self->recyclelist );
+    TAILQ_INIT( &self->lingers );
+
+    self->nforwards = 0;
+    self->forwards = NULL;
 
     return self;
 }
@@ -760,6 +1211,12 @@ struct session * session_manager_alloc( struct session_manager * self )
 
     if ( unlikely( session == NULL ) ) return NULL;
 
+    _session_manager_bind( self, session );
+    return session;
+}
+
+static inline void _session_manager_bind( struct session_manager * self, struct session * session )
+{
     // 获取空槽位
     uint32_t seq = self->free_head;
     struct slot * slot = &self->table[seq];
@@ -768,9 +1225,10 @@ struct session * session_manager_alloc( struct session_manager * self )
     self->free_head = slot->next_free;
 
     // 激活
-    ++self->count;
     slot->is_active = 1;
     slot->session = session;
+    slot->active = self->count;
+    self->actives[self->count++] = session;
 
     // 生成sid
     sid_t sid = MAKE_SID( self->index, slot->version, seq );
@@ -778,8 +1236,35 @@ struct session * session_manager_alloc( struct session_manager * self )
     // 绑定
     session->id = sid;
     session->manager = self;
+}
 
-    return session;
+int32_t session_manager_adopt( struct session_manager * self, struct session * session )
+{
+    if ( unlikely( self->free_head == INVALID_SLOT_INDEX ) ) {
+        if ( _session_manager_expand( self ) != 0 ) {
+            return -1;
+        }
+    }
+
+    _session_manager_bind( self, session );
+
+    // 旧的会话ID都指向新的会话ID
+    if ( session->aliases != NULL ) {
+        for ( uint32_t i = 0; i < sidlist_count( session->aliases ); ++i ) {
+            session_manager_alias( self, sidlist_get( session->aliases, i ), session->id );
+        }
+    }
+
+    // 重新加入本线程的广播组
+    for ( uint32_t i = 0; i < session->ngroups; ) {
+        if ( _group_add( self, &( session->groups[i] ), session ) == 0 ) {
+            ++i; continue;
+        }
+        syslog( LOG_WARNING, "%s(SID=%ld) : rejoin the Group(%lu) failed .", __FUNCTION__, session->id, session->groups[i].id );
+        session->groups[i] = session->groups[--session->ngroups];
+    }
+
+    return 0;
 }
 
 struct session * session_manager_get( struct session_manager * self, sid_t id )
@@ -787,7 +1272,16 @@ struct session * session_manager_get( struct session_manager * self, sid_t id )
     uint32_t seq = SID_SEQ( id );
     uint16_t ver = SID_VERSION( id );
 
-    if ( unlikely( seq >= self->capacity ) ) {
+    // 迁入的会话
+    if ( unlikely( self->nforwards > 0 ) ) {
+        struct forward * f = _forward_find( self, id );
+        if ( f != NULL ) {
+            return f->index == self->index ? session_manager_get( self, f->newid ) : NULL;
+        }
+    }
+
+    if ( unlikely( seq >= self->capacity
+             || SID_INDEX( id ) != self->index ) ) {
         return NULL;
     }
 
@@ -802,18 +1296,131 @@ struct session * session_manager_get( struct session_manager * self, sid_t id )
     return NULL;
 }
 
+int32_t session_manager_route( struct session_manager * self, sid_t id )
+{
+    if ( likely( self->nforwards == 0 ) ) {
+        return -1;
+    }
+
+    struct forward * f = _forward_find( self, id );
+    return ( f != NULL && f->index != self->index ) ? f->index : -1;
+}
+
+int32_t session_manager_forward( struct session_manager * self, sid_t id, uint8_t index )
+{
+    struct forward * f = _forward_insert( self, id );
+    if ( f == NULL ) {
+        return -1;
+    }
+
+    f->newid = 0;
+    f->index = index;
+    return 0;
+}
+
+int32_t session_manager_alias( struct session_manager * self, sid_t id, sid_t newid )
+{
+    struct forward * f = _forward_insert( self, id );
+    if ( f == NULL ) {
+        return -1;
+    }
+
+    f->newid = newid;
+    f->index = self->index;
+    return 0;
+}
+
+void session_manager_unforward( struct session_manager * self, sid_t id )
+{
+    if ( self->forwards == NULL ) {
+        return;
+    }
+
+    struct forward ** link = &( self->forwards[id & ( FORWARD_BUCKETS - 1 )] );
+    for ( ; *link != NULL; link = &( ( *link )->next ) ) {
+        struct forward * f = *link;
+        if ( f->id == id ) {
+            *link = f->next;
+            --self->nforwards;
+            free( f );
+            return;
+        }
+    }
+}
+
 int32_t session_manager_foreach( struct session_manager * self, int32_t ( *func )( void *, struct session * ), void * context )
 {
     int32_t count = 0;
 
-    for ( uint32_t i = 0; i < self->capacity; ++i ) {
-        struct slot * slot = &self->table[i];
-        if ( slot->is_active && slot->session != NULL ) {
-            if ( func( context, slot->session ) != 0 ) {
-                return count;
-            }
-            ++count;
+    // 只遍历活跃会话, 逆序遍历允许在回调中移除当前会话
+    for ( uint32_t i = self->count; i > 0; --i ) {
+        if ( func( context, self->actives[i - 1] ) != 0 ) {
+            return count;
+        }
+        ++count;
+    }
+
+    return count;
+}
+
+int32_t session_manager_join( struct session_manager * self, uint64_t group, struct session * session )
+{
+    for ( uint32_t i = 0; i < session->ngroups; ++i ) {
+        if ( session->groups[i].id == group ) {
+            return 1;
+        }
+    }
+
+    if ( session->ngroups == session->szgroups ) {
+        uint32_t size = session->szgroups == 0 ? 4 : session->szgroups << 1;
+        struct membership * groups = (struct membership *)realloc( session->groups, size * sizeof( struct membership ) );
+        if ( groups == NULL ) {
+            return -2;
+        }
+        session->szgroups = size;
+        session->groups = groups;
+    }
+
+    struct membership * m = &( session->groups[session->ngroups] );
+    m->id = group;
+    m->group = NULL;
+    if ( _group_add( self, m, session ) != 0 ) {
+        return -2;
+    }
+
+    ++session->ngroups;
+    return 0;
+}
+
+int32_t session_manager_leave( struct session_manager * self, uint64_t group, struct session * session )
+{
+    for ( uint32_t i = 0; i < session->ngroups; ++i ) {
+        if ( session->groups[i].id == group ) {
+            _group_del( self, &( session->groups[i] ) );
+            session->groups[i] = session->groups[--session->ngroups];
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+uint32_t session_manager_members( struct session_manager * self, uint64_t group )
+{
+    struct group * g = _group_find( self, group );
+    return g != NULL ? g->count : 0;
+}
+
+int32_t session_manager_foreach_group( struct session_manager * self, uint64_t group, int32_t ( *func )( void *, struct session * ), void * context )
+{
+    int32_t count = 0;
+    struct group * g = _group_find( self, group );
+
+    for ( uint32_t i = g != NULL ? g->count : 0; i > 0; --i ) {
+        if ( func( context, g->members[i - 1] ) != 0 ) {
+            return count;
         }
+        ++count;
     }
 
     return count;
@@ -831,13 +1438,22 @@ int32_t session_manager_remove( struct session_manager * self, struct session *
         return -1;
     }
 
+    // 离开本线程的广播组, 保留广播组ID(迁移后重新加入)
+    for ( uint32_t i = 0; i < session->ngroups; ++i ) {
+        _group_del( self, &( session->groups[i] ) );
+    }
+
+    // 从活跃会话数组中移除(Swap Remove)
+    struct session * last = self->actives[--self->count];
+    self->actives[slot->active] = last;
+    self->table[SID_SEQ( last->id )].active = slot->active;
+
     // 关闭
     slot->is_active = 0;
     // 版本号增加
     ++slot->version;
     // 归还
     slot->next_free = self->free_head;
-    --self->count;
     self->free_head = seq;
     // 清空会话
     session->id = 0;
@@ -846,6 +1462,89 @@ int32_t session_manager_remove( struct session_manager * self, struct session *
     return 0;
 }
 
+int32_t session_manager_linger( struct session_manager * self, struct session * session )
+{
+    if ( !session_zerocopy_pending( session )
+        || session->fd <= 0 || session->type == eSessionType_Shared ) {
+        return 0;
+    }
+
+    struct zclinger * linger = (struct zclinger *)calloc( 1, sizeof( struct zclinger ) );
+    if ( unlikely( linger == NULL ) ) {
+        return -1;
+    }
+    if ( QUEUE_INIT( zcqueue )( &linger->zcqueue, 8 ) != 0 ) {
+        free( linger );
+        return -1;
+    }
+
+    // 发送了一部分的消息也可能是零拷贝发送的, 不能随发送队列一起释放
+    if ( session->msgoffset > 0 ) {
+        struct message * message = NULL;
+        QUEUE_POP( sendqueue )( &session->sendqueue, &message );
+        struct zcentry entry = { session->zcseq - 1, message };
+        QUEUE_PUSH( zcqueue )( &session->zcqueue, &entry );
+        session->msgoffset = 0;
+    }
+
+    // 接管描述符以及等待完成通知的消息, 会话停止时不再关闭描述符
+    linger->fd = session->fd;
+    linger->id = session->id;
+    linger->zcseq = session->zcseq;
+    linger->zcdone = session->zcdone;
+    linger->nlinger = session->zclinger;
+    linger->evsets = session->evsets;
+    linger->manager = self;
+    QUEUE_SWAP( zcqueue )( &linger->zcqueue, &session->zcqueue );
+    session->fd = -1;
+    session->zcseq = session->zcdone = 0;
+    session->zclinger = 0;
+
+    // 发送队列中的数据发送完后关闭连接
+    shutdown( linger->fd, SHUT_WR );
+
+    // 定时读取错误队列中的完成通知
+    event_init( &linger->evtimer );
+    event_set( &linger->evtimer, -1, 0 );
+    event_set_callback( &linger->evtimer, channel_on_zclinger, linger );
+    evsets_add( linger->evsets, &linger->evtimer, ZEROCOPY_LINGER_INTERVAL );
+
+    TAILQ_INSERT_TAIL( &self->lingers, linger, linker );
+    return 1;
+}
+
+void session_manager_unlinger( struct session_manager * self, struct zclinger * linger )
+{
+    TAILQ_REMOVE( &self->lingers, linger, linker );
+
+    if ( QUEUE_COUNT( zcqueue )( &linger->zcqueue ) > 0 ) {
+        syslog( LOG_WARNING,
+            "%s(SID=%ld): %u zero-copy message(s) are not completed, reset the connection .",
+            __FUNCTION__, linger->id, QUEUE_COUNT( zcqueue )( &linger->zcqueue ) );
+        _abort_zerocopy( linger->fd, linger->id, &linger->zcqueue );
+    }
+
+    close( linger->fd );
+    QUEUE_CLEAR( zcqueue )( &linger->zcqueue );
+    free( linger );
+}
+
+void _abort_zerocopy( int32_t fd, sid_t id, struct zcqueue * queue )
+{
+    // 关闭描述符之前设置, 内核丢弃还没有发送的数据
+    if ( fd > 0 ) {
+        set_abortive( fd );
+    }
+
+    struct zcentry entry;
+    while ( QUEUE_POP( zcqueue )( queue, &entry ) ) {
+        message_add_failure( entry.message, id );
+        if ( message_is_complete( entry.message ) ) {
+            message_destroy( entry.message );
+        }
+    }
+}
+
 void session_manager_recycle( struct session_manager * self, struct session * session )
 {
     if ( session->manager == self && session->id != 0 ) {
@@ -876,6 +1575,13 @@ void session_manager_destroy( struct session_manager * self )
         }
     }
 
+    // 网络线程已经退出, 不再等待零拷贝的完成通知
+    // 事件集已经销毁, 定时器不需要删除
+    struct zclinger * linger;
+    while ( (linger = TAILQ_FIRST( &self->lingers )) != NULL ) {
+        session_manager_unlinger( self, linger );
+    }
+
     // 排空并释放 session 对象的回收队列
     struct session *session;
     while ( (session = STAILQ_FIRST( &self->recyclelist )) != NULL ) {
@@ -883,11 +1589,43 @@ void session_manager_destroy( struct session_manager * self )
         _del_session( session );
     }
 
+    // 释放转发表
+    if ( self->forwards != NULL ) {
+        for ( uint32_t i = 0; i < FORWARD_BUCKETS; ++i ) {
+            while ( self->forwards[i] != NULL ) {
+                struct forward * f = self->forwards[i];
+                self->forwards[i] = f->next;
+                free( f );
+            }
+        }
+        free( self->forwards );
+        self->forwards = NULL;
+    }
+    self->nforwards = 0;
+
+    // 释放广播组
+    if ( self->groups != NULL ) {
+        for ( uint32_t i = 0; i < GROUP_BUCKETS; ++i ) {
+            while ( self->groups[i] != NULL ) {
+                struct group * g = self->groups[i];
+                self->groups[i] = g->next;
+                free( g->members );
+                free( g );
+            }
+        }
+        free( self->groups );
+        self->groups = NULL;
+    }
+
     // 3. 释放 SlotMap 核心物理数组
     if ( self->table != NULL ) {
         free( self->table );
         self->table = NULL;
     }
+    if ( self->actives != NULL ) {
+        free( self->actives );
+        self->actives = NULL;
+    }
 
     self->capacity = 0;
     self->count = 0;
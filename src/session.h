@@ -11,6 +11,7 @@
 #include <netinet/in.h>
 
 #include "event.h"
+#include "event-internal.h"
 #include "network.h"
 #include "queue.h"
 #include "message.h"
@@ -65,10 +66,13 @@ enum SessionType {
 struct session;
 struct session_setting {
     int32_t persist_mode;
+    int32_t edge_trigger;
     int32_t timeout_msecs;
     int32_t keepalive_msecs;
     int32_t max_inbuffer_len;
     int32_t sendqueue_limit;
+    size_t zerocopy; // 零拷贝发送的阈值(字节), 0-关闭
+    uint64_t transformkey; // 数据改造的类型, 相同类型的会话共享广播的改造结果, 0-不共享
     ssize_t ( *transmit )( struct session * s );
     ssize_t ( *send )( struct session * s, char * buf, size_t nbytes );
 };
@@ -79,7 +83,7 @@ struct schedule_task {
     void * task;
     int32_t interval;
     taskrecycler_t recycle;
-    event_t evschedule;
+    struct event evschedule;
     struct session * session;
     SLIST_ENTRY( schedule_task ) tasklink;
 };
@@ -89,6 +93,22 @@ struct driver;
 QUEUE_HEAD( sendqueue, struct message * );
 QUEUE_PROTOTYPE( sendqueue, struct message * )
 
+// 零拷贝发送完成, 等待内核完成通知的消息
+struct zcentry {
+    uint32_t seq; // 最后一次发送的序号
+    struct message * message;
+};
+QUEUE_HEAD( zcqueue, struct zcentry );
+QUEUE_PROTOTYPE( zcqueue, struct zcentry )
+
+// 会话加入的广播组
+struct group;
+struct membership {
+    uint64_t id;          // 广播组ID
+    uint32_t index;       // 在广播组成员数组中的下标
+    struct group * group; // 会话所在网络线程的广播组
+};
+
 struct session {
     sid_t id;
 
@@ -98,10 +118,10 @@ struct session {
     char * host;
     uint16_t port;
 
-    // 读写以及超时事件
-    event_t evread;
-    event_t evwrite;
-    event_t evkeepalive;
+    // 读写以及超时事件(内嵌在会话中, 不单独分配)
+    struct event evread;
+    struct event evwrite;
+    struct event evkeepalive;
 
     // 事件集和管理器
     evsets_t evsets;
@@ -127,9 +147,24 @@ struct session {
     size_t msgoffset;
     struct sendqueue sendqueue;
 
+    // 零拷贝发送(MSG_ZEROCOPY)
+    // 内核按照发送的次数编号, 完成通知给出已经完成的编号区间
+    uint32_t zcseq;          // 下一次零拷贝发送的编号
+    uint32_t zcdone;         // 已经完成的编号(不包含)
+    int32_t zclinger;        // 终止会话时等待完成通知的次数
+    struct zcqueue zcqueue;  // 等待完成通知的消息
+
     // 会话的设置
     struct session_setting setting;
 
+    // 迁移前使用过的会话ID, 仍然可以访问到该会话
+    struct sidlist * aliases;
+
+    // 加入的广播组, 迁移时随会话一起迁移
+    uint32_t ngroups;
+    uint32_t szgroups;
+    struct membership * groups;
+
     // 回收链表
     STAILQ_ENTRY( session ) recyclelink;
 };
@@ -158,11 +193,41 @@ void session_sendqueue_take( struct session * self, struct sendqueue * q );
 // 发送队列合并
 void session_sendqueue_merge( struct session * self, struct sendqueue * q );
 
+// 是否有零拷贝发送的数据等待内核的完成通知
+#define session_zerocopy_pending( self ) ( ( self )->zcseq != ( self )->zcdone )
+// 消息是否使用零拷贝发送
+#define session_zerocopy_eligible( self, nbytes ) \
+    ( ( self )->setting.zerocopy > 0 && ( nbytes ) >= ( self )->setting.zerocopy )
+
+// 设置零拷贝发送的阈值, 0-关闭
+int32_t session_set_zerocopy( struct session * self, size_t threshold );
+
 // 发送数据
 ssize_t session_send( struct session * self, char * buf, size_t nbytes );
+// 发送数据, isfree!=0时由会话接管并释放缓冲区
+ssize_t session_send2( struct session * self, char * buf, size_t nbytes, int32_t isfree );
 // 发送消息
 ssize_t session_sendmessage( struct session * self, struct message * message );
 
+// 广播时按照数据改造的类型缓存改造后的消息
+// 只在一个网络线程的一次广播中有效
+struct transformed {
+    uint64_t key;
+    struct message * message; // NULL-数据未改造, 发送原始消息
+};
+struct transformcache {
+    uint32_t count;
+    uint32_t size;
+    struct transformed * entries;
+};
+
+#define transformcache_init( self ) ( *( self ) = ( struct transformcache ){ 0, 0, NULL } )
+// 销毁没有接收者的消息, 释放缓存
+void transformcache_clear( struct transformcache * self );
+
+// 广播消息, 相同改造类型的会话共享改造后的消息
+ssize_t session_sendmessage2( struct session * self, struct message * message, struct transformcache * cache );
+
 // 会话注册/反注册网络事件
 void session_add_event( struct session * self, int16_t ev );
 void session_del_event( struct session * self, int16_t ev );
@@ -191,13 +256,37 @@ int32_t session_shutdown( struct session * self );
 // 会话结束
 int32_t session_end( struct session * self, sid_t id, int8_t recycle );
 
+// 会话迁移
+// session_detach() - 从当前事件集中删除所有的事件(读写, 保活, 定时任务), 保留事件的状态
+//                    发送队列中共享的消息替换为私有的副本
+// session_attach() - 把删除的事件注册到新的事件集中, 定时器重新计时
+int32_t session_detach( struct session * self );
+int32_t session_attach( struct session * self, evsets_t sets );
+
 // -----------------------------------------------------------------------------
 // -----------------------------------------------------------------------------
 // -----------------------------------------------------------------------------
 
 struct slot;
+struct forward;
 STAILQ_HEAD( sessionlist, session );
 
+// 会话终止后等待零拷贝完成通知的描述符
+// 内核可能还在读取消息的数据, 收到完成通知之前不能释放消息
+struct zclinger {
+    int32_t fd;
+    sid_t id;
+    uint32_t zcseq;
+    uint32_t zcdone;
+    int32_t nlinger;         // 等待完成通知的次数
+    evsets_t evsets;
+    struct event evtimer;    // 定时检查完成通知
+    struct zcqueue zcqueue;  // 等待完成通知的消息
+    struct session_manager * manager;
+    TAILQ_ENTRY( zclinger ) linker;
+};
+TAILQ_HEAD( zclingerlist, zclinger );
+
 struct session_manager {
     uint8_t index;
     uint32_t count;
@@ -205,9 +294,22 @@ struct session_manager {
 
     struct slot * table;
     uint32_t free_head;
+    struct session ** actives;      // 活跃会话数组(count个), 用于遍历
+
+    // 迁移会话的转发表
+    // 转发: 迁出的会话ID -> 新的网络线程
+    // 别名: 迁入的会话的旧ID -> 本线程中的会话ID
+    uint32_t nforwards;
+    struct forward ** forwards;
+
+    // 广播组: 广播组ID -> 本线程中的组成员
+    struct group ** groups;
 
     uint32_t recyclesize;           // 回收个数
     struct sessionlist recyclelist; // 回收队列
+
+    // 等待零拷贝完成通知的描述符
+    struct zclingerlist lingers;
 };
 
 // 创建会话管理器
@@ -221,16 +323,46 @@ struct session_manager * session_manager_create( uint8_t index, uint32_t size );
 // 分配一个会话
 struct session * session_manager_alloc( struct session_manager * self );
 
-// 从会话管理器中取出一个会话
+// 从会话管理器中取出一个会话(包括迁入的会话的旧ID)
 struct session * session_manager_get( struct session_manager * self, sid_t id );
 
+// 迁入一个会话, 分配新的会话ID
+int32_t session_manager_adopt( struct session_manager * self, struct session * session );
+
+// 转发表
+// session_manager_route()   - 迁出的会话所在的网络线程, -1: 不需要转发
+// session_manager_forward() - 会话ID迁出到其他网络线程
+// session_manager_alias()   - 会话ID迁入到本网络线程
+// session_manager_unforward() - 删除会话ID的转发
+int32_t session_manager_route( struct session_manager * self, sid_t id );
+int32_t session_manager_forward( struct session_manager * self, sid_t id, uint8_t index );
+int32_t session_manager_alias( struct session_manager * self, sid_t id, sid_t newid );
+void session_manager_unforward( struct session_manager * self, sid_t id );
+
 // 遍历
 int32_t session_manager_foreach( struct session_manager * self,
     int32_t ( *func )( void *, struct session * ), void * context );
 
+// 广播组
+// session_manager_join()   - 会话加入广播组, 1: 已经加入
+// session_manager_leave()  - 会话离开广播组, -1: 没有加入
+// session_manager_members() - 本线程中广播组的成员个数
+// session_manager_foreach_group() - 遍历本线程中广播组的成员
+int32_t session_manager_join( struct session_manager * self, uint64_t group, struct session * session );
+int32_t session_manager_leave( struct session_manager * self, uint64_t group, struct session * session );
+uint32_t session_manager_members( struct session_manager * self, uint64_t group );
+int32_t session_manager_foreach_group( struct session_manager * self, uint64_t group,
+    int32_t ( *func )( void *, struct session * ), void * context );
+
 // 从会话管理器中移出会话
 int32_t session_manager_remove( struct session_manager * self, struct session * session );
 
+// 零拷贝发送
+// session_manager_linger()   - 会话终止时接管描述符和等待完成通知的消息, 1: 已经接管
+// session_manager_unlinger() - 完成或者超时后关闭描述符, 释放消息
+int32_t session_manager_linger( struct session_manager * self, struct session * session );
+void session_manager_unlinger( struct session_manager * self, struct zclinger * linger );
+
 // 回收会话
 void session_manager_recycle( struct session_manager * self, struct session * session );
 
@@ -10,6 +10,12 @@
 // 这个选项需要测试期间不断调整以适应场景的需要
 #define MSGQUEUE_DEFAULT_SIZE 4096
 
+// 负载的采样间隔(微秒)
+#define LOAD_SAMPLE_INTERVAL 100000
+
+// 每一轮执行(或者窃取)的可窃取任务数
+#define JOBS_PER_ROUND 32
+
 // 线程默认栈大小
 #define THREAD_DEFAULT_STACK_SIZE ( 8 * 1024 )
 
@@ -25,6 +31,7 @@ STAILQ_HEAD( associaterlist, associater );
 // 64位对齐，消除伪共享
 struct iothread {
     uint8_t index;
+    int32_t cpu; // 绑定的CPU, -1-不绑定
     pthread_t id;
 
     evsets_t sets;
@@ -34,6 +41,32 @@ struct iothread {
 
     event_t cmdevent;
     struct msgqueue * queue;
+    _Atomic int32_t sleeping; // 是否阻塞在事件集上等待, 只有此时才需要通知
+
+    // 负载, 由网络线程定期更新
+    _Atomic uint32_t nsessions; // 会话数
+    _Atomic uint32_t cpuload;   // 最近的CPU占用率(千分比)
+    _Atomic int64_t loadstamp;  // 最近一次采样的时间(微秒)
+
+    // 队列满的统计
+    _Atomic uint64_t nrejected; // 拒绝的任务数
+    _Atomic uint64_t ndropped;  // 丢弃的任务数
+
+    // 队列满时阻塞等待的生产者, 网络线程取出任务后通知
+    _Atomic int32_t nwaiters;
+    pthread_cond_t spacecond;
+    pthread_mutex_t spacelock;
+
+    // 可窃取的任务队列, 不绑定网络线程的任务
+    // 空闲的网络线程从其他网络线程的队列中窃取任务
+    struct evlock joblock;
+    struct taskqueue jobs;
+    _Atomic uint32_t njobs;
+    _Atomic uint64_t nstolen; // 窃取的任务数
+
+    // 已经退役, 不再分配新的会话和任务, 只转发迁出的会话
+    // 由调用者的线程release写入, 分配会话和任务的线程acquire读取
+    _Atomic uint8_t retired;
 
     // 回收列表
     struct acceptorlist acceptorlist;
@@ -41,10 +74,19 @@ struct iothread {
     struct associaterlist associaterlist;
 }__attribute__((aligned(64)));
 
-int32_t iothread_start( struct iothread * self, uint8_t index, uint32_t nclients, iothreads_t parent );
+int32_t iothread_start( struct iothread * self, uint8_t index, int32_t cpu, uint32_t nclients, iothreads_t parent );
 int32_t iothread_post( struct iothread * self,
+    int16_t type, int16_t utype, void * task, uint8_t size, int32_t flags );
+int32_t iothread_submit( struct iothread * self,
     int16_t type, int16_t utype, void * task, uint8_t size );
+int32_t iothread_posts( struct iothread * self,
+    int16_t type, int16_t utype, void * tasks, uint32_t count, uint8_t size, int32_t flags );
+int32_t iothread_embed( struct iothread * self, uint32_t nclients, iothreads_t parent );
 int32_t iothread_stop( struct iothread * self );
+// 网络线程是否已经退役
+#define iothread_is_retired( self ) atomic_load_explicit( &( self )->retired, memory_order_acquire )
+// 最近的CPU占用率(千分比), 阻塞等待期间不会采样, 读取时按照未采样的时间衰减
+uint32_t iothread_get_cpuload( struct iothread * self );
 
 //
 // 网络线程组
@@ -56,17 +98,42 @@ struct iothreads {
     // 任务处理器
     void * context;
     processor_t processor;
+    processor_t dropper;
 
-    uint8_t nthreads;
+    _Atomic uint8_t nthreads; // 运行期间可以增加, 其他线程acquire读取
+    uint8_t maxthreads;  // 网络线程数的上限
     uint8_t runflags;
     int32_t precision;   // 时间精度
+    int32_t evflags;     // 事件集的创建标志
+    int32_t busypoll;    // 忙轮询的时间(微秒)
+    int32_t qpolicy;     // 队列满时的处理策略
+    int32_t qtimeout;    // 队列满时阻塞等待的时间(毫秒)
+    uint32_t qcapacity;  // 任务队列的容量
+    _Atomic uint32_t roundrobin; // 可窃取任务的轮询分配
+
+    // 嵌入模式, 由调用者的线程驱动唯一的网络线程
+    uint8_t embedded;
+    int32_t timedout;
+    event_t pollevent;
+    struct taskqueue doqueue;
 
     uint8_t nrunthreads;
     pthread_cond_t cond;
     pthread_mutex_t lock;
 };
 
+// 当前线程所在的网络线程, 网络线程启动时设置, 其他线程为NULL
+extern __thread struct iothread * t_current_iothread;
+
+// 当前线程在网络线程组中的索引, -1: 不是该网络线程组中的线程
+static inline int32_t iothreads_current( iothreads_t self )
+{
+    struct iothread * thread = t_current_iothread;
+    return ( thread != NULL && thread->parent == self ) ? (int32_t)thread->index : -1;
+}
+
 int8_t iothreads_get_index( iothreads_t self );
+int32_t iothreads_get_cpu( iothreads_t self, uint8_t index );
 struct iothread * iothreads_get( iothreads_t self, uint8_t index );
 struct acceptorlist * iothreads_get_acceptlist( iothreads_t self, uint8_t index );
 struct connectorlist * iothreads_get_connectlist( iothreads_t self, uint8_t index );
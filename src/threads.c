@@ -1,9 +1,18 @@
 
+#if defined __linux__ && !defined _GNU_SOURCE
+    // pthread_setaffinity_np(), CPU_SET()
+    #define _GNU_SOURCE
+#endif
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
 #include <string.h>
 #include <signal.h>
+#include <time.h>
+#include <errno.h>
+#include <sched.h>
+#include <pthread.h>
 
 #include <sys/types.h>
 #include <sys/uio.h>
@@ -11,21 +20,51 @@
 #include <unistd.h>
 
 #include "config.h"
+#include "utils.h"
 #include "threads.h"
 #include "session.h"
 #include "threads-internal.h"
 
+// 当前线程所在的网络线程
+__thread struct iothread * t_current_iothread = NULL;
+
 // 基础处理器
 void _base_processor( void * context, uint8_t index, int16_t type, void * task ) {}
 
+static void * iothread_main( void * arg );
+static void iothread_on_command( int32_t fd, int16_t ev, void * arg );
+static void _on_polltimeout( int32_t fd, int16_t ev, void * arg );
+static inline uint32_t _process(
+    struct iothreads * parent, struct iothread * thread, struct taskqueue * doqueue );
+static inline int32_t _overflow(
+    struct iothreads * parent, struct iothread * thread, struct task * task, int32_t flags );
+static inline void _wakeup( struct iothread * thread );
+static inline int32_t _iothread_init( struct iothread * self, uint8_t index, int32_t cpu, uint32_t nclients, iothreads_t parent );
+static inline void _sample_load( struct iothread * thread, int64_t * lastsample, int64_t * lastcputime );
+static inline uint32_t _runjobs( struct iothreads * parent, struct iothread * thread, struct iothread * victim, uint32_t max );
+static inline uint32_t _execute( struct iothreads * parent, struct iothread * thread );
+static inline int32_t _backlogged( struct iothreads * parent, struct iothread * thread );
+
 iothreads_t iothreads_start( uint8_t nthreads, uint32_t nclients, int32_t precision )
+{
+    return iothreads_start2( nthreads, nclients, precision, 0 );
+}
+
+iothreads_t iothreads_start2( uint8_t nthreads, uint32_t nclients, int32_t precision, int32_t evflags )
+{
+    return iothreads_start3( nthreads, nclients, precision, evflags, NULL );
+}
+
+static inline struct iothreads * _iothreads_create( uint8_t nthreads, uint8_t maxthreads, int32_t precision, int32_t evflags )
 {
     struct iothreads * iothreads = (struct iothreads *)calloc( 1, sizeof( struct iothreads ) );
     if ( iothreads == NULL ) {
         return NULL;
     }
 
-    iothreads->threads = (struct iothread *)aligned_alloc( 64, nthreads * sizeof( struct iothread ) );
+    // 按照上限预留, 增加网络线程时不需要重新分配
+    maxthreads = MAX( nthreads, maxthreads );
+    iothreads->threads = (struct iothread *)aligned_alloc( 64, maxthreads * sizeof( struct iothread ) );
     if ( iothreads->threads == NULL ) {
         free( iothreads );
         return NULL;
@@ -33,21 +72,122 @@ iothreads_t iothreads_start( uint8_t nthreads, uint32_t nclients, int32_t precis
 
     iothreads->context = iothreads;
     iothreads->processor = _base_processor;
-    iothreads->nthreads = nthreads;
+    iothreads->dropper = _base_processor;
+    atomic_init( &iothreads->nthreads, nthreads );
+    iothreads->maxthreads = maxthreads;
     iothreads->precision = precision;
+    iothreads->evflags = evflags;
+    iothreads->busypoll = 0;
+    iothreads->qpolicy = IOTHREADS_QUEUE_FAILFAST;
+    iothreads->qtimeout = 0;
+    iothreads->qcapacity = 0;
     pthread_cond_init( &iothreads->cond, NULL );
     pthread_mutex_init( &iothreads->lock, NULL );
 
+    // 网络线程启动后就会窃取任务
+    atomic_init( &iothreads->roundrobin, 0 );
+    for ( uint8_t i = 0; i < maxthreads; ++i ) {
+        atomic_init( &iothreads->threads[i].njobs, 0 );
+    }
+
+    return iothreads;
+}
+
+iothreads_t iothreads_start3( uint8_t nthreads, uint32_t nclients, int32_t precision, int32_t evflags, const int32_t * cpus )
+{
+    return iothreads_start4( nthreads, nthreads, nclients, precision, evflags, cpus );
+}
+
+iothreads_t iothreads_start4( uint8_t nthreads, uint8_t maxthreads, uint32_t nclients, int32_t precision, int32_t evflags, const int32_t * cpus )
+{
+    struct iothreads * iothreads = _iothreads_create( nthreads, maxthreads, precision, evflags );
+    if ( iothreads == NULL ) {
+        return NULL;
+    }
+
     // 开启网络线程
     iothreads->runflags = 1;
     iothreads->nrunthreads = nthreads;
     for ( uint8_t i = 0; i < nthreads; ++i ) {
-        iothread_start( iothreads->threads + i, i, nclients, iothreads );
+        iothread_start( iothreads->threads + i,
+            i, cpus != NULL ? cpus[i] : -1, nclients, iothreads );
+    }
+
+    return iothreads;
+}
+
+iothreads_t iothreads_embed( uint32_t nclients, int32_t precision, int32_t evflags )
+{
+    struct iothreads * iothreads = _iothreads_create( 1, 1, precision, evflags );
+    if ( iothreads == NULL ) {
+        return NULL;
+    }
+
+    memset( iothreads->threads, 0, sizeof( struct iothread ) );
+    iothreads->embedded = 1;
+    iothreads->runflags = 1;
+    iothreads->nrunthreads = 0;
+    QUEUE_INIT( taskqueue ) ( &iothreads->doqueue, MSGQUEUE_DEFAULT_SIZE );
+
+    // 限定等待时间的定时器
+    iothreads->pollevent = event_create();
+    if ( iothreads->pollevent == NULL
+        || iothread_embed( iothreads->threads, nclients, iothreads ) != 0 ) {
+        iothreads_stop( iothreads );
+        return NULL;
     }
+    event_set( iothreads->pollevent, -1, 0 );
+    event_set_callback( iothreads->pollevent, _on_polltimeout, iothreads );
 
     return iothreads;
 }
 
+int32_t iothreads_poll( iothreads_t self, int32_t timeout )
+{
+    int32_t nactive = 0;
+    uint32_t nprocess = 0;
+    struct iothreads * iothreads = (struct iothreads *)( self );
+    struct iothread * thread = iothreads->threads;
+
+    assert( thread == t_current_iothread && "iothreads_poll() must be called in the owner thread" );
+
+    if ( unlikely( iothreads->embedded == 0 || iothreads->runflags != 1 ) ) {
+        return -1;
+    }
+
+    if ( timeout == 0 ) {
+        nactive = evsets_poll( thread->sets );
+    } else {
+        iothreads->timedout = 0;
+        if ( timeout > 0 ) {
+            evsets_add( thread->sets, iothreads->pollevent, timeout );
+        }
+
+        // 和iothread_main()相同, 声明进入睡眠后再检查一次任务队列
+        atomic_store_explicit( &thread->sleeping, 1, memory_order_relaxed );
+        atomic_thread_fence( memory_order_seq_cst );
+        if ( msgqueue_count( thread->queue ) > 0
+            || atomic_load_explicit( &thread->njobs, memory_order_relaxed ) > 0 ) {
+            atomic_store_explicit( &thread->sleeping, 0, memory_order_relaxed );
+            nactive = evsets_poll( thread->sets );
+        } else {
+            nactive = evsets_dispatch( thread->sets );
+        }
+
+        if ( timeout > 0 ) {
+            evsets_del( thread->sets, iothreads->pollevent );
+        }
+        // 超时定时器不计入激活的事件
+        nactive -= iothreads->timedout;
+    }
+
+    // 处理任务
+    nprocess = _process( iothreads, thread, &iothreads->doqueue );
+    nprocess += _execute( iothreads, thread );
+
+    return nactive + (int32_t)nprocess;
+}
+
 void iothreads_set_processor( iothreads_t self, processor_t processor, void * context )
 {
     struct iothreads * iothreads = (struct iothreads *)( self );
@@ -59,6 +199,76 @@ void iothreads_set_processor( iothreads_t self, processor_t processor, void * co
     return;
 }
 
+void iothreads_set_busypoll( iothreads_t self, int32_t usecs )
+{
+    struct iothreads * iothreads = (struct iothreads *)( self );
+
+    assert( iothreads != NULL );
+    iothreads->busypoll = usecs > 0 ? usecs : 0;
+}
+
+void iothreads_set_queuelimit( iothreads_t self, uint32_t capacity, int32_t policy, int32_t timeout )
+{
+    struct iothreads * iothreads = (struct iothreads *)( self );
+
+    assert( iothreads != NULL );
+    iothreads->qpolicy = policy;
+    iothreads->qtimeout = timeout > 0 ? timeout : 0;
+    iothreads->qcapacity = capacity;
+
+    for ( uint8_t i = 0; i < iothreads->nthreads; ++i ) {
+        msgqueue_set_capacity( iothreads->threads[i].queue, capacity );
+    }
+}
+
+int32_t iothreads_grow( iothreads_t self, int32_t cpu, uint32_t nclients )
+{
+    struct iothreads * iothreads = (struct iothreads *)( self );
+    uint8_t index = iothreads->nthreads;
+
+    assert( iothreads != NULL );
+
+    if ( iothreads->embedded
+        || iothreads->runflags != 1 || index >= iothreads->maxthreads ) {
+        return -1;
+    }
+
+    pthread_mutex_lock( &iothreads->lock );
+    ++iothreads->nrunthreads;
+    pthread_mutex_unlock( &iothreads->lock );
+
+    if ( iothread_start( iothreads->threads + index, index, cpu, nclients, iothreads ) != 0 ) {
+        pthread_mutex_lock( &iothreads->lock );
+        --iothreads->nrunthreads;
+        pthread_mutex_unlock( &iothreads->lock );
+        return -2;
+    }
+
+    // 网络线程初始化完成后才对其他线程可见
+    atomic_store_explicit( &iothreads->nthreads, index + 1, memory_order_release );
+
+    return index;
+}
+
+void iothreads_set_dropper( iothreads_t self, processor_t dropper )
+{
+    struct iothreads * iothreads = (struct iothreads *)( self );
+
+    assert( iothreads != NULL );
+    iothreads->dropper = dropper != NULL ? dropper : _base_processor;
+}
+
+uint32_t iothreads_get_queuesize( iothreads_t self, uint8_t index )
+{
+    struct iothreads * iothreads = (struct iothreads *)( self );
+
+    assert( iothreads != NULL );
+    assert( index < iothreads->nthreads );
+    assert( iothreads->threads != NULL );
+
+    return msgqueue_count( iothreads->threads[index].queue );
+}
+
 struct iothread * iothreads_get( iothreads_t self, uint8_t index )
 {
     struct iothreads * iothreads = (struct iothreads *)( self );
@@ -105,16 +315,18 @@ struct associaterlist * iothreads_get_associatelist( iothreads_t self, uint8_t i
 
 int8_t iothreads_get_index( iothreads_t self )
 {
-    pthread_t tid = pthread_self();
+    return (int8_t)iothreads_current( self );
+}
+
+int32_t iothreads_get_cpu( iothreads_t self, uint8_t index )
+{
     struct iothreads * iothreads = (struct iothreads *)( self );
 
-    for ( uint8_t i = 0; i < iothreads->nthreads; ++i ) {
-        if ( iothreads->threads[i].id == tid ) {
-            return i;
-        }
-    }
+    assert( iothreads != NULL );
+    assert( index < iothreads->nthreads );
+    assert( iothreads->threads != NULL );
 
-    return -1;
+    return iothreads->threads[index].cpu;
 }
 
 pthread_t iothreads_get_id( iothreads_t self, uint8_t index )
@@ -167,6 +379,11 @@ void iothreads_set_context( iothreads_t self, uint8_t index, void * context )
 // task     - 提交的任务数据
 // size     - 任务数据的长度, 默认设置为0
 int32_t iothreads_post( iothreads_t self, uint8_t index, int16_t type, void * task, uint8_t size )
+{
+    return iothreads_post2( self, index, type, task, size, 0 );
+}
+
+int32_t iothreads_post2( iothreads_t self, uint8_t index, int16_t type, void * task, uint8_t size, int32_t flags )
 {
     struct iothreads * iothreads = (struct iothreads *)( self );
 
@@ -178,6 +395,50 @@ int32_t iothreads_post( iothreads_t self, uint8_t index, int16_t type, void * ta
     }
 
     return iothread_post( iothreads->threads + index,
+        ( size == 0 ? eTaskType_User : eTaskType_Data ), type, task, size, flags );
+}
+
+int32_t iothreads_post_batch( iothreads_t self,
+    uint8_t index, int16_t type, void * tasks, uint32_t count, uint8_t size, int32_t flags )
+{
+    struct iothreads * iothreads = (struct iothreads *)( self );
+
+    assert( size <= TASK_PADDING_SIZE );
+    assert( index < iothreads->nthreads );
+
+    if ( unlikely( iothreads->runflags != 1 ) ) {
+        return -1;
+    }
+
+    return iothread_posts( iothreads->threads + index,
+        ( size == 0 ? eTaskType_User : eTaskType_Data ), type, tasks, count, size, flags );
+}
+
+int32_t iothreads_submit( iothreads_t self, int16_t type, void * task, uint8_t size )
+{
+    struct iothreads * iothreads = (struct iothreads *)( self );
+    struct iothread * thread = t_current_iothread;
+
+    assert( size <= TASK_PADDING_SIZE );
+
+    if ( unlikely( iothreads->runflags != 1 ) ) {
+        return -1;
+    }
+
+    // 其他线程中提交时轮询选择网络线程
+    if ( thread == NULL || thread->parent != self ) {
+        uint8_t nthreads = atomic_load_explicit( &iothreads->nthreads, memory_order_acquire );
+        uint32_t seq = atomic_fetch_add_explicit(
+            &iothreads->roundrobin, 1, memory_order_relaxed );
+        thread = iothreads->threads + seq % nthreads;
+
+        // 跳过退役的网络线程
+        for ( uint8_t i = 1; iothread_is_retired( thread ) && i < nthreads; ++i ) {
+            thread = iothreads->threads + ( seq + i ) % nthreads;
+        }
+    }
+
+    return iothread_submit( thread,
         ( size == 0 ? eTaskType_User : eTaskType_Data ), type, task, size );
 }
 
@@ -185,18 +446,37 @@ void iothreads_stop( iothreads_t self )
 {
     struct iothreads * iothreads = (struct iothreads *)( self );
 
-    // 向所有线程发送停止命令
-    iothreads->runflags = 0;
-    for ( uint8_t i = 0; i < iothreads->nthreads; ++i ) {
-        iothread_post( iothreads->threads + i, eTaskType_Null, 0, NULL, 0 );
-    }
+    if ( iothreads->embedded ) {
+        struct iothread * thread = iothreads->threads;
 
-    // 等待线程退出
-    pthread_mutex_lock( &iothreads->lock );
-    while ( iothreads->nrunthreads > 0 ) {
-        pthread_cond_wait( &iothreads->cond, &iothreads->lock );
+        // 嵌入模式下, 在调用者的线程中清理剩余的任务
+        iothreads->runflags = 0;
+        if ( thread->queue != NULL ) {
+            _process( iothreads, thread, &iothreads->doqueue );
+            while ( _runjobs( iothreads, thread, thread, JOBS_PER_ROUND ) > 0 ) {}
+        }
+        QUEUE_CLEAR( taskqueue ) ( &iothreads->doqueue );
+        if ( iothreads->pollevent != NULL ) {
+            event_destroy( iothreads->pollevent );
+            iothreads->pollevent = NULL;
+        }
+        if ( t_current_iothread == thread ) {
+            t_current_iothread = NULL;
+        }
+    } else {
+        // 向所有线程发送停止命令
+        iothreads->runflags = 0;
+        for ( uint8_t i = 0; i < iothreads->nthreads; ++i ) {
+            iothread_post( iothreads->threads + i, eTaskType_Null, 0, NULL, 0, IOTHREADS_POST_NOLIMIT );
+        }
+
+        // 等待线程退出
+        pthread_mutex_lock( &iothreads->lock );
+        while ( iothreads->nrunthreads > 0 ) {
+            pthread_cond_wait( &iothreads->cond, &iothreads->lock );
+        }
+        pthread_mutex_unlock( &iothreads->lock );
     }
-    pthread_mutex_unlock( &iothreads->lock );
 
     // 销毁所有网络线程
     for ( uint8_t i = 0; i < iothreads->nthreads; ++i ) {
@@ -217,22 +497,110 @@ void iothreads_stop( iothreads_t self )
 // -----------------------------------------------------------------------------
 // -----------------------------------------------------------------------------
 
-static void * iothread_main( void * arg );
-static void iothread_on_command( int32_t fd, int16_t ev, void * arg );
-static inline uint32_t _process(
-    struct iothreads * parent, struct iothread * thread, struct taskqueue * doqueue );
+int32_t iothread_start( struct iothread * self, uint8_t index, int32_t cpu, uint32_t nclients, iothreads_t parent )
+{
+    int32_t rc = 0;
+
+#if defined EVENT_OS_LINUX
+    // 分配之前把当前线程临时迁移到目标CPU上,
+    // 按照首次访问(first-touch)的策略, 网络线程新映射的内存页会落在该CPU所在的NUMA节点上,
+    // 已经被访问过的页面(例如struct iothread数组)不受影响, 只是尽力而为
+    cpu_set_t cpuset, origin;
+    int32_t migrated = 0;
+    if ( cpu >= 0
+        && pthread_getaffinity_np( pthread_self(), sizeof( origin ), &origin ) == 0 ) {
+        CPU_ZERO( &cpuset );
+        CPU_SET( cpu, &cpuset );
+        migrated = pthread_setaffinity_np( pthread_self(), sizeof( cpuset ), &cpuset ) == 0;
+    }
+#endif
+
+    rc = _iothread_init( self, index, cpu, nclients, parent );
+
+#if defined EVENT_OS_LINUX
+    if ( migrated ) {
+        pthread_setaffinity_np( pthread_self(), sizeof( origin ), &origin );
+    }
+#endif
+
+    if ( rc != 0 ) {
+        return rc;
+    }
+
+    // 启动线程
+    pthread_attr_t attr;
+    pthread_attr_init( &attr );
+    //    assert( pthread_attr_setstacksize( &attr, THREAD_DEFAULT_STACK_SIZE ) );
+    pthread_attr_setdetachstate( &attr, PTHREAD_CREATE_DETACHED );
+#if defined EVENT_OS_LINUX
+    // 绑定CPU
+    if ( cpu >= 0 ) {
+        CPU_ZERO( &cpuset );
+        CPU_SET( cpu, &cpuset );
+        if ( pthread_attr_setaffinity_np( &attr, sizeof( cpuset ), &cpuset ) != 0 ) {
+            syslog( LOG_WARNING, "%s(INDEX=%d) : can't bind to CPU%d .", __FUNCTION__, index, cpu );
+        }
+    }
+#endif
+
+    rc = pthread_create( &( self->id ), &attr, iothread_main, self );
+    pthread_attr_destroy( &attr );
 
-int32_t iothread_start( struct iothread * self, uint8_t index, uint32_t nclients, iothreads_t parent )
+    if ( rc != 0 ) {
+        iothread_stop( self );
+        return -3;
+    }
+
+    return 0;
+}
+
+int32_t iothread_embed( struct iothread * self, uint32_t nclients, iothreads_t parent )
 {
+    int32_t rc = _iothread_init( self, 0, -1, nclients, parent );
+    if ( rc != 0 ) {
+        return rc;
+    }
+
+    // 调用者的线程就是网络线程
+    self->id = pthread_self();
+    t_current_iothread = self;
+
+    return 0;
+}
+
+int32_t _iothread_init( struct iothread * self, uint8_t index, int32_t cpu, uint32_t nclients, iothreads_t parent )
+{
+    self->cpu = cpu;
     self->index = index;
     self->parent = parent;
-
-    self->manager = session_manager_create( index, nclients );
+    self->context = NULL;
+    atomic_init( &self->sleeping, 0 );
+    atomic_init( &self->nrejected, 0 );
+    atomic_init( &self->ndropped, 0 );
+    atomic_init( &self->nwaiters, 0 );
+    atomic_init( &self->nsessions, 0 );
+    atomic_init( &self->cpuload, 0 );
+    atomic_init( &self->loadstamp, 0 );
+    atomic_init( &self->nstolen, 0 );
+    atomic_init( &self->retired, 0 );
+
+    pthread_condattr_t attr;
+    pthread_condattr_init( &attr );
+    pthread_condattr_setclock( &attr, CLOCK_MONOTONIC );
+    pthread_cond_init( &self->spacecond, &attr );
+    pthread_condattr_destroy( &attr );
+    pthread_mutex_init( &self->spacelock, NULL );
+
+    evlock_init( &self->joblock );
+    QUEUE_INIT( taskqueue ) ( &self->jobs, JOBS_PER_ROUND * 2 );
+
+    self->manager = session_manager_create( self->index, nclients );
     if ( self->manager == NULL ) {
         iothread_stop( self );
     }
 
-    self->sets = evsets_create( ( (struct iothreads *)parent )->precision );
+    self->sets = evsets_create2(
+        ( (struct iothreads *)parent )->precision, ( (struct iothreads *)parent )->evflags );
     if ( self->sets == NULL ) {
         iothread_stop( self );
         return -1;
@@ -249,31 +617,51 @@ int32_t iothread_start( struct iothread * self, uint8_t index, uint32_t nclients
         iothread_stop( self );
         return -2;
     }
+    msgqueue_set_capacity( self->queue, ( (struct iothreads *)parent )->qcapacity );
 
     // 初始化命令事件
     event_set( self->cmdevent, msgqueue_popfd( self->queue ), EV_READ | EV_PERSIST );
     event_set_callback( self->cmdevent, iothread_on_command, self );
     evsets_add( self->sets, self->cmdevent, -1 );
+    evsets_set_sleepflag( (struct eventset *)self->sets, &self->sleeping );
 
-    // 启动线程
-    pthread_attr_t attr;
-    pthread_attr_init( &attr );
-    //    assert( pthread_attr_setstacksize( &attr, THREAD_DEFAULT_STACK_SIZE ) );
-    pthread_attr_setdetachstate( &attr, PTHREAD_CREATE_DETACHED );
+    return 0;
+}
 
-    int32_t rc = pthread_create( &( self->id ), &attr, iothread_main, self );
-    pthread_attr_destroy( &attr );
+int32_t iothread_post( struct iothread * self, int16_t type, int16_t utype, void * task, uint8_t size, int32_t flags )
+{
+    int32_t qflags = 0;
+    struct task inter_task = { .type = type, .utype = utype };
 
-    if ( rc != 0 ) {
-        iothread_stop( self );
-        return -3;
+    if ( size == 0 ) {
+        inter_task.taskdata = task;
+    } else {
+        memcpy( &( inter_task.data ), task, size );
+    }
+    if ( flags & IOTHREADS_POST_NOLIMIT ) {
+        qflags |= MSGQUEUE_NOLIMIT;
+    }
+    if ( flags & IOTHREADS_POST_DROPPABLE ) {
+        inter_task.flags |= eTaskFlag_Droppable;
     }
 
-    return 0;
+    // 默认: 提交任务不提醒消费者
+    int32_t rc = msgqueue_push( self->queue, &inter_task, qflags );
+    if ( unlikely( rc == IOTHREADS_EQUEUEFULL ) ) {
+        rc = _overflow( (struct iothreads *)self->parent, self, &inter_task, qflags );
+    }
+
+    if ( likely( rc == 0 ) ) {
+        _wakeup( self );
+    }
+
+    return rc;
 }
 
-int32_t iothread_post( struct iothread * self, int16_t type, int16_t utype, void * task, uint8_t size )
+int32_t iothread_submit( struct iothread * self, int16_t type, int16_t utype, void * task, uint8_t size )
 {
+    uint32_t njobs = 0;
+    struct iothreads * parent = (struct iothreads *)self->parent;
     struct task inter_task = { .type = type, .utype = utype };
 
     if ( size == 0 ) {
@@ -282,12 +670,174 @@ int32_t iothread_post( struct iothread * self, int16_t type, int16_t utype, void
         memcpy( &( inter_task.data ), task, size );
     }
 
-    // 默认: 提交任务不提醒消费者
-    return msgqueue_push( self->queue, &inter_task );
+    evlock_lock( &self->joblock );
+    int32_t rc = QUEUE_PUSH( taskqueue ) ( &self->jobs, &inter_task );
+    if ( likely( rc == 0 ) ) {
+        njobs = atomic_fetch_add( &self->njobs, 1 ) + 1;
+    }
+    evlock_unlock( &self->joblock );
+
+    if ( unlikely( rc != 0 ) ) {
+        return -1;
+    }
+
+    if ( self != t_current_iothread ) {
+        _wakeup( self );
+    }
+
+    // 任务积压时, 唤醒一个阻塞等待的网络线程来窃取
+    if ( njobs > 1 ) {
+        for ( uint8_t i = 1; i < parent->nthreads; ++i ) {
+            struct iothread * idle = parent->threads + ( self->index + i ) % parent->nthreads;
+            if ( atomic_load_explicit( &idle->sleeping, memory_order_relaxed ) ) {
+                _wakeup( idle );
+                break;
+            }
+        }
+    }
+
+    return 0;
+}
+
+int32_t iothread_posts( struct iothread * self,
+    int16_t type, int16_t utype, void * tasks, uint32_t count, uint8_t size, int32_t flags )
+{
+    int32_t qflags = 0;
+    uint32_t npushed = 0;
+
+    if ( count == 0 ) {
+        return 0;
+    }
+
+    struct task * list = (struct task *)malloc( count * sizeof( struct task ) );
+    if ( unlikely( list == NULL ) ) {
+        return -1;
+    }
+
+    for ( uint32_t i = 0; i < count; ++i ) {
+        list[i].type = type;
+        list[i].utype = utype;
+        list[i].flags = ( flags & IOTHREADS_POST_DROPPABLE ) ? eTaskFlag_Droppable : 0;
+        if ( size == 0 ) {
+            list[i].taskdata = ( (void **)tasks )[i];
+        } else {
+            memcpy( &( list[i].data ), (char *)tasks + (size_t)i * size, size );
+        }
+    }
+    if ( flags & IOTHREADS_POST_NOLIMIT ) {
+        qflags |= MSGQUEUE_NOLIMIT;
+    }
+
+    // 一次加锁提交整批任务, 剩余的任务按照队列满的策略逐个处理
+    npushed = msgqueue_pushs( self->queue, list, count, qflags );
+    for ( ; npushed < count; ++npushed ) {
+        if ( _overflow( (struct iothreads *)self->parent,
+                 self, &list[npushed], qflags ) != 0 ) {
+            break;
+        }
+    }
+    free( list );
+
+    if ( likely( npushed > 0 ) ) {
+        _wakeup( self );
+    }
+
+    return npushed;
+}
+
+uint32_t iothread_get_cpuload( struct iothread * self )
+{
+    uint32_t load = atomic_load_explicit( &self->cpuload, memory_order_relaxed );
+    int64_t elapsed = monotonic_microseconds()
+        - atomic_load_explicit( &self->loadstamp, memory_order_relaxed );
+
+    // 忙碌的网络线程每个采样间隔都会更新,
+    // 超过采样间隔没有更新说明一直阻塞等待, 这段时间按照空闲计算
+    if ( elapsed > LOAD_SAMPLE_INTERVAL ) {
+        load = (uint32_t)( (int64_t)load * LOAD_SAMPLE_INTERVAL / elapsed );
+    }
+
+    return load;
+}
+
+void _wakeup( struct iothread * thread )
+{
+    // 网络线程阻塞等待时才通知, 多个生产者只有一个会通知
+    // 和iothread_main()中的内存屏障配对, 保证不会丢失通知
+    atomic_thread_fence( memory_order_seq_cst );
+    if ( atomic_load_explicit( &thread->sleeping, memory_order_relaxed )
+        && atomic_exchange( &thread->sleeping, 0 ) ) {
+        msgqueue_notify( thread->queue );
+    }
+}
+
+int32_t _overflow( struct iothreads * parent, struct iothread * thread, struct task * task, int32_t flags )
+{
+    int32_t rc = IOTHREADS_EQUEUEFULL;
+
+    switch ( parent->qpolicy ) {
+        case IOTHREADS_QUEUE_BLOCK : {
+            // 网络线程向自己提交任务时不能等待
+            if ( parent->qtimeout > 0
+                && t_current_iothread != thread ) {
+                struct timespec deadline;
+                clock_gettime( CLOCK_MONOTONIC, &deadline );
+                deadline.tv_sec += parent->qtimeout / 1000;
+                deadline.tv_nsec += (long)( parent->qtimeout % 1000 ) * 1000000;
+                if ( deadline.tv_nsec >= 1000000000 ) {
+                    ++deadline.tv_sec;
+                    deadline.tv_nsec -= 1000000000;
+                }
+
+                // 先登记再重试, 和_process()中的内存屏障配对,
+                // 网络线程要么看到等待者, 要么重试时已经腾出了空间
+                atomic_fetch_add( &thread->nwaiters, 1 );
+                pthread_mutex_lock( &thread->spacelock );
+                // 批量提交时, 前面的任务可能还未通知网络线程
+                _wakeup( thread );
+                for ( ;; ) {
+                    rc = msgqueue_push( thread->queue, task, flags );
+                    if ( rc != IOTHREADS_EQUEUEFULL || parent->runflags != 1 ) {
+                        break;
+                    }
+                    if ( pthread_cond_timedwait( &thread->spacecond,
+                             &thread->spacelock, &deadline ) == ETIMEDOUT ) {
+                        rc = msgqueue_push( thread->queue, task, flags );
+                        break;
+                    }
+                }
+                pthread_mutex_unlock( &thread->spacelock );
+                atomic_fetch_sub( &thread->nwaiters, 1 );
+            }
+        } break;
+
+        case IOTHREADS_QUEUE_DROPOLDEST : {
+            struct task dropped;
+
+            // 只丢弃队首的可丢弃任务, 允许短暂地超出容量
+            if ( msgqueue_drop( thread->queue, &dropped ) == 1 ) {
+                atomic_fetch_add_explicit( &thread->ndropped, 1, memory_order_relaxed );
+                parent->dropper( parent->context, thread->index, dropped.utype,
+                    dropped.type == eTaskType_User ? dropped.taskdata : (void *)( dropped.data ) );
+                rc = msgqueue_push( thread->queue, task, flags | MSGQUEUE_NOLIMIT );
+            }
+        } break;
+    }
+
+    if ( rc == IOTHREADS_EQUEUEFULL ) {
+        atomic_fetch_add_explicit( &thread->nrejected, 1, memory_order_relaxed );
+    }
+
+    return rc;
 }
 
 int32_t iothread_stop( struct iothread * self )
 {
+    QUEUE_CLEAR( taskqueue ) ( &self->jobs );
+    evlock_destroy( &self->joblock );
+    pthread_cond_destroy( &self->spacecond );
+    pthread_mutex_destroy( &self->spacelock );
+
     if ( self->queue ) {
         msgqueue_destroy( self->queue );
         self->queue = NULL;
@@ -345,6 +895,15 @@ uint32_t _process( struct iothreads * parent, struct iothread * thread, struct t
     // 获取最大任务数
     nprocess = QUEUE_COUNT( taskqueue )( doqueue );
 
+    // 队列腾出了空间, 唤醒阻塞等待的生产者
+    atomic_thread_fence( memory_order_seq_cst );
+    if ( nprocess > 0
+        && atomic_load_explicit( &thread->nwaiters, memory_order_relaxed ) > 0 ) {
+        pthread_mutex_lock( &thread->spacelock );
+        pthread_cond_broadcast( &thread->spacecond );
+        pthread_mutex_unlock( &thread->spacelock );
+    }
+
     // 处理任务
     for ( ; QUEUE_COUNT( taskqueue )( doqueue ) > 0; ) {
         struct task task;
@@ -363,13 +922,116 @@ uint32_t _process( struct iothreads * parent, struct iothread * thread, struct t
     return nprocess;
 }
 
+uint32_t _runjobs( struct iothreads * parent, struct iothread * thread, struct iothread * victim, uint32_t max )
+{
+    uint32_t count = 0;
+    struct task tasks[JOBS_PER_ROUND];
+
+    if ( atomic_load_explicit( &victim->njobs, memory_order_relaxed ) == 0 ) {
+        return 0;
+    }
+
+    // 批量取出, 执行时不持有锁
+    evlock_lock( &victim->joblock );
+    for ( ; count < max && count < JOBS_PER_ROUND; ++count ) {
+        if ( QUEUE_POP( taskqueue ) ( &victim->jobs, &tasks[count] ) == 0 ) {
+            break;
+        }
+    }
+    atomic_fetch_sub( &victim->njobs, count );
+    evlock_unlock( &victim->joblock );
+
+    for ( uint32_t i = 0; i < count; ++i ) {
+        if ( tasks[i].type == eTaskType_User ) {
+            parent->processor( parent->context,
+                thread->index, tasks[i].utype, tasks[i].taskdata );
+        } else if ( tasks[i].type == eTaskType_Data ) {
+            parent->processor( parent->context,
+                thread->index, tasks[i].utype, (void *)( tasks[i].data ) );
+        }
+    }
+
+    return count;
+}
+
+uint32_t _execute( struct iothreads * parent, struct iothread * thread )
+{
+    // 优先执行本线程的任务
+    uint32_t count = _runjobs( parent, thread, thread, JOBS_PER_ROUND );
+    if ( count > 0 ) {
+        return count;
+    }
+
+    // 窃取其他网络线程一半的任务
+    for ( uint8_t i = 1; i < parent->nthreads; ++i ) {
+        struct iothread * victim = parent->threads + ( thread->index + i ) % parent->nthreads;
+        uint32_t njobs = atomic_load_explicit( &victim->njobs, memory_order_relaxed );
+
+        if ( njobs > 0 ) {
+            count = _runjobs( parent, thread, victim, ( njobs + 1 ) / 2 );
+            if ( count > 0 ) {
+                atomic_fetch_add_explicit( &thread->nstolen, count, memory_order_relaxed );
+                break;
+            }
+        }
+    }
+
+    return count;
+}
+
+int32_t _backlogged( struct iothreads * parent, struct iothread * thread )
+{
+    // 和iothread_submit()中唤醒的条件一致, 避免丢失唤醒
+    for ( uint8_t i = 1; i < parent->nthreads; ++i ) {
+        struct iothread * victim = parent->threads + ( thread->index + i ) % parent->nthreads;
+        if ( atomic_load_explicit( &victim->njobs, memory_order_relaxed ) > 1 ) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+void _sample_load( struct iothread * thread, int64_t * lastsample, int64_t * lastcputime )
+{
+    struct timespec ts;
+    int64_t now = monotonic_microseconds();
+
+    // 会话数每一轮都校正, 覆盖分配时预先计入的部分
+    atomic_store_explicit( &thread->nsessions,
+        session_manager_count( thread->manager ), memory_order_relaxed );
+
+    if ( now - *lastsample < LOAD_SAMPLE_INTERVAL
+        || clock_gettime( CLOCK_THREAD_CPUTIME_ID, &ts ) != 0 ) {
+        return;
+    }
+
+    // CPU占用率(千分比), 和上一次的结果平均
+    int64_t cputime = (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+    if ( *lastsample != 0 ) {
+        uint32_t load = (uint32_t)MIN( 1000, ( cputime - *lastcputime ) * 1000 / ( now - *lastsample ) );
+        uint32_t prev = iothread_get_cpuload( thread );
+        atomic_store_explicit( &thread->cpuload, ( prev + load ) / 2, memory_order_relaxed );
+    }
+    atomic_store_explicit( &thread->loadstamp, now, memory_order_relaxed );
+
+    *lastsample = now;
+    *lastcputime = cputime;
+}
+
 void * iothread_main( void * arg )
 {
     uint32_t maxtasks = 0;
+    uint32_t nexecute = 0;
+    int64_t lastbusy = 0;
+    int64_t lastsample = 0, lastcputime = 0;
 
     struct iothread * thread = (struct iothread *)arg;
     struct iothreads * parent = (struct iothreads *)( thread->parent );
 
+    // 标记当前线程, 用于判断是否可以直接执行
+    t_current_iothread = thread;
+
     sigset_t mask;
     sigfillset( &mask );
     pthread_sigmask( SIG_SETMASK, &mask, NULL );
@@ -379,25 +1041,65 @@ void * iothread_main( void * arg )
     QUEUE_INIT( taskqueue ) ( &doqueue, MSGQUEUE_DEFAULT_SIZE );
 
     for ( ; parent->runflags; ) {
+        int32_t nactive = 0;
         uint32_t nprocess = 0;
+        int32_t busypoll = parent->busypoll;
 
         // 轮询网络事件
-        evsets_dispatch( thread->sets );
+        // 忙轮询模式下, 最近一段时间内有事件或者任务时非阻塞轮询,
+        // 空闲超过busypoll微秒后退化为阻塞等待
+        if ( busypoll > 0
+            && monotonic_microseconds() - lastbusy < busypoll ) {
+            nactive = evsets_poll( thread->sets );
+        } else {
+            // 声明进入睡眠后再检查一次任务队列, 避免丢失通知
+            // 从等待中返回时, 由事件集清除睡眠标志
+            atomic_store_explicit( &thread->sleeping, 1, memory_order_relaxed );
+            atomic_thread_fence( memory_order_seq_cst );
+            // 还有未执行的任务, 上一轮窃取到了任务, 或者其他网络线程有积压的任务, 不能阻塞等待
+            if ( msgqueue_count( thread->queue ) > 0
+                || nexecute > 0
+                || atomic_load_explicit( &thread->njobs, memory_order_relaxed ) > 0
+                || _backlogged( parent, thread ) ) {
+                atomic_store_explicit( &thread->sleeping, 0, memory_order_relaxed );
+                nactive = evsets_poll( thread->sets );
+            } else {
+                nactive = evsets_dispatch( thread->sets );
+            }
+        }
 
         // 处理事件
         nprocess = _process( parent, thread, &doqueue );
+        // 执行(或者窃取)不绑定网络线程的任务
+        nexecute = _execute( parent, thread );
+        nprocess += nexecute;
+        if ( busypoll > 0
+            && ( nactive > 0 || nprocess > 0 ) ) {
+            lastbusy = monotonic_microseconds();
+        }
 
         // 最大任务数
         maxtasks = MAX( maxtasks, nprocess );
+
+        // 负载
+        _sample_load( thread, &lastsample, &lastcputime );
     }
 
     // 清理队列中剩余数据
     _process( parent, thread, &doqueue );
+    while ( _runjobs( parent, thread, thread, JOBS_PER_ROUND ) > 0 ) {}
     // 清空队列
     QUEUE_CLEAR( taskqueue ) ( &doqueue );
 
     // 日志
     syslog( LOG_INFO, "%s(INDEX=%d) : the Maximum Number of Requests is %d in EachFrame .", __FUNCTION__, thread->index, maxtasks );
+    uint64_t ctlcalls = 0, ctlsaved = 0;
+    evsets_get_ctlstats( thread->sets, &ctlcalls, &ctlsaved );
+    syslog( LOG_INFO, "%s(INDEX=%d) : the Number of epoll_ctl() is %llu, Saved %llu .", __FUNCTION__, thread->index, (unsigned long long)ctlcalls, (unsigned long long)ctlsaved );
+    syslog( LOG_INFO, "%s(INDEX=%d) : the Number of Tasks Rejected is %llu, Dropped %llu .", __FUNCTION__, thread->index,
+        (unsigned long long)atomic_load( &thread->nrejected ), (unsigned long long)atomic_load( &thread->ndropped ) );
+    syslog( LOG_INFO, "%s(INDEX=%d) : the Number of Jobs Stolen is %llu .", __FUNCTION__, thread->index,
+        (unsigned long long)atomic_load( &thread->nstolen ) );
 
     // 向主线程发送终止信号
     pthread_mutex_lock( &parent->lock );
@@ -423,3 +1125,8 @@ void iothread_on_command( int32_t fd, int16_t ev, void * arg )
         }
     }
 }
+
+void _on_polltimeout( int32_t fd, int16_t ev, void * arg )
+{
+    ( (struct iothreads *)arg )->timedout = 1;
+}
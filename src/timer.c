@@ -1,11 +1,71 @@
-
 #include <stdio.h>
 #include <syslog.h>
 #include <stdlib.h>
 
 #include "event-internal.h"
 
-struct evtimer * evtimer_create( int32_t max_precision, int32_t bucket_count )
+//
+// 分层时间轮(参考Linux内核的tvec_base)
+//
+// 第一层256个桶, 每个桶对应一个时钟周期;
+// 其余四层各64个桶, 每个桶覆盖下一层的一整圈
+// 高层的桶在低层转完一圈时, 整体降级(cascade)到低层
+// 所以每个事件在超时之前最多被移动TIMER_LEVEL_COUNT次
+//
+
+static inline void _evtimer_insert( struct evtimer * self, struct event * ev );
+static inline int32_t _evtimer_cascade( struct evtimer * self, int32_t level, uint32_t index );
+
+// 第level层(1~TIMER_LEVEL_COUNT)中桶的索引号
+#define EVTIMER_LEVEL_INDEX( level, expires ) \
+    ( ( ( expires ) >> ( TIMER_WHEEL_BITS + ( ( level ) - 1 ) * TIMER_LEVEL_BITS ) ) & ( TIMER_LEVEL_SIZE - 1 ) )
+#define EVTIMER_LEVEL_BUCKET( level, index ) \
+    ( TIMER_WHEEL_SIZE + ( ( level ) - 1 ) * TIMER_LEVEL_SIZE + ( index ) )
+
+void _evtimer_insert( struct evtimer * self, struct event * ev )
+{
+    int32_t index = 0;
+    uint32_t expires = ev->timer_expires;
+    uint32_t ticks = expires - self->dispatch_refer;
+
+    if ( ticks < TIMER_WHEEL_SIZE ) {
+        index = expires & ( TIMER_WHEEL_SIZE - 1 );
+    } else if ( ticks < 1U << ( TIMER_WHEEL_BITS + TIMER_LEVEL_BITS ) ) {
+        index = EVTIMER_LEVEL_BUCKET( 1, EVTIMER_LEVEL_INDEX( 1, expires ) );
+    } else if ( ticks < 1U << ( TIMER_WHEEL_BITS + 2 * TIMER_LEVEL_BITS ) ) {
+        index = EVTIMER_LEVEL_BUCKET( 2, EVTIMER_LEVEL_INDEX( 2, expires ) );
+    } else if ( ticks < 1U << ( TIMER_WHEEL_BITS + 3 * TIMER_LEVEL_BITS ) ) {
+        index = EVTIMER_LEVEL_BUCKET( 3, EVTIMER_LEVEL_INDEX( 3, expires ) );
+    } else if ( (int32_t)ticks < 0 ) {
+        // 已经过期了, 在下一个时钟周期触发
+        index = self->dispatch_refer & ( TIMER_WHEEL_SIZE - 1 );
+    } else {
+        index = EVTIMER_LEVEL_BUCKET( 4, EVTIMER_LEVEL_INDEX( 4, expires ) );
+    }
+
+    ev->timer_index = index;
+    TAILQ_INSERT_TAIL( &( self->bucket_array[index] ), ev, timerlink );
+}
+
+int32_t _evtimer_cascade( struct evtimer * self, int32_t level, uint32_t index )
+{
+    struct event * ev = NULL;
+    struct event_list list;
+    struct event_list * head = &( self->bucket_array[EVTIMER_LEVEL_BUCKET( level, index )] );
+
+    // 整个桶降级到低层
+    TAILQ_INIT( &list );
+    TAILQ_CONCAT( &list, head, timerlink );
+
+    for ( ev = TAILQ_FIRST( &list ); ev; ev = TAILQ_FIRST( &list ) ) {
+        TAILQ_REMOVE( &list, ev, timerlink );
+        _evtimer_insert( self, ev );
+    }
+
+    return index;
+}
+
+struct evtimer * evtimer_create( int32_t max_precision )
 {
     struct evtimer * t = NULL;
 
@@ -13,16 +73,15 @@ struct evtimer * evtimer_create( int32_t max_precision, int32_t bucket_count )
     if ( t ) {
         t->event_count = 0;
         t->dispatch_refer = 0;
-        t->bucket_count = bucket_count;
         t->max_precision = max_precision;
 
         t->bucket_array = (struct event_list *)calloc(
-            bucket_count, sizeof( struct event_list ) );
+            TIMER_BUCKET_COUNT, sizeof( struct event_list ) );
         if ( t->bucket_array == NULL ) {
             free( t );
             t = NULL;
         } else {
-            for ( int32_t i = 0; i < bucket_count; ++i ) {
+            for ( int32_t i = 0; i < TIMER_BUCKET_COUNT; ++i ) {
                 TAILQ_INIT( &( t->bucket_array[i] ) );
             }
         }
@@ -33,30 +92,23 @@ struct evtimer * evtimer_create( int32_t max_precision, int32_t bucket_count )
 
 int32_t evtimer_append( struct evtimer * self, struct event * ev )
 {
-    int32_t tv = EVENT_TIMEOUT( ev );
-    int32_t index = self->dispatch_refer - 1;
+    int64_t tv = EVENT_TIMEOUT( ev );
 
     if ( tv < 0 ) {
         return -1;
     }
 
-    // tv至少比self->max_precision大
+    // 毫秒转换成微秒, tv至少比self->max_precision大
+    tv *= 1000;
     tv = tv < self->max_precision ? self->max_precision : tv;
+    tv /= self->max_precision;
+    tv = tv > INT32_MAX ? INT32_MAX : tv;
 
-    // 把桶的索引号写入事件句柄中, 便于查找以及删除
-    // 如果定时器超时时间过长, 设定其定时器周期数
-    index += tv / self->max_precision;
-    index = EVTIMER_INDEX( self, index );
-
-    //
-    ev->timer_index = index;
-    ev->timer_stepcnt = tv / ( self->max_precision * self->bucket_count );
-    if ( tv % ( self->max_precision * self->bucket_count ) != 0 ) {
-        ev->timer_stepcnt += 1;
-    }
+    // 超时的时钟周期, 和dispatch_refer对应的桶在下一次分发时处理
+    ev->timer_expires = self->dispatch_refer - 1 + (uint32_t)tv;
 
     ++self->event_count;
-    TAILQ_INSERT_TAIL( &( self->bucket_array[index] ), ev, timerlink );
+    _evtimer_insert( self, ev );
 
     return 0;
 }
@@ -66,12 +118,12 @@ int32_t evtimer_remove( struct evtimer * self, struct event * ev )
     // 根据句柄中的索引号, 快速定位桶
     int32_t index = EVENT_TIMERINDEX( ev );
 
-    if ( index < 0 || index >= self->bucket_count ) {
+    if ( index < 0 || index >= TIMER_BUCKET_COUNT ) {
         return -1;
     }
 
     ev->timer_index = -1;
-    ev->timer_stepcnt = -1;
+    ev->timer_expires = 0;
 
     --self->event_count;
     TAILQ_REMOVE( &( self->bucket_array[index] ), ev, timerlink );
@@ -81,59 +133,86 @@ int32_t evtimer_remove( struct evtimer * self, struct event * ev )
 
 int32_t evtimer_dispatch( struct evtimer * self )
 {
-    int32_t index = 0;
-    int32_t rc = 0, done = 0;
-
-    struct event * laster = NULL;
+    int32_t rc = 0;
     struct event_list * head = NULL;
+    uint32_t index = self->dispatch_refer & ( TIMER_WHEEL_SIZE - 1 );
+
+    // 第一层转完一圈, 逐层降级
+    if ( index == 0 ) {
+        for ( int32_t level = 1; level <= TIMER_LEVEL_COUNT; ++level ) {
+            if ( _evtimer_cascade( self, level,
+                     EVTIMER_LEVEL_INDEX( level, self->dispatch_refer ) ) != 0 ) {
+                break;
+            }
+        }
+    }
+
+    ++self->dispatch_refer;
+    head = &( self->bucket_array[index] );
+
+    // 桶中的事件全部超时
+    for ( ; !TAILQ_EMPTY( head ); ) {
+        struct event * ev = TAILQ_FIRST( head );
 
-    index = self->dispatch_refer++;
-    head = &( self->bucket_array[EVTIMER_INDEX( self, index )] );
+        // 删除事件
+        evtimer_remove( self, ev );
+        ev->status &= ~EVSTATUS_TIMER;
 
-    // 该桶中没有定时的事件
-    if ( TAILQ_EMPTY( head ) ) {
-        return 0;
+        // 超时了,
+        // 从队列中删除, 并添加到激活队列中
+        ++rc;
+        event_active( ev, EV_TIMEOUT );
     }
 
-    // 遍历超时事件链表
-    laster = TAILQ_LAST( head, event_list );
-    for ( ; !done; ) {
-        int32_t step = 0;
-        struct event * ev = TAILQ_FIRST( head );
+    return rc;
+}
 
-        // 由于某些事件的超时时间过长
-        // 所以还是需要继续添加到事件链表中的
-        // 必须判断当前节点是否是链表的尾部元素
-        if ( ev == laster ) {
-            done = 1;
+int32_t evtimer_next( struct evtimer * self )
+{
+    uint32_t i = 0, ticks = 0;
+    uint32_t refer = self->dispatch_refer;
+
+    if ( self->event_count == 0 ) {
+        return -1;
+    }
+
+    // 高层非空时, 第一层转完一圈需要降级, 最多等到下一圈的起点
+    ticks = ( TIMER_WHEEL_SIZE - ( refer & ( TIMER_WHEEL_SIZE - 1 ) ) ) & ( TIMER_WHEEL_SIZE - 1 );
+    for ( i = TIMER_WHEEL_SIZE; i < TIMER_BUCKET_COUNT; ++i ) {
+        if ( !TAILQ_EMPTY( &( self->bucket_array[i] ) ) ) {
+            break;
         }
+    }
+    if ( i == TIMER_BUCKET_COUNT ) {
+        ticks = TIMER_WHEEL_SIZE;
+    }
 
-        // 获取步长
-        --ev->timer_stepcnt;
-        step = EVENT_TIMERSTEP( ev );
+    // 第一层中最近的非空桶
+    for ( i = 0; i < ticks; ++i ) {
+        if ( !TAILQ_EMPTY( &( self->bucket_array[( refer + i ) & ( TIMER_WHEEL_SIZE - 1 )] ) ) ) {
+            break;
+        }
+    }
 
-        if ( step > 0 ) {
-            // 未超时
-            TAILQ_REMOVE( head, ev, timerlink );
-            TAILQ_INSERT_TAIL( head, ev, timerlink );
-        } else {
-            // 超时 or 出错
-
-            // 删除事件
-            evtimer_remove( self, ev );
-            ev->status &= ~EVSTATUS_TIMER;
-
-            // 超时了,
-            // 从队列中删除, 并添加到激活队列中
-            if ( step == 0 ) {
-                // 计数器
-                ++rc;
-                event_active( ev, EV_TIMEOUT );
-            } else {
-                // 出错, 暂且记日志吧
-                syslog( LOG_WARNING, "%s() evtimer dispatch error <%p>", __FUNCTION__, ev );
-            }
+    return (int32_t)i;
+}
+
+int32_t evtimer_advance( struct evtimer * self, uint32_t ticks )
+{
+    int32_t rc = 0;
+
+    for ( ; ticks > 0; ) {
+        int32_t next = evtimer_next( self );
+
+        // 中间的时钟周期没有需要处理的桶, 直接跳过
+        if ( next < 0 || (uint32_t)next >= ticks ) {
+            self->dispatch_refer += ticks;
+            break;
         }
+
+        ticks -= next + 1;
+        self->dispatch_refer += next;
+        rc += evtimer_dispatch( self );
     }
 
     return rc;
@@ -148,7 +227,7 @@ int32_t evtimer_clean( struct evtimer * self )
 {
     int32_t rc = 0;
 
-    for ( int32_t i = 0; i < self->bucket_count; ++i ) {
+    for ( int32_t i = 0; i < TIMER_BUCKET_COUNT; ++i ) {
         struct event * ev = NULL;
         struct event_list * head = &( self->bucket_array[i] );
 
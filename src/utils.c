@@ -7,6 +7,7 @@
 #include <string.h>
 #include <errno.h>
 #include <syslog.h>
+#include <time.h>
 
 #include <sys/un.h>
 #include <sys/time.h>
@@ -92,6 +93,18 @@ int64_t microseconds()
     return now;
 }
 
+int64_t monotonic_microseconds()
+{
+    int64_t now = -1;
+    struct timespec ts;
+
+    if ( clock_gettime( CLOCK_MONOTONIC, &ts ) == 0 ) {
+        now = ts.tv_sec * 1000000ll + ts.tv_nsec / 1000ll;
+    }
+
+    return now;
+}
+
 int32_t is_ipv6only( int32_t fd )
 {
     int yes = 1;
@@ -146,6 +159,44 @@ int32_t set_non_block( int32_t fd )
     return rc;
 }
 
+int32_t set_busypoll( int32_t fd, int32_t usecs )
+{
+    int32_t rc = -1;
+
+#if defined SO_BUSY_POLL
+    // 超过net.core.busy_read需要CAP_NET_ADMIN权限
+    rc = setsockopt( fd, SOL_SOCKET, SO_BUSY_POLL, (void *)&usecs, sizeof( usecs ) ) == 0 ? 0 : -2;
+#if defined SO_PREFER_BUSY_POLL
+    if ( rc == 0 ) {
+        int32_t flag = 1;
+        setsockopt( fd, SOL_SOCKET, SO_PREFER_BUSY_POLL, (void *)&flag, sizeof( flag ) );
+    }
+#endif
+#endif
+
+    return rc;
+}
+
+int32_t set_zerocopy( int32_t fd )
+{
+    int32_t rc = -1;
+
+#if defined SO_ZEROCOPY
+    // Linux 4.14以上的TCP套接字, 开启后sendmsg()才能使用MSG_ZEROCOPY
+    int32_t flag = 1;
+    rc = setsockopt( fd, SOL_SOCKET, SO_ZEROCOPY, (void *)&flag, sizeof( flag ) ) == 0 ? 0 : -2;
+#endif
+
+    return rc;
+}
+
+int32_t set_abortive( int32_t fd )
+{
+    // 关闭描述符时发送RST, 内核丢弃发送队列中还没有发送的数据
+    struct linger l = { 1, 0 };
+    return setsockopt( fd, SOL_SOCKET, SO_LINGER, (void *)&l, sizeof( l ) ) == 0 ? 0 : -1;
+}
+
 int32_t unix_connect( const char * path, int32_t ( *options )( int32_t ) )
 {
     int32_t fd = socket( AF_UNIX, SOCK_STREAM, 0 );
@@ -39,6 +39,9 @@ void msleep( int32_t mseconds );
 int64_t milliseconds();
 int64_t microseconds();
 
+// 单调时钟, 返回微妙数(不受系统时间调整的影响)
+int64_t monotonic_microseconds();
+
 // 获取线程ID
 #if defined EVENT_OS_LINUX
 pid_t threadid();
@@ -49,6 +52,9 @@ int32_t is_ipv6only( int32_t fd );
 int32_t is_connected( int32_t fd );
 int32_t set_cloexec( int32_t fd );
 int32_t set_non_block( int32_t fd );
+int32_t set_busypoll( int32_t fd, int32_t usecs );
+int32_t set_zerocopy( int32_t fd );
+int32_t set_abortive( int32_t fd );
 int32_t unix_connect( const char * path, int32_t ( *options )( int32_t ) );
 int32_t unix_listen( const char * path, int32_t ( *options )( int32_t ) );
 int32_t tcp_accept( int32_t fd, char * remotehost, uint16_t * remoteport );
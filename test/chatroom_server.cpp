@@ -2,6 +2,7 @@
 #include <deque>
 #include <vector>
 #include <set>
+#include <map>
 #include <algorithm>
 
 #include <stdio.h>
@@ -60,7 +61,9 @@ private:
 class ChatRoomService : public IIOService
 {
 public:
-    ChatRoomService( uint8_t nthreads, uint32_t nclients );
+    // rooms > 0 : 按照房间广播, 使用网络层的广播组
+    // rooms < 0 : 按照房间广播, 每次广播指定房间的会话列表
+    ChatRoomService( uint8_t nthreads, uint32_t nclients, int32_t rooms );
     virtual ~ChatRoomService();
 
 public:
@@ -82,6 +85,9 @@ private:
 
     uint32_t m_UniqueID;
     bool m_Perform;
+    int32_t m_Rooms;
+    std::map<sid_t, uint32_t> m_RoomMap;
+    std::vector<sids_t> m_RoomMembers;
     pthread_cond_t m_TaskCond;
     pthread_mutex_t m_TaskLock;
     std::deque<Task> m_TaskQueue;
@@ -143,10 +149,12 @@ int32_t ChatRoomSession::onPerform( int32_t type, void * task, int32_t interval
     return 0;
 }
 
-ChatRoomService::ChatRoomService( uint8_t nthreads, uint32_t nclients )
+ChatRoomService::ChatRoomService( uint8_t nthreads, uint32_t nclients, int32_t rooms )
     : IIOService( nthreads, nclients ),
       m_UniqueID( 0 ),
-      m_Perform( false )
+      m_Perform( false ),
+      m_Rooms( rooms ),
+      m_RoomMembers( rooms < 0 ? -rooms : 0 )
 {
     pthread_cond_init( &m_TaskCond, nullptr );
     pthread_mutex_init( &m_TaskLock, nullptr );
@@ -193,6 +201,15 @@ void ChatRoomService::run( int32_t seconds )
         switch ( task.msgid ) {
             case 0 : {
                 m_SessionMap.insert( task.sid );
+                if ( m_Rooms != 0 ) {
+                    uint32_t room = m_UniqueID++ % ( m_Rooms > 0 ? m_Rooms : -m_Rooms );
+                    m_RoomMap[task.sid] = room;
+                    if ( m_Rooms > 0 ) {
+                        join( room + 1, task.sid );
+                    } else {
+                        m_RoomMembers[room].push_back( task.sid );
+                    }
+                }
             } break;
 
             case 1 : {
@@ -214,12 +231,30 @@ void ChatRoomService::run( int32_t seconds )
                 head->length = length;
                 memcpy( head + 1, task.message, task.length );
                 buffer.resize( length );
-                broadcast( buffer );
+                auto it = m_RoomMap.find( task.sid );
+                if ( m_Rooms == 0 ) {
+                    broadcast( buffer );
+                } else if ( it != m_RoomMap.end() ) {
+                    if ( m_Rooms > 0 ) {
+                        publish( it->second + 1, buffer );
+                    } else {
+                        broadcast( m_RoomMembers[it->second], buffer );
+                    }
+                }
                 free( task.message );
             } break;
 
             case 3 : {
                 m_SessionMap.erase( task.sid );
+                auto it = m_RoomMap.find( task.sid );
+                if ( it != m_RoomMap.end() ) {
+                    // 广播组在会话终止时自动离开
+                    if ( m_Rooms < 0 ) {
+                        sids_t & members = m_RoomMembers[it->second];
+                        members.erase( std::find( members.begin(), members.end(), task.sid ) );
+                    }
+                    m_RoomMap.erase( it );
+                }
             } break;
         }
     }
@@ -273,8 +308,10 @@ void signal_handle( int32_t signo )
 
 int main( int argc, char ** argv )
 {
-    if ( argc != 5 ) {
-        printf( "chatroom_server [host] [port] [threads] [clients] \n" );
+    if ( argc != 5 && argc != 6 ) {
+        printf( "chatroom_server [host] [port] [threads] [clients] [rooms] \n" );
+        printf( "\trooms > 0 : broadcast to the room with iolayer_broadcast_group() \n" );
+        printf( "\trooms < 0 : broadcast to the room with iolayer_broadcast() \n" );
         return -1;
     }
 
@@ -282,11 +319,12 @@ int main( int argc, char ** argv )
     uint16_t port = atoi( argv[2] );
     uint8_t nthreads = atoi( argv[3] );
     uint32_t nclients = atoi( argv[4] );
+    int32_t rooms = argc == 6 ? atoi( argv[5] ) : 0;
 
     signal( SIGPIPE, SIG_IGN );
     signal( SIGINT, signal_handle );
 
-    ChatRoomService service( nthreads, nclients );
+    ChatRoomService service( nthreads, nclients, rooms );
 
     if ( !service.init( host, port ) ) {
         return -2;
@@ -7,10 +7,13 @@
 #include <string.h>
 #include <assert.h>
 #include <time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
 
 #include "network.h"
 
-#define __DEBUG__
 #define METHOD        1
 
 struct session
@@ -151,11 +154,97 @@ void signal_handle( int32_t signo )
     g_Running = 0;
 }
 
+int64_t rtt_nanoseconds()
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec * 1000000000ll + ts.tv_nsec;
+}
+
+int32_t rtt_compare( const void * a, const void * b )
+{
+    int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+    return x < y ? -1 : ( x > y ? 1 : 0 );
+}
+
+//
+// 测量TCP回环的往返时延(RTT)
+// 发送msgsize字节后等待服务器回显, 重复rounds次, 输出平均值, p50和p99
+//
+int32_t rtt_client( const char * host, uint16_t port, int32_t rounds, int32_t msgsize )
+{
+    int32_t i = 0, flag = 1;
+    int64_t total = 0;
+    char * buf = malloc( msgsize );
+    int64_t * samples = malloc( rounds * sizeof(int64_t) );
+
+    struct sockaddr_in addr;
+    memset( &addr, 0, sizeof(addr) );
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons( port );
+    addr.sin_addr.s_addr = inet_addr( host );
+
+    int32_t fd = socket( AF_INET, SOCK_STREAM, 0 );
+    if ( fd < 0 || connect( fd, (struct sockaddr *)&addr, sizeof(addr) ) != 0 )
+    {
+        printf( "connect %s::%d failed .\n", host, port );
+        return -1;
+    }
+    setsockopt( fd, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag) );
+    memset( buf, 'p', msgsize );
+
+    for ( i = 0; i < rounds; ++i )
+    {
+        int32_t nread = 0;
+        int64_t start = rtt_nanoseconds();
+
+        if ( write( fd, buf, msgsize ) != msgsize )
+        {
+            break;
+        }
+        while ( nread < msgsize )
+        {
+            ssize_t n = read( fd, buf + nread, msgsize - nread );
+            if ( n <= 0 )
+            {
+                break;
+            }
+            nread += n;
+        }
+        if ( nread != msgsize )
+        {
+            break;
+        }
+
+        samples[i] = rtt_nanoseconds() - start;
+        total += samples[i];
+    }
+
+    if ( i > 0 )
+    {
+        qsort( samples, i, sizeof(int64_t), rtt_compare );
+        printf( "RTT(%d bytes, %d rounds) : avg %.1fus, p50 %.1fus, p99 %.1fus\n",
+            msgsize, i, total / 1000.0 / i, samples[i / 2] / 1000.0, samples[i * 99 / 100] / 1000.0 );
+    }
+
+    close( fd );
+    free( buf );
+    free( samples );
+    return i == rounds ? 0 : -2;
+}
+
 int main( int32_t argc, char ** argv )
 {
-    if ( argc != 5 )
+    if ( argc >= 4 && strcmp( argv[1], "rtt" ) == 0 )
+    {
+        return rtt_client( argv[2], atoi(argv[3]),
+            argc > 4 ? atoi(argv[4]) : 20000, argc > 5 ? atoi(argv[5]) : 64 );
+    }
+
+    if ( argc != 5 && argc != 6 )
     {
-        printf("pingpong [type] [host] [port] [threads] \n");
+        printf("pingpong [type] [host] [port] [threads] [busypoll(usecs)] \n");
+        printf("pingpong rtt [host] [port] [rounds] [msgsize] \n");
         return -1;
     }
 
@@ -163,11 +252,12 @@ int main( int32_t argc, char ** argv )
     char * host = argv[2];
     uint16_t port = atoi(argv[3]);
     uint8_t nthreads = atoi(argv[4]);
+    ioconfig_t config = { .busypoll = argc == 6 ? atoi(argv[5]) : 0 };
 
     signal( SIGPIPE, SIG_IGN );
     signal( SIGINT, signal_handle );
 
-    iolayer_t layer = iolayer_create( nthreads, 500, 8 );
+    iolayer_t layer = iolayer_create2( nthreads, 500, 8, &config );
     if ( layer == NULL )
     {
         return -2;
@@ -16,12 +16,56 @@
 #include <time.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <unistd.h>
 #include <sys/time.h>
 
 #include "event.h"
 
 #define NTEST   1000000
 
+// 漂移测试: 周期定时器, 以及阻塞的慢回调
+#define DRIFT_PERIOD    48
+#define DRIFT_ROUNDS    40
+#define SLOW_PERIOD     8
+#define SLOW_COST       15
+// 定时器和系统调用的舍入误差(微秒), 调度的误差另外测量
+#define DRIFT_SLACK     4000
+
+struct drift
+{
+    event_t     ev;
+    int32_t     rounds;
+    int64_t     added;      // 添加定时器的时间
+    int64_t     maxdrift;   // 最大偏差
+    int64_t     totaldrift; // 累计偏差
+};
+
+int64_t monotonic_usecs()
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec * 1000000ll + ts.tv_nsec / 1000;
+}
+
+// 进程在就绪队列中等待调度的累计时间(微秒), 不支持时返回0
+int64_t rundelay_usecs()
+{
+    long long runtime = 0, rundelay = 0;
+    FILE * fp = fopen( "/proc/self/schedstat", "r" );
+
+    if ( fp == NULL )
+    {
+        return 0;
+    }
+    if ( fscanf( fp, "%lld %lld", &runtime, &rundelay ) != 2 )
+    {
+        rundelay = 0;
+    }
+    fclose( fp );
+
+    return rundelay / 1000;
+}
+
 void ev_callback( int32_t fd, int16_t ev, void * arg )
 {}
 
@@ -105,6 +149,136 @@ int32_t test_operate_timer()
     return 0;
 }
 
+void ev_drift_callback( int32_t fd, int16_t ev, void * arg )
+{
+    struct drift * d = (struct drift *)arg;
+    int64_t now = monotonic_usecs();
+
+    // 实际触发时间和理论触发时间的偏差
+    int64_t drift = now - ( d->added + DRIFT_PERIOD * 1000 );
+    drift = drift < 0 ? -drift : drift;
+    d->totaldrift += drift;
+    if ( drift > d->maxdrift )
+    {
+        d->maxdrift = drift;
+    }
+
+    if ( ++d->rounds < DRIFT_ROUNDS )
+    {
+        d->added = monotonic_usecs();
+        evsets_add( event_get_sets( d->ev ), d->ev, DRIFT_PERIOD );
+    }
+}
+
+void ev_slow_callback( int32_t fd, int16_t ev, void * arg )
+{
+    event_t e = (event_t)arg;
+
+    // 模拟很慢的回调
+    usleep( SLOW_COST * 1000 );
+    evsets_add( event_get_sets( e ), e, SLOW_PERIOD );
+}
+
+//
+// 定时器按照时钟周期追赶经过的时间, 偏差不会累积:
+// 平均偏差不超过2个时钟周期;
+// 慢回调时, 慢定时器相对时间轮重新添加, 可能连续触发两次, 再加上两次慢回调的耗时;
+// 进程等待调度的时间按轮次平摊到上限中, 最大偏差受调度影响, 只输出不检查
+//
+int32_t test_drift( const char * name, int32_t precision, int32_t flags, int32_t slow )
+{
+    int64_t limit = 0, avgdrift = 0, rundelay = 0;
+    evsets_t sets = NULL;
+    event_t ev_slow = NULL;
+    struct drift d = { NULL, 0, 0, 0, 0 };
+
+    sets = evsets_create2( precision, flags );
+
+    d.ev = event_create();
+    event_set( d.ev, -1, 0 );
+    event_set_callback( d.ev, ev_drift_callback, &d );
+    rundelay = rundelay_usecs();
+    d.added = monotonic_usecs();
+    evsets_add( sets, d.ev, DRIFT_PERIOD );
+
+    if ( slow )
+    {
+        ev_slow = event_create();
+        event_set( ev_slow, -1, 0 );
+        event_set_callback( ev_slow, ev_slow_callback, ev_slow );
+        evsets_add( sets, ev_slow, SLOW_PERIOD );
+    }
+
+    while ( d.rounds < DRIFT_ROUNDS )
+    {
+        evsets_dispatch( sets );
+    }
+
+    rundelay = rundelay_usecs() - rundelay;
+    avgdrift = d.totaldrift / DRIFT_ROUNDS;
+
+    printf("test_drift(%s, slow:%dms) : period %dms, rounds %d, max drift %ld usecs, avg drift %ld usecs, run delay %ld usecs .\n",
+        name, slow ? SLOW_COST : 0, DRIFT_PERIOD, DRIFT_ROUNDS, d.maxdrift, avgdrift, rundelay );
+
+    limit = 2 * ( ( flags & EVSETS_HIGHRES ) ? precision : precision * 1000 ) + DRIFT_SLACK + rundelay / DRIFT_ROUNDS;
+    if ( slow )
+    {
+        limit += 2 * SLOW_COST * 1000;
+    }
+    if ( avgdrift > limit )
+    {
+        printf("test_drift(%s) : avg drift %ld usecs exceeds %ld usecs, FAILED .\n", name, avgdrift, limit );
+        exit( -1 );
+    }
+
+    evsets_destroy( sets );
+    event_destroy( d.ev );
+    if ( ev_slow != NULL )
+    {
+        event_destroy( ev_slow );
+    }
+
+    return 0;
+}
+
+void ev_idle_callback( int32_t fd, int16_t ev, void * arg )
+{
+    *(int32_t *)arg = 1;
+}
+
+//
+// 高精度模式下空闲时不按时钟周期唤醒:
+// 等待一个200ms的定时器, 分发的次数应该远小于时钟周期数(800)
+//
+int32_t test_idle()
+{
+    int32_t fired = 0, ndispatch = 0;
+    evsets_t sets = evsets_create2( 250, EVSETS_HIGHRES );
+    event_t ev = event_create();
+
+    event_set( ev, -1, 0 );
+    event_set_callback( ev, ev_idle_callback, &fired );
+    evsets_add( sets, ev, 200 );
+
+    while ( !fired )
+    {
+        evsets_dispatch( sets );
+        ++ndispatch;
+    }
+
+    printf("test_idle(highres-250us) : timer 200ms, dispatch %d times .\n", ndispatch );
+    if ( ndispatch > 10 )
+    {
+        printf("test_idle(highres-250us) : the eventsets wakes up every tick, FAILED .\n" );
+        exit( -1 );
+    }
+
+    event_destroy( ev );
+    evsets_destroy( sets );
+
+    return 0;
+}
+
 int32_t test_evtimer()
 {
     evsets_t sets = NULL;
@@ -132,6 +306,13 @@ int32_t test_evtimer()
 int main()
 {
     test_operate_timer();
+
+    test_drift( "8ms", 8, 0, 0 );
+    test_drift( "8ms", 8, 0, 1 );
+    test_drift( "highres-250us", 250, EVSETS_HIGHRES, 0 );
+    test_drift( "highres-250us", 250, EVSETS_HIGHRES, 1 );
+    test_idle();
+
     test_evtimer();
 
     return 0;
@@ -10,6 +10,7 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/queue.h>
+#include <sys/socket.h>
 #include <unistd.h>
 #include <sys/time.h>
 
@@ -51,9 +52,98 @@ void fifo_read( int32_t fd, int16_t ev, void * arg )
     printf("Read: %s\n", buf);
 }
 
-int32_t main()
+void reuse_read( int32_t fd, int16_t ev, void * arg )
+{
+    char buf[16];
+
+    if ( read( fd, buf, sizeof(buf) ) > 0 )
+    {
+        *(int32_t *)arg = fd;
+    }
+}
+
+// 删除事件并关闭描述符, 在下一次dispatch之前重新打开相同的描述符号
+// 新的描述符必须能收到事件, 旧的描述符必须真正关闭(对端收到EOF)
+int32_t test_reuse( int32_t flags )
+{
+    int32_t i, rc = 0;
+    int32_t readfd = -1;
+    int32_t oldpair[2], newpair[2];
+    char c = 'x';
+
+    evsets_t evsets = evsets_create2( 8, flags );
+    event_t ev = event_create();
+    if ( evsets == NULL || ev == NULL )
+    {
+        printf("evsets_create() error .\n");
+        return -1;
+    }
+
+    socketpair( AF_UNIX, SOCK_STREAM, 0, oldpair );
+    event_set( ev, oldpair[0], EV_READ|EV_PERSIST );
+    event_set_callback( ev, reuse_read, &readfd );
+    evsets_add( evsets, ev, -1 );
+
+    // 第一次dispatch之后poll请求已经提交给内核
+    write( oldpair[1], &c, 1 );
+    for ( i = 0; i < 100 && readfd != oldpair[0]; ++i )
+    {
+        evsets_poll( evsets );
+        usleep( 1000 );
+    }
+    if ( readfd != oldpair[0] )
+    {
+        printf("reuse: the old descriptor isn't readable .\n");
+        rc = -2;
+    }
+
+    // 读完数据后再次提交poll请求, 内核中等待旧的描述符
+    evsets_poll( evsets );
+
+    evsets_del( evsets, ev );
+    close( oldpair[0] );
+    socketpair( AF_UNIX, SOCK_STREAM, 0, newpair );
+    if ( rc == 0 && newpair[0] != oldpair[0] )
+    {
+        printf("reuse: the descriptor %d isn't reused (%d) .\n", oldpair[0], newpair[0]);
+        rc = -3;
+    }
+
+    readfd = -1;
+    event_set( ev, newpair[0], EV_READ|EV_PERSIST );
+    evsets_add( evsets, ev, -1 );
+    write( newpair[1], &c, 1 );
+    for ( i = 0; rc == 0 && i < 100 && readfd != newpair[0]; ++i )
+    {
+        evsets_poll( evsets );
+        usleep( 1000 );
+    }
+    if ( rc == 0 && readfd != newpair[0] )
+    {
+        printf("reuse: the reopened descriptor isn't polled .\n");
+        rc = -4;
+    }
+    if ( rc == 0 && recv( oldpair[1], &c, 1, MSG_DONTWAIT ) != 0 )
+    {
+        printf("reuse: the closed descriptor is still referenced .\n");
+        rc = -5;
+    }
+
+    evsets_del( evsets, ev );
+    evsets_destroy( evsets );
+    event_destroy( ev );
+    close( oldpair[1] );
+    close( newpair[0] );
+    close( newpair[1] );
+
+    printf("reuse : %s (%d)\n", rc == 0 ? "OK" : "FAILED", rc);
+    return rc;
+}
+
+int32_t main( int32_t argc, char ** argv )
 {
     int32_t socketfd;
+    int32_t flags = 0;
 
     event_t evfifo = NULL;
     evsets_t evsets = NULL;
@@ -62,6 +152,17 @@ int32_t main()
 
     done = 0;
 
+    // test_events [iouring]
+    // test_events reuse [iouring]
+    if ( argc > 1 && strcmp( argv[argc - 1], "iouring" ) == 0 )
+    {
+        flags |= EVSETS_IOURING;
+    }
+    if ( argc > 1 && strcmp( argv[1], "reuse" ) == 0 )
+    {
+        return test_reuse( flags ) == 0 ? 0 : 1;
+    }
+
     printf("VERSION : %s\n", evsets_get_version() );
 
     signal( SIGINT, signal_handler );
@@ -99,7 +200,7 @@ int32_t main()
 
     fprintf( stderr, "Write data to %s\n", fifo );
 
-    evsets = evsets_create( 8 );
+    evsets = evsets_create2( 8, flags );
     if ( evsets == NULL )
     {
         printf("evsets_create() error .\n");
@@ -0,0 +1,1197 @@
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "utils.h"
+#include "network.h"
+
+//
+// 网络层的功能测试
+// 本地回环上建立TCP会话, 检查会话的分配策略, 迁移, 网络线程的增减以及嵌入模式
+//
+
+#define NTHREADS    4
+#define MAX_CLIENTS 64
+
+struct server
+{
+    iolayer_t layer;
+    uint8_t indexes[NTHREADS];
+
+    pthread_mutex_t lock;
+    int32_t naccepted;
+    sid_t sids[MAX_CLIENTS];
+    uint8_t owners[MAX_CLIENTS];
+
+    size_t zerocopy;          // 零拷贝发送的阈值
+    uint64_t * transformkeys; // 会话的数据改造类型, NULL表示不改造
+};
+
+static struct server g_server;
+static _Atomic int32_t g_ntransforms;
+
+static int32_t on_start( void * context )
+{
+    if ( g_server.zerocopy > 0 )
+    {
+        iolayer_set_zerocopy( g_server.layer, *(sid_t *)context, g_server.zerocopy );
+    }
+    if ( g_server.transformkeys != NULL )
+    {
+        int32_t n = (sid_t *)context - g_server.sids;
+        iolayer_set_transformkey( g_server.layer, *(sid_t *)context, g_server.transformkeys[n] );
+    }
+    return 0;
+}
+
+// 计数的数据改造: 数据的前后加上'<'和'>'
+static char * on_transform( void * context, const char * buf, size_t * nbytes )
+{
+    char * buffer = (char *)malloc( *nbytes + 2 );
+
+    atomic_fetch_add( &g_ntransforms, 1 );
+    buffer[0] = '<';
+    memcpy( buffer + 1, buf, *nbytes );
+    buffer[*nbytes + 1] = '>';
+    *nbytes += 2;
+
+    return buffer;
+}
+
+static ssize_t on_process( void * context, const char * buf, size_t nbytes )
+{
+    // 回显, 迁移后仍然使用旧的会话ID
+    iolayer_send( g_server.layer, *(sid_t *)context, buf, nbytes, 0 );
+    return nbytes;
+}
+
+static int32_t on_timeout( void * context )
+{
+    return -1;
+}
+
+static int32_t on_keepalive( void * context )
+{
+    return 0;
+}
+
+static int32_t on_error( void * context, int32_t result )
+{
+    return -1;
+}
+
+static int32_t on_perform( void * context, int32_t type, void * task, int32_t interval )
+{
+    return 0;
+}
+
+static void on_shutdown( void * context, int32_t way )
+{
+}
+
+static int32_t on_accept( void * context, void * local, sid_t id, const char * host, uint16_t port )
+{
+    struct server * server = (struct server *)context;
+    ioservice_t service = {
+        .start = on_start,
+        .process = on_process,
+        .transform = server->transformkeys != NULL ? on_transform : NULL,
+        .keepalive = on_keepalive,
+        .timeout = on_timeout,
+        .error = on_error,
+        .perform = on_perform,
+        .shutdown = on_shutdown,
+    };
+
+    pthread_mutex_lock( &server->lock );
+    if ( server->naccepted == MAX_CLIENTS )
+    {
+        pthread_mutex_unlock( &server->lock );
+        return -1;
+    }
+    server->sids[server->naccepted] = id;
+    server->owners[server->naccepted] = *(uint8_t *)local;
+    iolayer_set_service( server->layer, id, &service, &server->sids[server->naccepted] );
+    ++server->naccepted;
+    pthread_mutex_unlock( &server->lock );
+
+    return 0;
+}
+
+static int32_t server_start2( struct server * server, uint16_t port, uint8_t nthreads, const ioconfig_t * config )
+{
+    void * contexts[NTHREADS];
+
+    server->naccepted = 0;
+    server->zerocopy = 0;
+    server->transformkeys = NULL;
+    pthread_mutex_init( &server->lock, NULL );
+
+    server->layer = iolayer_create2( nthreads, 1024, 8, config );
+    if ( server->layer == NULL )
+    {
+        return -1;
+    }
+
+    for ( uint8_t i = 0; i < NTHREADS; ++i )
+    {
+        server->indexes[i] = i;
+        contexts[i] = &server->indexes[i];
+    }
+    // 嵌入模式只有一个网络线程
+    iolayer_set_iocontext( server->layer, contexts, nthreads > 0 ? nthreads : 1 );
+
+    return iolayer_listen( server->layer,
+        NETWORK_TCP, "127.0.0.1", port, NULL, on_accept, server );
+}
+
+static int32_t server_start( struct server * server, uint16_t port, int32_t placement )
+{
+    ioconfig_t config;
+
+    memset( &config, 0, sizeof( config ) );
+    config.placement = placement;
+
+    return server_start2( server, port, NTHREADS, &config );
+}
+
+static void server_stop( struct server * server )
+{
+    iolayer_stop( server->layer );
+    iolayer_destroy( server->layer );
+    pthread_mutex_destroy( &server->lock );
+}
+
+// 建立count个客户端连接, 等待服务端全部接受
+static int32_t connect_clients( struct server * server, uint16_t port, int32_t * fds, int32_t count )
+{
+    int32_t expected = server->naccepted + count;
+    struct sockaddr_in addr;
+
+    memset( &addr, 0, sizeof( addr ) );
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons( port );
+    addr.sin_addr.s_addr = inet_addr( "127.0.0.1" );
+
+    for ( int32_t i = 0; i < count; ++i )
+    {
+        fds[i] = socket( AF_INET, SOCK_STREAM, 0 );
+        if ( connect( fds[i], (struct sockaddr *)&addr, sizeof( addr ) ) != 0 )
+        {
+            printf( "\tconnect() failed\n" );
+            return -1;
+        }
+
+        // 逐个等待分配完成, 负载的统计才是准确的
+        for ( int32_t wait = 0; wait < 200; ++wait )
+        {
+            pthread_mutex_lock( &server->lock );
+            int32_t naccepted = server->naccepted;
+            pthread_mutex_unlock( &server->lock );
+            if ( naccepted >= expected - count + i + 1 )
+            {
+                break;
+            }
+            usleep( 10000 );
+        }
+    }
+
+    return server->naccepted == expected ? 0 : -2;
+}
+
+static void close_clients( int32_t * fds, int32_t count )
+{
+    for ( int32_t i = 0; i < count; ++i )
+    {
+        close( fds[i] );
+    }
+}
+
+static int32_t count_owner( struct server * server, int32_t from, uint8_t index )
+{
+    int32_t count = 0;
+
+    for ( int32_t i = from; i < server->naccepted; ++i )
+    {
+        if ( server->owners[i] == index )
+        {
+            ++count;
+        }
+    }
+
+    return count;
+}
+
+//
+// 会话的分配策略
+//
+
+static uint8_t place_on_two( void * context, const ioload_t * loads, uint8_t count )
+{
+    return 2;
+}
+
+static int32_t test_placer( uint16_t port )
+{
+    int32_t fds[8];
+    struct server * server = &g_server;
+
+    if ( server_start( server, port, IOLAYER_PLACEMENT_MODULO ) != 0 )
+    {
+        return -1;
+    }
+    iolayer_set_placer( server->layer, place_on_two, NULL );
+
+    int32_t rc = connect_clients( server, port, fds, 8 );
+    if ( rc == 0 && count_owner( server, 0, 2 ) != 8 )
+    {
+        printf( "\tplacer: %d/8 sessions on thread 2\n", count_owner( server, 0, 2 ) );
+        rc = -3;
+    }
+
+    close_clients( fds, 8 );
+    server_stop( server );
+    return rc;
+}
+
+static int32_t test_leastsessions( uint16_t port )
+{
+    int32_t fds[NTHREADS * 2];
+    struct server * server = &g_server;
+
+    if ( server_start( server, port, IOLAYER_PLACEMENT_LEASTSESSIONS ) != 0 )
+    {
+        return -1;
+    }
+
+    int32_t rc = connect_clients( server, port, fds, NTHREADS * 2 );
+    for ( uint8_t i = 0; rc == 0 && i < NTHREADS; ++i )
+    {
+        if ( count_owner( server, 0, i ) != 2 )
+        {
+            printf( "\tleastsessions: %d sessions on thread %d\n", count_owner( server, 0, i ), i );
+            rc = -3;
+        }
+    }
+
+    close_clients( fds, NTHREADS * 2 );
+    server_stop( server );
+    return rc;
+}
+
+static _Atomic int32_t g_spinning;
+
+static void spin( void * context, void * task )
+{
+    int64_t until = monotonic_microseconds() + (int64_t)(intptr_t)task;
+
+    while ( monotonic_microseconds() < until )
+    {
+    }
+    g_spinning = 0;
+}
+
+static int32_t test_leastcpu( uint16_t port )
+{
+    ioload_t load;
+    int32_t fds[NTHREADS * 2];
+    struct server * server = &g_server;
+
+    if ( server_start( server, port, IOLAYER_PLACEMENT_LEASTCPU ) != 0 )
+    {
+        return -1;
+    }
+
+    // 0号网络线程忙碌一段时间后进入空闲
+    usleep( 200000 );
+    g_spinning = 1;
+    iolayer_invoke_thread( server->layer, 0, (void *)(intptr_t)300000, spin );
+    while ( g_spinning )
+    {
+        usleep( 1000 );
+    }
+    usleep( 20000 );
+
+    // 刚刚忙碌过的网络线程不分配会话
+    int32_t rc = connect_clients( server, port, fds, NTHREADS );
+    iolayer_get_load( server->layer, 0, &load );
+    if ( rc == 0 && count_owner( server, 0, 0 ) != 0 )
+    {
+        printf( "\tleastcpu: %d sessions on the busy thread (cpuload %u)\n", count_owner( server, 0, 0 ), load.cpuload );
+        rc = -3;
+    }
+
+    // 空闲的网络线程阻塞等待期间不会采样, 读取时必须按照空闲的时间衰减
+    usleep( 1000000 );
+    iolayer_get_load( server->layer, 0, &load );
+    if ( rc == 0 && load.cpuload > 100 )
+    {
+        printf( "\tleastcpu: the idle thread still reports cpuload %u\n", load.cpuload );
+        rc = -4;
+    }
+
+    close_clients( fds, NTHREADS );
+    server_stop( server );
+    return rc;
+}
+
+//
+// 会话迁移
+//
+
+#define NBROADCASTS    64
+#define BROADCAST_SIZE 65536
+#define TRAILER        "TRAILER"
+
+// 读取count个字节, 检查广播的数据和结尾的标记
+static int32_t receive_all( int32_t fd, size_t count )
+{
+    size_t nread = 0;
+    char * buffer = (char *)malloc( count );
+    struct timeval tv = { .tv_sec = 5, .tv_usec = 0 };
+
+    setsockopt( fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof( tv ) );
+    while ( nread < count )
+    {
+        ssize_t n = recv( fd, buffer + nread, count - nread, 0 );
+        if ( n <= 0 )
+        {
+            break;
+        }
+        nread += n;
+    }
+
+    int32_t rc = nread == count ? 0 : -1;
+    for ( size_t i = 0; rc == 0 && i < NBROADCASTS * BROADCAST_SIZE; ++i )
+    {
+        if ( buffer[i] != (char)( i / BROADCAST_SIZE ) )
+        {
+            rc = -2;
+        }
+    }
+    if ( rc == 0
+        && memcmp( buffer + NBROADCASTS * BROADCAST_SIZE, TRAILER, strlen( TRAILER ) ) != 0 )
+    {
+        rc = -3;
+    }
+
+    free( buffer );
+    return rc;
+}
+
+static int32_t test_migrate_queued( uint16_t port )
+{
+    int32_t fds[NTHREADS * 2];
+    struct server * server = &g_server;
+    char * buffer = (char *)malloc( BROADCAST_SIZE );
+
+    if ( server_start( server, port, IOLAYER_PLACEMENT_MODULO ) != 0 )
+    {
+        return -1;
+    }
+
+    int32_t rc = connect_clients( server, port, fds, NTHREADS * 2 );
+
+    // 广播的消息由同一个网络线程中的会话共享,
+    // 客户端不读取, 迁移时共享的消息还在发送队列中
+    for ( int32_t i = 0; rc == 0 && i < NBROADCASTS; ++i )
+    {
+        memset( buffer, i, BROADCAST_SIZE );
+        iolayer_broadcast2( server->layer, buffer, BROADCAST_SIZE );
+    }
+    for ( int32_t i = 0; rc == 0 && i < server->naccepted; ++i )
+    {
+        iolayer_migrate( server->layer, server->sids[i], ( server->owners[i] + 1 ) % NTHREADS );
+    }
+    for ( int32_t i = 0; rc == 0 && i < server->naccepted; ++i )
+    {
+        iolayer_send( server->layer, server->sids[i], TRAILER, strlen( TRAILER ), 0 );
+    }
+
+    // 通过旧的会话ID发送的数据在广播之后到达
+    for ( int32_t i = 0; rc == 0 && i < server->naccepted; ++i )
+    {
+        rc = receive_all( fds[i], NBROADCASTS * BROADCAST_SIZE + strlen( TRAILER ) );
+        if ( rc != 0 )
+        {
+            printf( "\tmigrate: client %d received incomplete data (%d)\n", i, rc );
+        }
+    }
+
+    close_clients( fds, NTHREADS * 2 );
+    server_stop( server );
+    free( buffer );
+    return rc;
+}
+
+//
+// 广播组: 加入, 离开, 会话终止以及迁移
+//
+
+#define GROUP_ID      1001
+#define GROUP_CLIENTS 8
+
+static uint8_t place_on_context( void * context, const ioload_t * loads, uint8_t count )
+{
+    return *(uint8_t *)context;
+}
+
+// 广播后检查每个客户端收到的数据, members[i]表示客户端i是否是组成员
+static int32_t publish_check( struct server * server, int32_t * fds, const int32_t * members, const char * data )
+{
+    int32_t rc = 0;
+
+    iolayer_broadcast_group( server->layer, GROUP_ID, data, strlen( data ) );
+    usleep( 100000 );
+
+    for ( int32_t i = 0; i <= GROUP_CLIENTS; ++i )
+    {
+        char buffer[64];
+        ssize_t nread = 0;
+
+        if ( fds[i] < 0 )
+        {
+            continue;
+        }
+
+        for ( ;; )
+        {
+            ssize_t n = recv( fds[i], buffer + nread, sizeof( buffer ) - nread, MSG_DONTWAIT );
+            if ( n <= 0 )
+            {
+                break;
+            }
+            nread += n;
+        }
+
+        const char * expected = members[i] ? data : "";
+        if ( nread != (ssize_t)strlen( expected ) || memcmp( buffer, expected, nread ) != 0 )
+        {
+            printf( "\tgroup: client %d received %ld bytes, expected '%s'\n", i, nread, expected );
+            rc = -1;
+        }
+    }
+
+    return rc;
+}
+
+static int32_t test_group( uint16_t port )
+{
+    int32_t fds[GROUP_CLIENTS + 1];
+    int32_t members[GROUP_CLIENTS + 1] = { 0 };
+    struct server * server = &g_server;
+
+    if ( server_start( server, port, IOLAYER_PLACEMENT_MODULO ) != 0 )
+    {
+        return -1;
+    }
+
+    fds[GROUP_CLIENTS] = -1;
+    int32_t rc = connect_clients( server, port, fds, GROUP_CLIENTS );
+
+    // 前6个客户端加入广播组
+    for ( int32_t i = 0; rc == 0 && i < 6; ++i )
+    {
+        members[i] = 1;
+        iolayer_join_group( server->layer, GROUP_ID, server->sids[i] );
+    }
+    if ( rc == 0 )
+    {
+        rc = publish_check( server, fds, members, "join" );
+    }
+
+    // 离开广播组
+    if ( rc == 0 )
+    {
+        members[0] = 0;
+        iolayer_leave_group( server->layer, GROUP_ID, server->sids[0] );
+        rc = publish_check( server, fds, members, "leave" );
+    }
+
+    // 会话终止后离开广播组, 在同一个网络线程中建立新的会话, 不能收到广播
+    if ( rc == 0 )
+    {
+        close( fds[1] );
+        fds[1] = -1;
+        members[1] = 0;
+        usleep( 200000 );
+
+        iolayer_set_placer( server->layer, place_on_context, &server->owners[1] );
+        rc = connect_clients( server, port, &fds[GROUP_CLIENTS], 1 );
+    }
+    if ( rc == 0 )
+    {
+        rc = publish_check( server, fds, members, "close" );
+    }
+
+    // 迁移后仍然是组成员, 并且只收到一次广播
+    if ( rc == 0 )
+    {
+        iolayer_migrate( server->layer, server->sids[2], ( server->owners[2] + 1 ) % NTHREADS );
+        usleep( 200000 );
+        rc = publish_check( server, fds, members, "migrate" );
+    }
+
+    // 通过旧的会话ID离开广播组
+    if ( rc == 0 )
+    {
+        members[2] = 0;
+        iolayer_leave_group( server->layer, GROUP_ID, server->sids[2] );
+        usleep( 100000 );
+        rc = publish_check( server, fds, members, "forward" );
+    }
+
+    close_clients( fds, GROUP_CLIENTS );
+    if ( fds[GROUP_CLIENTS] >= 0 )
+    {
+        close( fds[GROUP_CLIENTS] );
+    }
+    server_stop( server );
+    return rc;
+}
+
+//
+// 零拷贝发送的会话终止后, 消息等到内核的完成通知后才释放
+//
+
+static int32_t test_zerocopy_linger( uint16_t port )
+{
+    int32_t fd = -1;
+    int32_t rcvbuf = BROADCAST_SIZE;
+    char * scribbles[NBROADCASTS];
+    struct server * server = &g_server;
+    char * buffer = (char *)malloc( NBROADCASTS * BROADCAST_SIZE );
+
+    if ( server_start( server, port, IOLAYER_PLACEMENT_MODULO ) != 0 )
+    {
+        return -1;
+    }
+    server->zerocopy = BROADCAST_SIZE;
+
+    // 客户端的接收缓冲区较小并且不读取, 零拷贝发送的数据积压在内核中
+    struct sockaddr_in addr;
+    memset( &addr, 0, sizeof( addr ) );
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons( port );
+    addr.sin_addr.s_addr = inet_addr( "127.0.0.1" );
+    fd = socket( AF_INET, SOCK_STREAM, 0 );
+    setsockopt( fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof( rcvbuf ) );
+    int32_t rc = connect( fd, (struct sockaddr *)&addr, sizeof( addr ) ) == 0 ? 0 : -1;
+    for ( int32_t wait = 0; rc == 0 && wait < 200 && server->naccepted == 0; ++wait )
+    {
+        usleep( 10000 );
+    }
+    if ( rc == 0 && server->naccepted != 1 )
+    {
+        rc = -1;
+    }
+
+    for ( int32_t i = 0; rc == 0 && i < NBROADCASTS; ++i )
+    {
+        memset( buffer, i, BROADCAST_SIZE );
+        iolayer_send( server->layer, server->sids[0], buffer, BROADCAST_SIZE, 0 );
+    }
+    usleep( 100000 );
+
+    // 客户端关闭写端, 服务端终止会话, 丢弃还没有发送的消息
+    shutdown( fd, SHUT_WR );
+    usleep( 200000 );
+
+    // 重新使用释放的内存, 提前释放的消息会破坏内核中还没有发送的数据
+    for ( int32_t i = 0; i < NBROADCASTS; ++i )
+    {
+        scribbles[i] = (char *)malloc( BROADCAST_SIZE );
+        memset( scribbles[i], 0xff, BROADCAST_SIZE );
+    }
+
+    // 已经交给内核的数据必须完整
+    size_t nread = 0;
+    struct timeval tv = { .tv_sec = 5, .tv_usec = 0 };
+    setsockopt( fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof( tv ) );
+    while ( rc == 0 && nread < NBROADCASTS * BROADCAST_SIZE )
+    {
+        ssize_t n = recv( fd, buffer + nread, NBROADCASTS * BROADCAST_SIZE - nread, 0 );
+        if ( n == 0 )
+        {
+            break;
+        }
+        if ( n < 0 )
+        {
+            printf( "\tzerocopy: recv() failed, %s\n", strerror( errno ) );
+            rc = -2;
+        }
+        nread += n > 0 ? n : 0;
+    }
+    for ( size_t i = 0; rc == 0 && i < nread; ++i )
+    {
+        if ( buffer[i] != (char)( i / BROADCAST_SIZE ) )
+        {
+            printf( "\tzerocopy: corrupted data at offset %lu\n", i );
+            rc = -3;
+        }
+    }
+    if ( rc == 0 && nread == 0 )
+    {
+        rc = -4;
+    }
+
+    for ( int32_t i = 0; i < NBROADCASTS; ++i )
+    {
+        free( scribbles[i] );
+    }
+    close_clients( &fd, 1 );
+    server_stop( server );
+    free( buffer );
+    return rc;
+}
+
+//
+// 负载下增加和退役网络线程
+//
+
+#define LOAD_CLIENTS 48
+
+struct loader
+{
+    uint16_t port;
+    _Atomic int32_t running;
+
+    int32_t nclients;
+    int32_t fds[LOAD_CLIENTS];
+
+    uint64_t nechoes;
+    int32_t nresets; // 退役时正在握手的连接可能被重置
+    int32_t nlost;   // 没有收到回显
+};
+
+// 发送并等待回显, 0-成功, 1-连接被重置, -1-超时
+static int32_t ping( int32_t fd )
+{
+    char buffer[4];
+    size_t nread = 0;
+
+    if ( send( fd, "ping", 4, MSG_NOSIGNAL ) != 4 )
+    {
+        return 1;
+    }
+
+    while ( nread < sizeof( buffer ) )
+    {
+        ssize_t n = recv( fd, buffer + nread, sizeof( buffer ) - nread, 0 );
+        if ( n == 0 )
+        {
+            return 1;
+        }
+        if ( n < 0 )
+        {
+            return errno == ECONNRESET ? 1 : -1;
+        }
+        nread += n;
+    }
+
+    return memcmp( buffer, "ping", 4 ) == 0 ? 0 : -1;
+}
+
+static void * loader_main( void * arg )
+{
+    struct loader * loader = (struct loader *)arg;
+    struct timeval tv = { .tv_sec = 2, .tv_usec = 0 };
+    struct sockaddr_in addr;
+
+    memset( &addr, 0, sizeof( addr ) );
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons( loader->port );
+    addr.sin_addr.s_addr = inet_addr( "127.0.0.1" );
+
+    while ( atomic_load( &loader->running ) )
+    {
+        // 持续建立新的连接
+        if ( loader->nclients < LOAD_CLIENTS )
+        {
+            int32_t fd = socket( AF_INET, SOCK_STREAM, 0 );
+            setsockopt( fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof( tv ) );
+            if ( connect( fd, (struct sockaddr *)&addr, sizeof( addr ) ) != 0 )
+            {
+                close( fd );
+                fd = -1;
+            }
+            loader->fds[loader->nclients++] = fd;
+        }
+
+        for ( int32_t i = 0; i < loader->nclients; ++i )
+        {
+            if ( loader->fds[i] < 0 )
+            {
+                continue;
+            }
+
+            int32_t rc = ping( loader->fds[i] );
+            if ( rc == 0 )
+            {
+                ++loader->nechoes;
+            }
+            else
+            {
+                if ( rc > 0 )
+                {
+                    ++loader->nresets;
+                }
+                else
+                {
+                    ++loader->nlost;
+                }
+                close( loader->fds[i] );
+                loader->fds[i] = -1;
+            }
+        }
+
+        usleep( 5000 );
+    }
+
+    return NULL;
+}
+
+static int32_t test_grow_retire( uint16_t port )
+{
+    ioconfig_t config;
+    pthread_t loaderid;
+    struct loader loader;
+    struct server * server = &g_server;
+
+    memset( &config, 0, sizeof( config ) );
+    config.maxthreads = NTHREADS;
+
+    memset( &loader, 0, sizeof( loader ) );
+    loader.port = port;
+    atomic_init( &loader.running, 1 );
+
+    if ( server_start2( server, port, 2, &config ) != 0 )
+    {
+        return -1;
+    }
+    pthread_create( &loaderid, NULL, loader_main, &loader );
+
+    // 增加到NTHREADS个网络线程, 再退役两个, 最后恢复一个
+    int32_t rc = 0;
+    usleep( 200000 );
+    if ( iolayer_add_thread( server->layer, -1, &server->indexes[2] ) != 2
+        || iolayer_add_thread( server->layer, -1, &server->indexes[3] ) != 3
+        || iolayer_add_thread( server->layer, -1, NULL ) >= 0 )
+    {
+        rc = -2;
+    }
+    usleep( 300000 );
+    if ( rc == 0
+        && ( iolayer_retire_thread( server->layer, 0 ) != 0
+            || iolayer_retire_thread( server->layer, 2 ) != 0 ) )
+    {
+        rc = -3;
+    }
+    usleep( 300000 );
+
+    // 退役的网络线程迁出了所有的TCP会话
+    for ( uint8_t i = 0; rc == 0 && i < NTHREADS; i += 2 )
+    {
+        ioload_t load;
+        iolayer_get_load( server->layer, i, &load );
+        if ( load.nsessions != 0 )
+        {
+            printf( "\tgrow_retire: the retired thread %d still has %u sessions\n", i, load.nsessions );
+            rc = -4;
+        }
+    }
+    if ( rc == 0 && iolayer_add_thread( server->layer, -1, &server->indexes[0] ) != 0 )
+    {
+        rc = -5;
+    }
+    usleep( 300000 );
+
+    atomic_store( &loader.running, 0 );
+    pthread_join( loaderid, NULL );
+
+    if ( rc == 0 && ( loader.nlost != 0 || loader.nechoes == 0 ) )
+    {
+        printf( "\tgrow_retire: %d clients lost their echo (%lu echoes, %d resets)\n",
+            loader.nlost, loader.nechoes, loader.nresets );
+        rc = -6;
+    }
+    if ( rc == 0 && count_owner( server, 0, 2 ) + count_owner( server, 0, 3 ) == 0 )
+    {
+        printf( "\tgrow_retire: the new threads got no sessions\n" );
+        rc = -7;
+    }
+
+    for ( int32_t i = 0; i < loader.nclients; ++i )
+    {
+        if ( loader.fds[i] >= 0 )
+        {
+            close( loader.fds[i] );
+        }
+    }
+    server_stop( server );
+    return rc;
+}
+
+// 统计本机监听端口的套接字个数
+static int32_t count_listeners( uint16_t port )
+{
+    char line[512];
+    int32_t count = 0;
+
+    FILE * fp = fopen( "/proc/net/tcp", "r" );
+    if ( fp == NULL )
+    {
+        return -1;
+    }
+
+    while ( fgets( line, sizeof( line ), fp ) != NULL )
+    {
+        unsigned int lport = 0, state = 0;
+        if ( sscanf( line, " %*d: %*x:%x %*x:%*x %x", &lport, &state ) == 2
+            && lport == port && state == 0x0A )
+        {
+            ++count;
+        }
+    }
+
+    fclose( fp );
+    return count;
+}
+
+static int32_t test_retire_revive( uint16_t port )
+{
+    int32_t fds[NTHREADS * 2];
+    struct server * server = &g_server;
+
+    if ( server_start( server, port, IOLAYER_PLACEMENT_MODULO ) != 0 )
+    {
+        return -1;
+    }
+
+    // 退役任务执行之前就恢复, 每个网络线程仍然只有一个监听套接字
+    int32_t rc = 0;
+    usleep( 100000 );
+    if ( iolayer_retire_thread( server->layer, 1 ) != 0
+        || iolayer_add_thread( server->layer, -1, &server->indexes[1] ) != 1 )
+    {
+        rc = -2;
+    }
+    usleep( 200000 );
+
+    int32_t nlisteners = count_listeners( port );
+    if ( rc == 0 && nlisteners >= 0 && nlisteners != NTHREADS )
+    {
+        printf( "\tretire_revive: %d listeners for %d threads\n", nlisteners, NTHREADS );
+        rc = -3;
+    }
+    if ( rc == 0 )
+    {
+        rc = connect_clients( server, port, fds, NTHREADS * 2 );
+        close_clients( fds, NTHREADS * 2 );
+    }
+
+    server_stop( server );
+    return rc;
+}
+
+//
+// 嵌入模式: 测试线程调用iolayer_poll()驱动网络层, 接口都直接执行, 不经过任务队列
+//
+
+struct embedded
+{
+    sid_t sid;          // 主动连接的会话
+    int32_t nconnected;
+    size_t nreceived;
+};
+
+static struct embedded g_embedded;
+
+static ssize_t on_embedded_process( void * context, const char * buf, size_t nbytes )
+{
+    g_embedded.nreceived += nbytes;
+    return nbytes;
+}
+
+static int32_t on_connected( void * context, void * local, int32_t result, const char * host, uint16_t port, sid_t id )
+{
+    ioservice_t service = {
+        .start = on_start,
+        .process = on_embedded_process,
+        .transform = NULL,
+        .keepalive = on_keepalive,
+        .timeout = on_timeout,
+        .error = on_error,
+        .perform = on_perform,
+        .shutdown = on_shutdown,
+    };
+
+    if ( result != 0 )
+    {
+        return -1;
+    }
+
+    g_embedded.sid = id;
+    ++g_embedded.nconnected;
+    iolayer_set_service( g_server.layer, id, &service, &g_embedded.sid );
+    return 0;
+}
+
+// 驱动网络层, 直到条件满足
+static int32_t poll_until( struct server * server, const int32_t * value, int32_t expected )
+{
+    for ( int32_t i = 0; i < 200 && *value < expected; ++i )
+    {
+        iolayer_poll( server->layer, 10 );
+    }
+
+    return *value >= expected ? 0 : -1;
+}
+
+// 阻塞接收nbytes个字节
+static int32_t receive_exactly( int32_t fd, const char * expected, size_t nbytes )
+{
+    char buf[64];
+    size_t nread = 0;
+
+    while ( nread < nbytes )
+    {
+        ssize_t n = recv( fd, buf + nread, nbytes - nread, 0 );
+        if ( n <= 0 )
+        {
+            return -1;
+        }
+        nread += n;
+    }
+
+    return memcmp( buf, expected, nbytes ) == 0 ? 0 : -1;
+}
+
+static int32_t test_embedded( uint16_t port )
+{
+    int32_t fd = -1;
+    int64_t elapsed = 0;
+    struct timespec start, end;
+    struct timeval tv = { 1, 0 };
+    struct sockaddr_in addr;
+    struct server * server = &g_server;
+
+    memset( &g_embedded, 0, sizeof( g_embedded ) );
+    if ( server_start2( server, port, 0, NULL ) != 0 )
+    {
+        return -1;
+    }
+
+    // 没有事件时等待timeout毫秒
+    int32_t rc = 0;
+    clock_gettime( CLOCK_MONOTONIC, &start );
+    int32_t nactive = iolayer_poll( server->layer, 100 );
+    clock_gettime( CLOCK_MONOTONIC, &end );
+    elapsed = ( end.tv_sec - start.tv_sec ) * 1000 + ( end.tv_nsec - start.tv_nsec ) / 1000000;
+    if ( nactive != 0 || elapsed < 90 || elapsed > 1000 )
+    {
+        printf( "\tembedded: iolayer_poll(100) returned %d after %ldms\n", nactive, (long)elapsed );
+        rc = -2;
+    }
+    clock_gettime( CLOCK_MONOTONIC, &start );
+    nactive = iolayer_poll( server->layer, 0 );
+    clock_gettime( CLOCK_MONOTONIC, &end );
+    elapsed = ( end.tv_sec - start.tv_sec ) * 1000 + ( end.tv_nsec - start.tv_nsec ) / 1000000;
+    if ( rc == 0 && ( nactive != 0 || elapsed > 50 ) )
+    {
+        printf( "\tembedded: iolayer_poll(0) returned %d after %ldms\n", nactive, (long)elapsed );
+        rc = -3;
+    }
+
+    // 回环上回显
+    memset( &addr, 0, sizeof( addr ) );
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons( port );
+    addr.sin_addr.s_addr = inet_addr( "127.0.0.1" );
+    fd = socket( AF_INET, SOCK_STREAM, 0 );
+    setsockopt( fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof( tv ) );
+    if ( rc == 0
+        && ( connect( fd, (struct sockaddr *)&addr, sizeof( addr ) ) != 0
+            || poll_until( server, &server->naccepted, 1 ) != 0 ) )
+    {
+        printf( "\tembedded: the connection was not accepted\n" );
+        rc = -4;
+    }
+    if ( rc == 0 )
+    {
+        send( fd, "embedded", 8, 0 );
+        for ( int32_t i = 0; i < 10; ++i )
+        {
+            iolayer_poll( server->layer, 10 );
+        }
+        if ( receive_exactly( fd, "embedded", 8 ) != 0 )
+        {
+            printf( "\tembedded: no echo\n" );
+            rc = -5;
+        }
+    }
+
+    // 发送直接写入套接字, 不驱动网络层也能收到
+    if ( rc == 0
+        && ( iolayer_send( server->layer, server->sids[0], "direct", 6, 0 ) != 0
+            || iolayer_get_queuesize( server->layer, 0 ) != 0
+            || receive_exactly( fd, "direct", 6 ) != 0 ) )
+    {
+        printf( "\tembedded: iolayer_send() was not executed directly\n" );
+        rc = -6;
+    }
+
+    // 主动连接直接注册到事件集
+    if ( rc == 0
+        && ( iolayer_connect( server->layer, "127.0.0.1", port, on_connected, NULL ) != 0
+            || iolayer_get_queuesize( server->layer, 0 ) != 0
+            || poll_until( server, &g_embedded.nconnected, 1 ) != 0
+            || poll_until( server, &server->naccepted, 2 ) != 0 ) )
+    {
+        printf( "\tembedded: iolayer_connect() failed\n" );
+        rc = -7;
+    }
+
+    // 广播直接加入会话的发送队列, 由下一次iolayer_poll()写出
+    if ( rc == 0
+        && ( iolayer_broadcast( server->layer, server->sids, 2, "broadcast", 9 ) != 0
+            || iolayer_get_queuesize( server->layer, 0 ) != 0 ) )
+    {
+        printf( "\tembedded: iolayer_broadcast() was not executed directly\n" );
+        rc = -8;
+    }
+    for ( int32_t i = 0; rc == 0 && i < 200 && g_embedded.nreceived < 9; ++i )
+    {
+        iolayer_poll( server->layer, 10 );
+    }
+    if ( rc == 0 && receive_exactly( fd, "broadcast", 9 ) != 0 )
+    {
+        printf( "\tembedded: the client received no broadcast\n" );
+        rc = -9;
+    }
+    if ( rc == 0 && g_embedded.nreceived != 9 )
+    {
+        printf( "\tembedded: the connected session received %lu bytes\n", g_embedded.nreceived );
+        rc = -10;
+    }
+
+    if ( fd >= 0 )
+    {
+        close( fd );
+    }
+    server_stop( server );
+    return rc;
+}
+
+//
+// 共享数据改造的结果
+//
+
+#define TRANSFORM_CLIENTS 16
+
+static int32_t test_transformkey( uint16_t port )
+{
+    int32_t fds[TRANSFORM_CLIENTS];
+    uint64_t keys[TRANSFORM_CLIENTS];
+    struct timeval tv = { 1, 0 };
+    struct server * server = &g_server;
+
+    // 一半的会话共享类型1, 四分之一共享类型2, 其余的不共享
+    for ( int32_t i = 0; i < TRANSFORM_CLIENTS; ++i )
+    {
+        keys[i] = i < TRANSFORM_CLIENTS / 2 ? 1 : ( i < TRANSFORM_CLIENTS * 3 / 4 ? 2 : 0 );
+    }
+
+    if ( server_start( server, port, IOLAYER_PLACEMENT_MODULO ) != 0 )
+    {
+        return -1;
+    }
+    server->transformkeys = keys;
+    atomic_store( &g_ntransforms, 0 );
+
+    int32_t rc = connect_clients( server, port, fds, TRANSFORM_CLIENTS );
+    usleep( 100000 );
+
+    // 每个网络线程中每种类型只改造一次, 不共享的会话各自改造
+    int32_t expected = 0;
+    for ( int32_t i = 0; i < TRANSFORM_CLIENTS; ++i )
+    {
+        int32_t shared = 0;
+        for ( int32_t j = 0; j < i && keys[i] != 0; ++j )
+        {
+            if ( keys[j] == keys[i] && server->owners[j] == server->owners[i] )
+            {
+                shared = 1;
+            }
+        }
+        expected += shared ? 0 : 1;
+    }
+
+    if ( rc == 0 && iolayer_broadcast2( server->layer, "transform", 9 ) != 0 )
+    {
+        rc = -2;
+    }
+    for ( int32_t i = 0; rc == 0 && i < TRANSFORM_CLIENTS; ++i )
+    {
+        setsockopt( fds[i], SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof( tv ) );
+        if ( receive_exactly( fds[i], "<transform>", 11 ) != 0 )
+        {
+            printf( "\ttransformkey: client %d (key %lu) received no transformed broadcast\n", i, (unsigned long)keys[i] );
+            rc = -3;
+        }
+    }
+    if ( rc == 0 && ( atomic_load( &g_ntransforms ) != expected || expected >= TRANSFORM_CLIENTS ) )
+    {
+        printf( "\ttransformkey: %d transforms for %d sessions, expected %d\n",
+            atomic_load( &g_ntransforms ), TRANSFORM_CLIENTS, expected );
+        rc = -4;
+    }
+
+    close_clients( fds, TRANSFORM_CLIENTS );
+    server_stop( server );
+    return rc;
+}
+
+int32_t main()
+{
+    int32_t rc = 0;
+
+    struct
+    {
+        const char * name;
+        int32_t ( *test )( uint16_t );
+    } tests[] = {
+        { "placer", test_placer },
+        { "leastsessions", test_leastsessions },
+        { "leastcpu", test_leastcpu },
+        { "migrate", test_migrate_queued },
+        { "group", test_group },
+        { "grow_retire", test_grow_retire },
+        { "zerocopy", test_zerocopy_linger },
+        { "retire_revive", test_retire_revive },
+        { "embedded", test_embedded },
+        { "transformkey", test_transformkey },
+    };
+
+    for ( size_t i = 0; i < sizeof( tests ) / sizeof( tests[0] ); ++i )
+    {
+        int32_t result = tests[i].test( (uint16_t)( 19310 + i ) );
+        printf( "%-16s : %s (%d)\n", tests[i].name, result == 0 ? "OK" : "FAILED", result );
+        if ( result != 0 )
+        {
+            rc = -1;
+        }
+    }
+
+    return rc;
+}
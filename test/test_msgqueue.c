@@ -0,0 +1,164 @@
+
+#include <stdio.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "utils.h"
+#include "msgqueue.h"
+
+//
+// 消息队列的基准测试
+// 多个生产者并发提交任务, 单个消费者阻塞在通知描述符上取任务
+// 同时检查同一个生产者的任务是否有序
+//
+
+#define NTASKS_PER_ROUND 4000000
+
+struct producer {
+    int32_t index;
+    uint32_t ntasks;
+    struct msgqueue * queue;
+};
+
+static void * producer_main( void * arg )
+{
+    struct producer * p = (struct producer *)arg;
+
+    for ( uint32_t i = 0; i < p->ntasks; ++i ) {
+        struct task task = { .type = eTaskType_Data, .utype = (int16_t)p->index };
+        *(uint32_t *)task.data = i;
+
+        while ( msgqueue_push( p->queue, &task, MSGQUEUE_NOTIFY ) != 0 ) {
+        }
+    }
+
+    return NULL;
+}
+
+static int32_t consume( struct msgqueue * queue, int32_t nproducers, uint32_t ntasks )
+{
+    int32_t errors = 0;
+    uint64_t received = 0, total = (uint64_t)nproducers * ntasks;
+    uint32_t * expected = (uint32_t *)calloc( nproducers, sizeof( uint32_t ) );
+
+    struct taskqueue doqueue;
+    QUEUE_INIT( taskqueue )( &doqueue, 4096 );
+
+    struct pollfd pfd = { .fd = msgqueue_popfd( queue ), .events = POLLIN };
+
+    while ( received < total ) {
+        uint64_t value = 0;
+
+        // 队列为空时, 阻塞等待通知
+        if ( msgqueue_count( queue ) == 0 ) {
+            if ( poll( &pfd, 1, 1000 ) == 0 ) {
+                printf( "\tconsumer: wait for notification timeout (received %lu/%lu)\n", received, total );
+            }
+            if ( read( pfd.fd, &value, sizeof( value ) ) < 0 ) {
+            }
+        }
+
+        msgqueue_swap( queue, &doqueue );
+
+        struct task task;
+        while ( QUEUE_POP( taskqueue )( &doqueue, &task ) ) {
+            uint32_t seq = *(uint32_t *)task.data;
+            if ( seq != expected[task.utype] ) {
+                ++errors;
+            }
+            expected[task.utype] = seq + 1;
+            ++received;
+        }
+    }
+
+    QUEUE_CLEAR( taskqueue )( &doqueue );
+    free( expected );
+
+    return errors;
+}
+
+static void bench( int32_t nproducers )
+{
+    pthread_t threads[64];
+    struct producer producers[64];
+    uint32_t ntasks = NTASKS_PER_ROUND / nproducers;
+    struct msgqueue * queue = msgqueue_create( 4096 );
+
+    int64_t start = monotonic_microseconds();
+
+    for ( int32_t i = 0; i < nproducers; ++i ) {
+        producers[i].index = i;
+        producers[i].ntasks = ntasks;
+        producers[i].queue = queue;
+        pthread_create( &threads[i], NULL, producer_main, &producers[i] );
+    }
+
+    int32_t errors = consume( queue, nproducers, ntasks );
+
+    for ( int32_t i = 0; i < nproducers; ++i ) {
+        pthread_join( threads[i], NULL );
+    }
+
+    int64_t elapsed = monotonic_microseconds() - start;
+
+    printf( "%s producers=%2d : %u tasks in %ld usecs, %.2f Mops/s, out of order %d\n",
+#if defined USE_LOCKFREE_QUEUE
+        "lockfree",
+#else
+        "spinlock",
+#endif
+        nproducers, ntasks * nproducers, elapsed,
+        (double)ntasks * nproducers / (double)elapsed, errors );
+
+    msgqueue_destroy( queue );
+}
+
+// 检查队列容量的限制
+static void check_capacity()
+{
+    int32_t errors = 0;
+    struct task task = { .type = eTaskType_Data };
+    struct msgqueue * queue = msgqueue_create( 8 );
+
+    msgqueue_set_capacity( queue, 4 );
+    for ( int32_t i = 0; i < 4; ++i ) {
+        task.flags = i == 0 ? eTaskFlag_Droppable : 0;
+        errors += msgqueue_push( queue, &task, 0 ) != 0;
+    }
+    errors += msgqueue_push( queue, &task, 0 ) != -2;
+    errors += msgqueue_push( queue, &task, MSGQUEUE_NOLIMIT ) != 0;
+
+#if !defined USE_LOCKFREE_QUEUE
+    // 只有队首的可丢弃任务才能被丢弃
+    errors += msgqueue_drop( queue, &task ) != 1;
+    errors += msgqueue_drop( queue, &task ) != 0;
+    errors += msgqueue_count( queue ) != 4;
+#endif
+
+    // 批量提交只提交队列剩余空间内的任务
+    struct task tasks[8];
+    for ( int32_t i = 0; i < 8; ++i ) {
+        tasks[i] = task;
+    }
+    uint32_t count = msgqueue_count( queue );
+    msgqueue_set_capacity( queue, 8 );
+    errors += msgqueue_pushs( queue, tasks, 8, 0 ) != 8 - count;
+    errors += msgqueue_count( queue ) != 8;
+    errors += msgqueue_pushs( queue, tasks, 8, MSGQUEUE_NOLIMIT ) != 8;
+
+    printf( "capacity : errors %d\n", errors );
+    msgqueue_destroy( queue );
+}
+
+int main( int argc, char ** argv )
+{
+    check_capacity();
+    bench( 1 );
+    bench( 4 );
+    bench( 16 );
+
+    return 0;
+}
@@ -0,0 +1,289 @@
+
+#include <stdio.h>
+#include <errno.h>
+#include <unistd.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <malloc.h>
+#include <syslog.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "network.h"
+
+//
+// 零拷贝发送的测试
+// 发送端通过libevlite发送大消息(先发送8字节的消息长度),
+// 接收端每收到一个消息回复1个字节(控制发送窗口)
+// 输出发送端每发送1GB数据消耗的CPU时间
+//
+// NOTICE: 回环地址上内核总是回退到拷贝发送, 需要在两台机器上测试零拷贝的效果
+//      接收端: zerocopy -s [port]
+//      发送端: zerocopy [host] [port] [msgsize(KB)] [total(MB)]
+//
+
+#define WINDOW_SIZE 16
+
+struct sender
+{
+    sid_t id;
+    iolayer_t layer;
+    size_t msgsize;
+    size_t threshold;
+    uint64_t nmessages;
+    uint64_t nsent;
+    uint64_t nacked;
+    volatile int32_t done;
+};
+
+static int64_t cputime()
+{
+    struct rusage usage;
+    getrusage( RUSAGE_SELF, &usage );
+    return ( usage.ru_utime.tv_sec + usage.ru_stime.tv_sec ) * 1000000LL
+        + usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+}
+
+static int64_t walltime()
+{
+    struct timeval tv;
+    gettimeofday( &tv, NULL );
+    return tv.tv_sec * 1000000LL + tv.tv_usec;
+}
+
+static void sendnext( struct sender * s )
+{
+    // 由网络层接管缓冲区, 零拷贝发送时不需要复制
+    char * buf = (char *)malloc( s->msgsize );
+    uint64_t seq = s->nsent++;
+    memcpy( buf, &seq, sizeof( seq ) );
+    memcpy( buf + s->msgsize - sizeof( seq ), &seq, sizeof( seq ) );
+    iolayer_send( s->layer, s->id, buf, s->msgsize, 1 );
+}
+
+int32_t onStart( void * context )
+{
+    struct sender * s = (struct sender *)context;
+
+    if ( s->threshold > 0
+        && iolayer_set_zerocopy( s->layer, s->id, s->threshold ) != 0 ) {
+        printf( "MSG_ZEROCOPY isn't supported .\n" );
+    }
+
+    uint64_t msgsize = s->msgsize;
+    iolayer_send( s->layer, s->id, (const char *)&msgsize, sizeof( msgsize ), 0 );
+
+    for ( int32_t i = 0; i < WINDOW_SIZE && s->nsent < s->nmessages; ++i ) {
+        sendnext( s );
+    }
+
+    return 0;
+}
+
+ssize_t onProcess( void * context, const char * buf, size_t nbytes )
+{
+    struct sender * s = (struct sender *)context;
+
+    for ( size_t i = 0; i < nbytes; ++i ) {
+        if ( buf[i] != 1 ) {
+            printf( "the Sink found a corrupted message .\n" );
+            s->done = -1;
+            return -1;
+        }
+        ++s->nacked;
+        if ( s->nsent < s->nmessages ) {
+            sendnext( s );
+        }
+    }
+
+    if ( s->nacked == s->nmessages ) {
+        s->done = 1;
+    }
+
+    return nbytes;
+}
+
+char * onTransform( void * context, const char * buf, size_t * nbytes ) { return (char *)buf; }
+int32_t onTimeout( void * context ) { return -1; }
+int32_t onKeepalive( void * context ) { return 0; }
+int32_t onError( void * context, int32_t result ) { return -1; }
+void onShutdown( void * context, int32_t way ) {}
+int32_t onPerform( void * context, int32_t type, void * task, int32_t interval ) { return 0; }
+
+int32_t onConnect( void * context, void * local, int32_t result, const char * host, uint16_t port, sid_t id )
+{
+    struct sender * s = (struct sender *)context;
+
+    if ( result != 0 ) {
+        printf( "connect %s::%d failed .\n", host, port );
+        s->done = -1;
+        return -1;
+    }
+
+    ioservice_t ioservice = {
+        .start = onStart, .process = onProcess, .transform = onTransform,
+        .timeout = onTimeout, .keepalive = onKeepalive, .error = onError,
+        .shutdown = onShutdown, .perform = onPerform };
+
+    s->id = id;
+    iolayer_set_service( s->layer, id, &ioservice, s );
+    return 0;
+}
+
+static int32_t sink( uint16_t port, int32_t once )
+{
+    int32_t fd = socket( AF_INET, SOCK_STREAM, 0 );
+    int32_t flag = 1;
+    setsockopt( fd, SOL_SOCKET, SO_REUSEADDR, &flag, sizeof( flag ) );
+
+    struct sockaddr_in addr;
+    memset( &addr, 0, sizeof( addr ) );
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons( port );
+    addr.sin_addr.s_addr = htonl( INADDR_ANY );
+    if ( bind( fd, (struct sockaddr *)&addr, sizeof( addr ) ) != 0 || listen( fd, 8 ) != 0 ) {
+        printf( "sink listen %d failed .\n", port );
+        return -1;
+    }
+
+    for ( int32_t n = 0; once == 0 || n < once; ++n ) {
+        int32_t cfd = accept( fd, NULL, NULL );
+        if ( cfd < 0 ) {
+            continue;
+        }
+
+        uint64_t size = 0;
+        size_t length = 0, capacity = 8 << 20;
+        char * buf = (char *)malloc( capacity );
+        uint64_t expected = 0;
+
+        // 消息长度
+        if ( recv( cfd, &size, sizeof( size ), MSG_WAITALL ) != sizeof( size )
+            || size < 16 || size > capacity ) {
+            size = 0;
+        }
+
+        while ( size > 0 ) {
+            ssize_t nread = read( cfd, buf + length, capacity - length );
+            if ( nread <= 0 ) {
+                break;
+            }
+            length += nread;
+
+            while ( length >= size ) {
+                uint64_t head, tail;
+                memcpy( &head, buf, 8 );
+                memcpy( &tail, buf + size - 8, 8 );
+                char ack = ( head == expected && tail == expected ) ? 1 : 0;
+                if ( write( cfd, &ack, 1 ) != 1 ) {
+                    break;
+                }
+                ++expected;
+
+                memmove( buf, buf + size, length - size );
+                length -= size;
+            }
+        }
+
+        free( buf );
+        close( cfd );
+    }
+
+    close( fd );
+    return 0;
+}
+
+static int32_t run( const char * host, uint16_t port, size_t msgsize, size_t total, size_t threshold )
+{
+    struct sender s;
+    memset( &s, 0, sizeof( s ) );
+    s.msgsize = msgsize;
+    s.threshold = threshold;
+    s.nmessages = total / msgsize;
+
+    s.layer = iolayer_create( 1, 16, 8 );
+    if ( s.layer == NULL ) {
+        return -1;
+    }
+
+    int64_t startcpu = cputime();
+    int64_t start = walltime();
+
+    iolayer_connect( s.layer, host, port, onConnect, &s );
+    while ( s.done == 0 ) {
+        usleep( 1000 );
+    }
+
+    int64_t cpu = cputime() - startcpu;
+    int64_t elapsed = walltime() - start;
+    double gbytes = (double)( s.nmessages * msgsize ) / ( 1 << 30 );
+
+    if ( s.done > 0 ) {
+        printf( "%-9s msgsize=%5zuKB : %.2f GB in %6.1f ms, %7.1f MB/s, CPU %7.1f ms/GB\n",
+            threshold > 0 ? "zerocopy" : "copy", msgsize >> 10, gbytes,
+            elapsed / 1000.0, gbytes * 1024 * 1000000 / elapsed, cpu / 1000.0 / gbytes );
+    }
+
+    iolayer_shutdown( s.layer, s.id );
+    iolayer_stop( s.layer );
+    iolayer_destroy( s.layer );
+    return s.done > 0 ? 0 : -2;
+}
+
+int main( int32_t argc, char ** argv )
+{
+    signal( SIGPIPE, SIG_IGN );
+    openlog( "zerocopy", LOG_PERROR | LOG_PID, LOG_USER );
+
+    if ( argc == 3 && strcmp( argv[1], "-s" ) == 0 ) {
+        return sink( atoi( argv[2] ), 0 );
+    }
+
+    if ( argc != 1 && argc != 5 ) {
+        printf( "zerocopy -s [port]\n" );
+        printf( "zerocopy [host] [port] [msgsize(KB)] [total(MB)]\n" );
+        return -1;
+    }
+
+    const char * host = argc == 5 ? argv[1] : "127.0.0.1";
+    uint16_t port = argc == 5 ? atoi( argv[2] ) : 19527;
+    size_t total = (size_t)( argc == 5 ? atoi( argv[4] ) : 2048 ) << 20;
+
+    // 大块内存在堆上复用, 避免每个消息的缺页中断影响测试结果
+    mallopt( M_MMAP_THRESHOLD, 64 << 20 );
+    mallopt( M_TRIM_THRESHOLD, 256 << 20 );
+
+    pid_t child = -1;
+    if ( argc == 1 ) {
+        // 本机测试
+        child = fork();
+        if ( child == 0 ) {
+            return sink( port, 8 );
+        }
+        usleep( 100000 );
+        printf( "NOTICE: the kernel always copies on the loopback, zerocopy falls back to copy .\n" );
+    }
+
+    size_t sizes[] = { 64, 256, 1024, 4096 };
+    for ( size_t i = 0; i < sizeof( sizes ) / sizeof( sizes[0] ); ++i ) {
+        size_t msgsize = (size_t)( argc == 5 ? atoi( argv[3] ) : sizes[i] ) << 10;
+        run( host, port, msgsize, total, 0 );
+        run( host, port, msgsize, total, 64 << 10 );
+        if ( argc == 5 ) {
+            break;
+        }
+    }
+
+    if ( child > 0 ) {
+        kill( child, SIGTERM );
+        waitpid( child, NULL, 0 );
+    }
+
+    return 0;
+}